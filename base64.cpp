@@ -28,96 +28,117 @@
 #include "base64.h"
 #include <iostream>
 
-static const std::string base64_chars = 
+static const char base64_chars[] = 
              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
              "abcdefghijklmnopqrstuvwxyz"
              "0123456789+/";
 
 
-static inline bool is_base64(unsigned char c) {
-  return (isalnum(c) || (c == '+') || (c == '/'));
-}
+// Decoding table: value of each base64 character, or -1 for anything else
+// (including '=', which ends the data).
+static const signed char base64_values[256] = {
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+  52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1,
+  -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+  15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+  -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+  41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+void base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len, std::string& out) {
+  unsigned char const* in = bytes_to_encode;
+  char* p;
+
+  out.resize(4 * ((in_len + 2) / 3));
+  p = &out[0];
+
+  for (; in_len >= 3; in_len -= 3, in += 3) {
+    *p++ = base64_chars[in[0] >> 2];
+    *p++ = base64_chars[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+    *p++ = base64_chars[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+    *p++ = base64_chars[in[2] & 0x3f];
+  }
 
-std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-  std::string ret;
-  int i = 0;
-  int j = 0;
-  unsigned char char_array_3[3];
-  unsigned char char_array_4[4];
-
-  while (in_len--) {
-    char_array_3[i++] = *(bytes_to_encode++);
-    if (i == 3) {
-      char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-      char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-      char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-      char_array_4[3] = char_array_3[2] & 0x3f;
-
-      for(i = 0; (i <4) ; i++)
-        ret += base64_chars[char_array_4[i]];
-      i = 0;
+  if (in_len) {
+    *p++ = base64_chars[in[0] >> 2];
+    if (in_len == 1) {
+      *p++ = base64_chars[(in[0] & 0x03) << 4];
+      *p++ = '=';
     }
+    else {
+      *p++ = base64_chars[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+      *p++ = base64_chars[(in[1] & 0x0f) << 2];
+    }
+    *p++ = '=';
   }
+}
 
-  if (i)
-  {
-    for(j = i; j < 3; j++)
-      char_array_3[j] = '\0';
-
-    char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-    char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-    char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-    char_array_4[3] = char_array_3[2] & 0x3f;
-
-    for (j = 0; (j < i + 1); j++)
-      ret += base64_chars[char_array_4[j]];
-
-    while((i++ < 3))
-      ret += '=';
-
-  }
+std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
+  std::string ret;
 
+  base64_encode(bytes_to_encode, in_len, ret);
   return ret;
-
 }
 
-std::string base64_decode(std::string const& encoded_string) {
-  int in_len = encoded_string.size();
+int base64_decode(char const* encoded, unsigned int in_len, char* out, unsigned int out_len) {
+  unsigned char const* in = (unsigned char const*)encoded;
+  unsigned char const* end = in + in_len;
+  unsigned int o = 0;
+  unsigned int acc = 0;
   int i = 0;
-  int j = 0;
-  int in_ = 0;
-  unsigned char char_array_4[4], char_array_3[3];
-  std::string ret;
-
-  while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-    char_array_4[i++] = encoded_string[in_]; in_++;
-    if (i ==4) {
-      for (i = 0; i <4; i++)
-        char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-      char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-      char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-      char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-      for (i = 0; (i < 3); i++)
-        ret += char_array_3[i];
+  int v;
+
+  for (; in < end; ++in) {
+    v = base64_values[*in];
+    if (v < 0)
+      break;
+    acc = (acc << 6) | v;
+    if (++i == 4) {
+      if (out_len - o < 3)
+        return -1;
+      out[o++] = acc >> 16;
+      out[o++] = acc >> 8;
+      out[o++] = acc;
+      acc = 0;
       i = 0;
     }
   }
 
-  if (i) {
-    for (j = i; j <4; j++)
-      char_array_4[j] = 0;
+  // A partial quad of i characters holds i-1 bytes.
+  if (i > 1) {
+    if (out_len - o < (unsigned int)(i - 1))
+      return -1;
+    acc <<= 6 * (4 - i);
+    out[o++] = acc >> 16;
+    if (i == 3)
+      out[o++] = acc >> 8;
+  }
+
+  return o;
+}
 
-    for (j = 0; j <4; j++)
-      char_array_4[j] = base64_chars.find(char_array_4[j]);
+int base64_decode(std::string const& encoded_string, char* out, unsigned int out_len) {
+  return base64_decode(encoded_string.data(), encoded_string.size(), out, out_len);
+}
 
-    char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-    char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-    char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+void base64_decode(std::string const& encoded_string, std::string& out) {
+  out.resize(encoded_string.size() / 4 * 3 + 3);
+  out.resize(base64_decode(encoded_string, &out[0], out.size()));
+}
 
-    for (j = 0; (j < i - 1); j++) ret += char_array_3[j];
-  }
+std::string base64_decode(std::string const& encoded_string) {
+  std::string ret;
 
+  base64_decode(encoded_string, ret);
   return ret;
 }
@@ -23,6 +23,10 @@
 
    René Nyffenegger rene.nyffenegger@adp-gmbh.ch
 
+   Modified for CassFS: table-driven encode/decode, plus variants that work
+   in caller-supplied buffers so that a reused std::string keeps its
+   capacity instead of being reallocated for every block.
+
 */
 
 #include <string>
@@ -30,4 +34,10 @@
 std::string base64_encode(unsigned char const* , unsigned int len);
 std::string base64_decode(std::string const& s);
 
+void base64_encode(unsigned char const* , unsigned int len, std::string& out);
+void base64_decode(std::string const& s, std::string& out);
+// Returns the decoded length, or -1 if it would exceed out_len.
+int base64_decode(std::string const& s, char* out, unsigned int out_len);
+int base64_decode(char const* s, unsigned int in_len, char* out, unsigned int out_len);
+
 #define UCCP(x)	((unsigned char const *)x)
@@ -0,0 +1,718 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Drives CassFs directly, with no FUSE in the way, through a few simple
+// workloads, e.g. "cassfs_bench -s 4k -w seqwrite,randread".  By default
+// it runs against an in-memory store (see CfsMemConnector), which shows
+// what CassFs itself costs; -c host:port runs against a real cluster
+// instead.  Results go to stdout as JSON, one object per run, so they can
+// be collected and compared over time: per workload, throughput,
+// latency percentiles, and how many calls to the store each op took.
+// Log messages go to stdout too, so use -o to keep the JSON apart.
+//
+// -l adds simulated network latency to either (see CfsLatencyConnector),
+// e.g. -l normal:500:100/bw:100 for a round trip of about half a ms and a
+// 100 MB/s link.
+//
+// Writes go through a CfsWriteBuffer, the way the daemons do them.  Each
+// run starts with a fresh filesystem (-F, default "bench"), so don't point
+// this at one you care about.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TTransportUtils.h>
+#include "Cassandra.h"
+#include "cfs_types.h"
+#include "codec.h"
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace org::apache::cassandra;
+
+#include "connect.h"
+#include "cassfs.h"
+#include "log.h"
+#include "stats.h"
+#include "writebuf.h"
+
+#define SEQ_FILE	"/seq"
+#define CREATE_DIR	"/create"
+#define PATH_LEN	64
+
+struct BenchResult {
+	const char *		name;
+	unsigned long		ops;
+	unsigned long long	bytes;
+	uint64_t		ns;		// whole run, including any flush
+	vector<uint64_t>	lat;		// per op
+	uint64_t		rpcs[CFS_OP_COUNT];
+};
+
+typedef int bench_func_t (CassFs * cfs, BenchResult * res);
+
+// Settings, from the command line.
+static size_t		io_size		= 64 << 10;
+static size_t		file_size	= 16 << 20;
+static unsigned long	n_ops		= 1000;
+
+static FILE *		out;		// where the JSON goes
+
+// What's been set up so far.
+static bool		seq_ready;
+static unsigned long	n_created;
+static char *		io_buf;
+
+static size_t
+ParseSize (const char * arg)
+{
+	size_t	n;
+	
+	n = strtoul(arg,NULL,10);
+	if (strchr(arg,'k')) {
+		n <<= 10;
+	}
+	else if (strchr(arg,'m')) {
+		n <<= 20;
+	}
+	return n;
+}
+
+static void
+CreatePath (unsigned long i, char * path, size_t len)
+{
+	snprintf(path,len,"%s/f%07lu",CREATE_DIR,i);
+}
+
+static cfs_offset_t
+RandomOffset (void)
+{
+	return (cfs_offset_t)(random() % (file_size / io_size)) * io_size;
+}
+
+static void
+Fail (const char * what, int rc)
+{
+	fprintf(stderr,"%s failed: %s\n",what,strerror(rc));
+}
+
+// Writes the whole of SEQ_FILE, timing each write if res is given.
+static int
+WriteSeq (CassFs * cfs, BenchResult * res)
+{
+	char			path[]	= SEQ_FILE;
+	CfsFile *		file;
+	CfsWriteBuffer *	wbuf;
+	cfs_offset_t		off;
+	uint64_t		start;
+	int			rc;
+	
+	rc = cfs->Open(path,1,&file);
+	if (rc != 0) {
+		Fail("open " SEQ_FILE,rc);
+		return rc;
+	}
+	wbuf = new CfsWriteBuffer(cfs,file);
+	for (off = 0; off + io_size <= file_size; off += io_size) {
+		start = CfsNowNs();
+		rc = wbuf->Write(off,io_buf,io_size);
+		if (rc != 0) {
+			Fail("write",rc);
+			break;
+		}
+		if (res) {
+			res->lat.push_back(CfsNowNs()-start);
+			res->bytes += io_size;
+		}
+	}
+	if (rc == 0) {
+		rc = wbuf->Flush();
+		if (rc != 0) {
+			Fail("flush",rc);
+		}
+	}
+	delete wbuf;
+	cfs->Close(file);
+	if (rc == 0) {
+		seq_ready = true;
+	}
+	return rc;
+}
+
+static int
+SetupSeq (CassFs * cfs)
+{
+	return seq_ready ? 0 : WriteSeq(cfs,NULL);
+}
+
+static int
+CreateOne (CassFs * cfs, unsigned long i)
+{
+	char		path[PATH_LEN];
+	CfsFile *	file;
+	int		rc;
+	
+	CreatePath(i,path,sizeof(path));
+	rc = cfs->Open(path,1,&file);
+	if (rc != 0) {
+		Fail("create",rc);
+		return rc;
+	}
+	cfs->Close(file);
+	return 0;
+}
+
+static int
+SetupDir (CassFs * cfs)
+{
+	char	path[]	= CREATE_DIR;
+	int	rc;
+	
+	rc = cfs->Mkdir(path);
+	if ((rc != 0) && (rc != EEXIST)) {
+		Fail("mkdir " CREATE_DIR,rc);
+		return rc;
+	}
+	return 0;
+}
+
+// Makes sure there are files in CREATE_DIR to look up.
+static int
+SetupCreate (CassFs * cfs)
+{
+	int	rc;
+	
+	if (n_created) {
+		return 0;
+	}
+	rc = SetupDir(cfs);
+	if (rc != 0) {
+		return rc;
+	}
+	for (; n_created < n_ops; ++n_created) {
+		rc = CreateOne(cfs,n_created);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+	return 0;
+}
+
+static int
+SeqWrite (CassFs * cfs, BenchResult * res)
+{
+	return WriteSeq(cfs,res);
+}
+
+static int
+SeqRead (CassFs * cfs, BenchResult * res)
+{
+	char		path[]	= SEQ_FILE;
+	CfsFile *	file;
+	cfs_offset_t	off;
+	cfs_size_t	len;
+	uint64_t	start;
+	int		rc;
+	
+	rc = cfs->Open(path,0,&file);
+	if (rc != 0) {
+		Fail("open " SEQ_FILE,rc);
+		return rc;
+	}
+	for (off = 0; off + io_size <= file_size; off += io_size) {
+		start = CfsNowNs();
+		len = io_size;
+		rc = cfs->ReadFile(file,off,io_buf,len);
+		if (rc != 0) {
+			Fail("read",rc);
+			break;
+		}
+		res->lat.push_back(CfsNowNs()-start);
+		res->bytes += len;
+	}
+	cfs->Close(file);
+	return rc;
+}
+
+static int
+RandWrite (CassFs * cfs, BenchResult * res)
+{
+	char			path[]	= SEQ_FILE;
+	CfsFile *		file;
+	CfsWriteBuffer *	wbuf;
+	unsigned long		i;
+	uint64_t		start;
+	int			rc;
+	
+	rc = cfs->Open(path,0,&file);
+	if (rc != 0) {
+		Fail("open " SEQ_FILE,rc);
+		return rc;
+	}
+	wbuf = new CfsWriteBuffer(cfs,file);
+	for (i = 0; i < n_ops; ++i) {
+		start = CfsNowNs();
+		rc = wbuf->Write(RandomOffset(),io_buf,io_size);
+		if (rc != 0) {
+			Fail("write",rc);
+			break;
+		}
+		res->lat.push_back(CfsNowNs()-start);
+		res->bytes += io_size;
+	}
+	if (rc == 0) {
+		rc = wbuf->Flush();
+		if (rc != 0) {
+			Fail("flush",rc);
+		}
+	}
+	delete wbuf;
+	cfs->Close(file);
+	return rc;
+}
+
+static int
+RandRead (CassFs * cfs, BenchResult * res)
+{
+	char		path[]	= SEQ_FILE;
+	CfsFile *	file;
+	unsigned long	i;
+	cfs_size_t	len;
+	uint64_t	start;
+	int		rc;
+	
+	rc = cfs->Open(path,0,&file);
+	if (rc != 0) {
+		Fail("open " SEQ_FILE,rc);
+		return rc;
+	}
+	for (i = 0; i < n_ops; ++i) {
+		start = CfsNowNs();
+		len = io_size;
+		rc = cfs->ReadFile(file,RandomOffset(),io_buf,len);
+		if (rc != 0) {
+			Fail("read",rc);
+			break;
+		}
+		res->lat.push_back(CfsNowNs()-start);
+		res->bytes += len;
+	}
+	cfs->Close(file);
+	return rc;
+}
+
+// Creates n_ops more files in CREATE_DIR, i.e. in a growing directory.
+static int
+Create (CassFs * cfs, BenchResult * res)
+{
+	unsigned long	end	= n_created + n_ops;
+	uint64_t	start;
+	int		rc;
+	
+	rc = SetupDir(cfs);
+	if (rc != 0) {
+		return rc;
+	}
+	for (; n_created < end; ++n_created) {
+		start = CfsNowNs();
+		rc = CreateOne(cfs,n_created);
+		if (rc != 0) {
+			return rc;
+		}
+		res->lat.push_back(CfsNowNs()-start);
+	}
+	return 0;
+}
+
+static int
+LookupOne (CassFs * cfs, unsigned long i)
+{
+	char		path[PATH_LEN];
+	CfsInode	inode;
+	CfsInode *	inodep	= &inode;
+	int		rc;
+	
+	CreatePath(i,path,sizeof(path));
+	rc = cfs->LookupAll(path,&inodep);
+	if (rc != 0) {
+		Fail("lookup",rc);
+	}
+	return rc;
+}
+
+static int
+Lookup (CassFs * cfs, BenchResult * res)
+{
+	unsigned long	i;
+	uint64_t	start;
+	int		rc;
+	
+	for (i = 0; i < n_ops; ++i) {
+		start = CfsNowNs();
+		rc = LookupOne(cfs,random()%n_created);
+		if (rc != 0) {
+			return rc;
+		}
+		res->lat.push_back(CfsNowNs()-start);
+	}
+	return 0;
+}
+
+// Half reads, a fifth each writes and lookups, a tenth creates.
+static int
+Mixed (CassFs * cfs, BenchResult * res)
+{
+	char			path[]	= SEQ_FILE;
+	CfsFile *		file;
+	CfsWriteBuffer *	wbuf;
+	unsigned long		i;
+	int			pick;
+	cfs_size_t		len;
+	uint64_t		start;
+	int			rc	= 0;
+	
+	rc = cfs->Open(path,0,&file);
+	if (rc != 0) {
+		Fail("open " SEQ_FILE,rc);
+		return rc;
+	}
+	wbuf = new CfsWriteBuffer(cfs,file);
+	for (i = 0; (i < n_ops) && (rc == 0); ++i) {
+		pick = random() % 10;
+		start = CfsNowNs();
+		if (pick < 5) {
+			rc = wbuf->Flush();
+			if (rc == 0) {
+				len = io_size;
+				rc = cfs->ReadFile(file,RandomOffset(),io_buf,
+						   len);
+				res->bytes += len;
+			}
+		}
+		else if (pick < 7) {
+			rc = wbuf->Write(RandomOffset(),io_buf,io_size);
+			res->bytes += io_size;
+		}
+		else if (pick < 9) {
+			rc = LookupOne(cfs,random()%n_created);
+		}
+		else {
+			rc = CreateOne(cfs,n_created++);
+		}
+		if (rc == 0) {
+			res->lat.push_back(CfsNowNs()-start);
+		}
+	}
+	if (rc == 0) {
+		rc = wbuf->Flush();
+	}
+	if (rc != 0) {
+		Fail("mixed op",rc);
+	}
+	delete wbuf;
+	cfs->Close(file);
+	return rc;
+}
+
+static struct {
+	const char *	name;
+	bench_func_t *	func;
+	bool		needs_seq;
+	bool		needs_files;
+} workloads[] = {
+	{ "seqwrite",	SeqWrite,	false,	false	},
+	{ "seqread",	SeqRead,	true,	false	},
+	{ "randwrite",	RandWrite,	true,	false	},
+	{ "randread",	RandRead,	true,	false	},
+	{ "create",	Create,		false,	false	},
+	{ "lookup",	Lookup,		false,	true	},
+	{ "mixed",	Mixed,		true,	true	},
+	{ NULL }
+};
+
+static int
+RunWorkload (CassFs * cfs, int w, BenchResult * res)
+{
+	uint64_t	start;
+	int		op;
+	int		rc;
+	
+	if (workloads[w].needs_seq) {
+		rc = SetupSeq(cfs);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+	if (workloads[w].needs_files) {
+		rc = SetupCreate(cfs);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+	
+	res->name = workloads[w].name;
+	res->bytes = 0;
+	CfsStatsReset();
+	start = CfsNowNs();
+	rc = workloads[w].func(cfs,res);
+	res->ns = CfsNowNs() - start;
+	res->ops = res->lat.size();
+	for (op = CFS_OP_BE_GET; op < CFS_OP_COUNT; ++op) {
+		res->rpcs[op] = CfsStatOpCount(op);
+	}
+	return rc;
+}
+
+static double
+Percentile (vector<uint64_t> & lat, double pct)
+{
+	size_t	i;
+	
+	if (lat.empty()) {
+		return 0;
+	}
+	i = (size_t)(lat.size() * pct / 100.0);
+	if (i >= lat.size()) {
+		i = lat.size() - 1;
+	}
+	return lat[i] / 1000.0;
+}
+
+static void
+PrintResult (BenchResult * res, bool last)
+{
+	double	secs	= res->ns / 1e9;
+	int	op;
+	
+	sort(res->lat.begin(),res->lat.end());
+	fprintf(out,"    {\"workload\": \"%s\", \"ops\": %lu, "
+		"\"bytes\": %llu, \"seconds\": %.6f,\n",res->name,res->ops,
+		res->bytes,secs);
+	fprintf(out,"     \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f,\n",
+		res->ops / secs,res->bytes / secs / (1024 * 1024));
+	fprintf(out,"     \"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, "
+		"\"p999\": %.1f},\n",Percentile(res->lat,50),
+		Percentile(res->lat,99),Percentile(res->lat,99.9));
+	fprintf(out,"     \"rpcs_per_op\": {");
+	for (op = CFS_OP_BE_GET; op < CFS_OP_COUNT; ++op) {
+		fprintf(out,"%s\"%s\": %.2f",
+			(op == CFS_OP_BE_GET) ? "" : ", ",
+			CfsStatOpName(op) + 3,	// less "be_"
+			res->ops ? (double)res->rpcs[op] / res->ops : 0.0);
+	}
+	fprintf(out,"}}%s\n",last ? "" : ",");
+}
+
+static int
+ExitWithUsage (char * prog)
+{
+	int	w;
+	
+	fprintf(stderr,"Usage: %s [options]\n",prog);
+	fprintf(stderr,"  -c host:port   use Cassandra, not an in-memory store\n");
+	fprintf(stderr,"  -l spec        simulated latency, e.g. fixed:500/bw:100\n");
+	fprintf(stderr,"  -F name        filesystem to (re)make (bench)\n");
+	fprintf(stderr,"  -b bsize       block size (%u)\n",CFS_BLOCK_SIZE);
+	fprintf(stderr,"  -s size        I/O size (64k)\n");
+	fprintf(stderr,"  -f size        file size for I/O workloads (16m)\n");
+	fprintf(stderr,"  -n count       ops for the other workloads (1000)\n");
+	fprintf(stderr,"  -p writers     write pipeline threads (none)\n");
+	fprintf(stderr,"  -r seed        random seed (1)\n");
+	fprintf(stderr,"  -o file        write results there, not stdout\n");
+	fprintf(stderr,"  -w list        workloads, comma-separated, from:\n ");
+	for (w = 0; workloads[w].name; ++w) {
+		fprintf(stderr," %s",workloads[w].name);
+	}
+	fprintf(stderr,"\n");
+	return EINVAL;
+}
+
+int
+main (int argc, char ** argv)
+{
+	CfsConnector *		connector	= NULL;
+	const char *		backend		= "mem";
+	const char *		latency		= NULL;
+	CfsLatencySpec		lspec;
+	char *			fs_name		= (char *)"bench";
+	unsigned long		bsize		= CFS_BLOCK_SIZE;
+	int			writers		= 0;
+	const char *		wlist		= NULL;
+	vector<int>		todo;
+	vector<BenchResult *>	results;
+	CassFs *		cfs;
+	char *			colon;
+	char *			tok;
+	string			names;
+	int			opt;
+	int			w;
+	size_t			i;
+	int			rc;
+	
+	srandom(1);
+	out = stdout;
+	while ((opt = getopt(argc,argv,"c:l:F:b:s:f:n:p:r:w:o:")) != -1) {
+		switch (opt) {
+		case 'c':
+			backend = optarg;
+			colon = strchr(optarg,':');
+			if (!colon) {
+				return ExitWithUsage(argv[0]);
+			}
+			connector = new CfsThriftConnector(
+				string(optarg,colon-optarg).c_str(),
+				atoi(colon+1));
+			break;
+		case 'l':
+			latency = optarg;
+			if (CfsParseLatency(latency,&lspec) != 0) {
+				fprintf(stderr,"bad latency spec %s\n",latency);
+				return ExitWithUsage(argv[0]);
+			}
+			break;
+		case 'F':
+			fs_name = optarg;
+			break;
+		case 'b':
+			bsize = ParseSize(optarg);
+			break;
+		case 's':
+			io_size = ParseSize(optarg);
+			break;
+		case 'f':
+			file_size = ParseSize(optarg);
+			break;
+		case 'n':
+			n_ops = strtoul(optarg,NULL,10);
+			break;
+		case 'p':
+			writers = atoi(optarg);
+			break;
+		case 'r':
+			srandom(strtoul(optarg,NULL,10));
+			break;
+		case 'w':
+			wlist = optarg;
+			break;
+		case 'o':
+			out = fopen(optarg,"w");
+			if (!out) {
+				perror(optarg);
+				return errno;
+			}
+			break;
+		default:
+			return ExitWithUsage(argv[0]);
+		}
+	}
+	if (!io_size || (file_size < io_size) || !n_ops) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	if (wlist) {
+		names = wlist;
+		for (tok = strtok(&names[0],","); tok; tok = strtok(NULL,",")) {
+			for (w = 0; workloads[w].name; ++w) {
+				if (!strcmp(tok,workloads[w].name)) {
+					break;
+				}
+			}
+			if (!workloads[w].name) {
+				fprintf(stderr,"unknown workload %s\n",tok);
+				return ExitWithUsage(argv[0]);
+			}
+			todo.push_back(w);
+		}
+	}
+	else {
+		for (w = 0; workloads[w].name; ++w) {
+			todo.push_back(w);
+		}
+	}
+	
+	if (!connector) {
+		connector = new CfsMemConnector();
+	}
+	if (latency) {
+		connector = new CfsLatencyConnector(connector,true,lspec);
+	}
+	cfs_log_level = CFS_LOG_WARN;	// no superblock dumps, please
+	try {
+		cfs = new CassFs(connector);
+	}
+	catch (TException &tx) {
+		fprintf(stderr,"can't connect to %s: %s\n",backend,tx.what());
+		return EIO;
+	}
+	rc = cfs->Mkfs(fs_name,bsize,CFS_CODEC_NONE,0);
+	if (rc == 0) {
+		rc = cfs->MountFs(fs_name);
+	}
+	if ((rc == 0) && writers) {
+		rc = cfs->StartPipeline(writers,4*writers);
+	}
+	if (rc != 0) {
+		Fail("mkfs/mount",rc);
+		return rc;
+	}
+	io_buf = new char[io_size];
+	for (i = 0; i < io_size; ++i) {
+		io_buf[i] = random();
+	}
+	
+	for (i = 0; i < todo.size(); ++i) {
+		results.push_back(new BenchResult);
+		rc = RunWorkload(cfs,todo[i],results.back());
+		if (rc != 0) {
+			fprintf(stderr,"%s stopped early\n",
+				workloads[todo[i]].name);
+			break;
+		}
+	}
+	
+	fprintf(out,"{\"backend\": \"%s\", \"latency\": \"%s\", "
+		"\"block_size\": %lu, \"io_size\": %lu, \"file_size\": %lu, "
+		"\"count\": %lu, \"writers\": %d,\n",backend,
+		latency ? latency : "none",bsize,(unsigned long)io_size,
+		(unsigned long)file_size,n_ops,writers);
+	fprintf(out,"  \"results\": [\n");
+	for (i = 0; i < results.size(); ++i) {
+		PrintResult(results[i],i == results.size()-1);
+		delete results[i];
+	}
+	fprintf(out,"  ]}\n");
+	fclose(out);
+	
+	delete cfs;
+	delete connector;
+	delete [] io_buf;
+	return rc;
+}
@@ -0,0 +1,83 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+
+#include "bufpool.h"
+
+using namespace std;
+
+struct CfsBufList {
+	int		count;
+	string *	bufs[CFS_BUF_POOL_MAX];
+};
+
+static __thread CfsBufList *	my_list;
+static pthread_key_t		list_key;
+static pthread_once_t		list_once	= PTHREAD_ONCE_INIT;
+
+// Frees a thread's idle buffers when it exits.
+static void
+FreeList (void * arg)
+{
+	CfsBufList *	list	= (CfsBufList *)arg;
+	
+	while (list->count > 0) {
+		delete list->bufs[--list->count];
+	}
+	delete list;
+	my_list = NULL;
+}
+
+static void
+MakeKey (void)
+{
+	(void)pthread_key_create(&list_key,FreeList);
+}
+
+static CfsBufList *
+GetList (void)
+{
+	if (!my_list) {
+		(void)pthread_once(&list_once,MakeKey);
+		my_list = new CfsBufList;
+		my_list->count = 0;
+		(void)pthread_setspecific(list_key,my_list);
+	}
+	return my_list;
+}
+
+CfsBuf::CfsBuf ()
+{
+	CfsBufList *	list	= GetList();
+	
+	str = list->count ? list->bufs[--list->count] : new string;
+}
+
+CfsBuf::~CfsBuf ()
+{
+	CfsBufList *	list	= GetList();
+	
+	if (list->count < CFS_BUF_POOL_MAX) {
+		str->clear();
+		list->bufs[list->count++] = str;
+	}
+	else {
+		delete str;
+	}
+}
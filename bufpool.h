@@ -0,0 +1,44 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Reusable scratch buffers for block I/O.  Every block read or written
+// passes through a few temporaries (base64 text, encoded block, decoded
+// block) that are as big as the block itself.  A CfsBuf borrows a string
+// from a per-thread free list and gives it back, capacity intact, when it
+// goes out of scope, so once a thread is warmed up a block costs no heap
+// allocations and threads never contend for the allocator over them.  Use
+// the buffer-reusing base64 and codec calls (which resize rather than
+// assign a new string) or the capacity is lost anyway.
+
+#include <string>
+
+#define CFS_BUF_POOL_MAX	8	// idle buffers kept per thread
+
+class CfsBuf {
+private:
+	std::string *	str;
+	
+		CfsBuf		(const CfsBuf &);	// not copyable
+	void	operator=	(const CfsBuf &);
+	
+public:
+		CfsBuf		();
+		~CfsBuf		();
+	std::string &	operator*	(void) { return *str; }
+	std::string *	operator->	(void) { return str; }
+};
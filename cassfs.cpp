@@ -17,8 +17,16 @@
 */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/statvfs.h>
 #include <iostream>
+#include <set>
 
 #include <boost/shared_ptr.hpp>
 #include <protocol/TBinaryProtocol.h>
@@ -26,7 +34,10 @@
 #include <transport/TTransportUtils.h>
 #include "Cassandra.h"
 #include "base64.h"
+#include "bufpool.h"
 #include "cfs_types.h"
+#include "codec.h"
+#include "sha256.h"
 
 using namespace std;
 using namespace boost;
@@ -35,45 +46,214 @@ using namespace apache::thrift::protocol;
 using namespace apache::thrift::transport;
 using namespace org::apache::cassandra;
 
+#include "connect.h"
 #include "cassfs.h"
+#include "log.h"
+#include "pipeline.h"
+#include "reclaim.h"
 
-#define THRIFT_HOST "localhost"
-#define THRIFT_PORT 9160
+// Deepest directory tree we'll walk up through.
+#define CFS_MAX_DEPTH		1024
 
-inline void
+// Most block data to ask for in one multiget.
+#define CFS_READ_BATCH_BYTES	(4 * 1024 * 1024)
+
+// Usage changes to count up before writing out our shard (on the next
+// superblock write), how long statfs may reuse the totals, and how many
+// shards it reads at a time.
+#define CFS_USAGE_BATCH		64
+#define CFS_USAGE_CACHE_SECS	2
+#define CFS_USAGE_PAGE		1000
+// Held while folding other processes' usage columns (see ClaimUsageShard).
+#define CFS_USAGE_LOCK		"/tmp/.cassfs_usage_lock"
+
+// Holds a mutex for the rest of the enclosing scope, exceptions and all.
+class CfsLocker {
+private:
+	pthread_mutex_t *	mutex;
+public:
+	CfsLocker	(pthread_mutex_t * a_mutex) : mutex(a_mutex)
+	{
+		pthread_mutex_lock(mutex);
+	}
+	~CfsLocker	()
+	{
+		pthread_mutex_unlock(mutex);
+	}
+};
+
+void
 IndexToDataKey (cfs_block_idx index, char * pfx, char * key)
 {
 	snprintf(key,CFS_MAX_KEY_LEN,"%s_d_%0*d",
 		pfx, CFS_INDEX_DIGITS, index);
 }
 
-inline void
+void
 IndexToInodeKey (cfs_block_idx index, char * pfx, char * key)
 {
 	snprintf(key,CFS_MAX_KEY_LEN,"%s_i_%0*d",
 		pfx, CFS_INDEX_DIGITS, index);
 }
 
+// Where name is in a directory's entries, or n if it isn't there.
+size_t
+CfsFindEntry (const CfsDirEntry * ents, size_t n, const char * name)
+{
+	size_t	i;
+	
+	for (i = 0; i < n; ++i) {
+		if (!strcmp(ents[i].name,name)) {
+			break;
+		}
+	}
+	return i;
+}
+
+// The reverse: the index is whatever follows the last '_'.
+inline cfs_block_idx
+InodeKeyToIndex (const char * key)
+{
+	const char *	num	= rindex(key,'_');
+	
+	return num ? strtoul(num+1,NULL,10) : 0;
+}
+
+// Hashes a block's contents and returns its content record key.
+static void
+ContentKey (const char * data, size_t len, char * pfx, string & key)
+{
+	static const char	hex[]	= "0123456789abcdef";
+	unsigned char		digest[CFS_SHA256_LEN];
+	int			i;
+	
+	cfs_sha256(data,len,digest);
+	key = pfx;
+	key += "_c_";
+	for (i = 0; i < CFS_SHA256_LEN; ++i) {
+		key += hex[digest[i]>>4];
+		key += hex[digest[i]&0xf];
+	}
+}
+
+// Inodes written before the version field existed are a little shorter,
+// and read as version 0.
+static bool
+DecodeInode (const string & b64data, CfsInode * inodep)
+{
+	int	len;
+	
+	len = base64_decode(b64data,(char *)inodep,sizeof(*inodep));
+	if (len == (int)CFS_INODE_MIN_SIZE) {
+		inodep->version = 0;
+		return true;
+	}
+	return len == (int)sizeof(*inodep);
+}
+
+// Returns log2(bsize), or -1 if bsize isn't a block size we support.
+static int
+BlockShift (unsigned long bsize)
+{
+	if ((bsize < CFS_MIN_BLOCK_SIZE) || (bsize > CFS_MAX_BLOCK_SIZE)) {
+		return -1;
+	}
+	if (bsize & (bsize - 1)) {
+		return -1;
+	}
+	return __builtin_ctzl(bsize);
+}
+
 CassFs::CassFs () :
-	socket(new TSocket(THRIFT_HOST, THRIFT_PORT)),
-	transport(new TBufferedTransport(socket)),
-	protocol(new TBinaryProtocol(transport))
+	connector(new CfsTimedConnector(
+		new CfsThriftConnector(THRIFT_HOST, THRIFT_PORT),true))
+{
+	Init();
+}
+
+CassFs::CassFs (CfsConnector * a_connector) :
+	connector(new CfsTimedConnector(a_connector,false))
+{
+	Init();
+}
+
+void
+CassFs::Init (void)
 {
 	mytable			= "Keyspace1";
 	mycolumn.column_family	= "Standard1";
 	mycolumn.column		= "data";
 	mycolumn.__isset.column	= true;
+	hashcolumn.column_family = "Standard1";
+	hashcolumn.column	= "hash";
+	hashcolumn.__isset.column = true;
+	myrow.column_family	= "Standard1";
 	timestamp		= time(NULL);
 	
-	client		= new CassandraClient(protocol);
-	transport->open();
+	client		= connector->Connect();
+	pipe		= NULL;
+	reclaimer	= NULL;
+	pthread_mutex_init(&ref_lock,NULL);
+	pthread_mutex_init(&open_lock,NULL);
+	pthread_mutex_init(&usage_lock,NULL);
 	
 	mounted = 0;
+	crc_errors = 0;
+	usage_slot = -1;
+	memset(&usage_mine,0,sizeof(usage_mine));
+	memset(&usage_delta,0,sizeof(usage_delta));
+	usage_changes = 0;
+	memset(&usage_total,0,sizeof(usage_total));
+	usage_time = 0;
 }
 
 CassFs::~CassFs ()
 {
-	transport->close();
+	delete reclaimer;
+	delete pipe;
+	ReleaseUsageShard();
+	connector->Disconnect(client);
+	delete connector;
+}
+
+// Sends data blocks written through WriteFile to the store from nthreads
+// worker threads (each with its own connection), with up to window blocks
+// outstanding at once.  Only plain (non-dedup) stores are pipelined.
+int
+CassFs::StartPipeline (int nthreads, int window)
+{
+	if (pipe || (nthreads < 1) || (window < 1)) {
+		return EINVAL;
+	}
+	try {
+		pipe = new CfsPipeline(this,connector,nthreads,window);
+	}
+	catch (TException &tx) {
+		CFS_ERROR("could not start write pipeline: " << tx.what());
+		return EIO;
+	}
+	CFS_INFO("write pipeline: " << nthreads << " threads, window "
+	         << window);
+	return 0;
+}
+
+// Frees the space of unlinked files and removed directories in the
+// background, at up to rate removals per second (see reclaim.h).
+int
+CassFs::StartReclaimer (int rate)
+{
+	if (reclaimer || (rate < 1)) {
+		return EINVAL;
+	}
+	try {
+		reclaimer = new CfsReclaimer(this,connector,rate);
+	}
+	catch (TException &tx) {
+		CFS_ERROR("could not start reclaimer: " << tx.what());
+		return EIO;
+	}
+	CFS_INFO("reclaimer: " << rate << " removals/sec");
+	return 0;
 }
 
 // TBD
@@ -93,9 +273,314 @@ CassFs::WriteSuperBlock (void)
 	sb_name += "_sb";
 	
 	b64data = base64_encode(UCCP(&sb),sizeof(sb));
-	cout << "writing " << sb_name << endl;
-	client->insert(mytable,sb_name,mycolumn,b64data,timestamp++,ONE);
+	CFS_DEBUG("writing " << sb_name);
+	client->insert(mytable,sb_name,mycolumn,b64data,NextStamp(),ONE);
+	
+	if (usage_changes >= CFS_USAGE_BATCH) {
+		FlushUsage();
+	}
+	return 0;
+}
+
+// Usage column slots taken by CassFs objects in this process.
+static pthread_mutex_t	shard_lock	= PTHREAD_MUTEX_INITIALIZER;
+static set<int>		shard_slots;
+
+// Reads the whole usage row, a page at a time.
+void
+CassFs::ReadUsage (vector<ColumnOrSuperColumn> & shards)
+{
+	vector<ColumnOrSuperColumn>	page;
+	ColumnParent			parent;
+	SlicePredicate			pred;
+	
+	parent.column_family = myrow.column_family;
+	pred.slice_range.start = "";
+	pred.slice_range.finish = "";
+	pred.slice_range.reversed = false;
+	pred.slice_range.count = CFS_USAGE_PAGE;
+	pred.__isset.slice_range = true;
+	shards.clear();
+	for (;;) {
+		client->get_slice(page,mytable,string(sb.prefix)+"_us",
+				  parent,pred,ONE);
+		// After the first page, the first column is the last one
+		// we've seen.
+		shards.insert(shards.end(),
+			      page.begin() + (shards.empty() ? 0 : 1),
+			      page.end());
+		if (page.size() < CFS_USAGE_PAGE) {
+			break;
+		}
+		pred.slice_range.start = page.back().column.name;
+	}
+}
+
+static bool
+DecodeUsage (const Column & col, CfsUsage * usagep)
+{
+	string	rdata	= base64_decode(col.value);
+	
+	if (rdata.size() != sizeof(*usagep)) {
+		CFS_WARN("got " << rdata.size() << "/" << sizeof(*usagep)
+		         << " for usage shard " << col.name);
+		return false;
+	}
+	memcpy(usagep,rdata.data(),sizeof(*usagep));
+	return true;
+}
+
+// Whether a usage column (host:pid:slot) belongs to a CassFs that's gone,
+// which we can only tell for our own host.
+static bool
+ShardIsDead (const string & name, const char * host)
+{
+	size_t	colon1	= name.rfind(':');
+	size_t	colon2;
+	int	pid;
+	int	slot;
+	
+	if ((colon1 == string::npos) || (colon1 == 0)) {
+		return false;
+	}
+	colon2 = name.rfind(':',colon1-1);
+	if ((colon2 == string::npos) || name.compare(0,colon2,host)) {
+		return false;
+	}
+	if (sscanf(name.c_str()+colon2+1,"%d:%d",&pid,&slot) != 2) {
+		return false;
+	}
+	if (pid == (int)getpid()) {
+		return !shard_slots.count(slot);
+	}
+	return (kill(pid,0) < 0) && (errno == ESRCH);
+}
+
+// Takes the lowest column slot no other CassFs in this process has, and
+// starts from what that column already says.  Columns left by processes on
+// this host that have since exited are folded into ours (and removed), so
+// the row only grows with the number of clients running at once.  The lock
+// file keeps two processes from folding the same column.
+void
+CassFs::ClaimUsageShard (void)
+{
+	CfsLocker			guard(&shard_lock);
+	vector<ColumnOrSuperColumn>	shards;
+	vector<ColumnOrSuperColumn>	dead;
+	ColumnPath			ucol	= myrow;
+	CfsUsage			mine;
+	CfsUsage			shard;
+	char				host[64];
+	char				name[128];
+	string				b64data;
+	int				lockfd;
+	int				slot;
+	size_t				i;
+	
+	for (slot = 0; shard_slots.count(slot); ++slot) {
+	}
+	if (gethostname(host,sizeof(host)) != 0) {
+		strcpy(host,"unknown");
+	}
+	host[sizeof(host)-1] = '\0';
+	snprintf(name,sizeof(name),"%s:%d:%d",host,(int)getpid(),slot);
+	
+	lockfd = open(CFS_USAGE_LOCK,O_RDWR|O_CREAT,0666);
+	if (lockfd >= 0) {
+		(void)flock(lockfd,LOCK_EX);
+	}
+	memset(&mine,0,sizeof(mine));
+	try {
+		ReadUsage(shards);
+		for (i = 0; i < shards.size(); ++i) {
+			const Column &	col	= shards[i].column;
+			
+			// Whoever wrote these may have counted further
+			// ahead, and we're about to overwrite or remove.
+			SkipStamp(col.timestamp);
+			if (col.name == name) {
+				if (DecodeUsage(col,&shard)) {
+					mine.blocks += shard.blocks;
+					mine.inodes += shard.inodes;
+				}
+			}
+			else if ((lockfd >= 0) && ShardIsDead(col.name,host)) {
+				if (DecodeUsage(col,&shard)) {
+					mine.blocks += shard.blocks;
+					mine.inodes += shard.inodes;
+				}
+				dead.push_back(shards[i]);
+			}
+		}
+		if (!dead.empty()) {
+			ucol.column = name;
+			ucol.__isset.column = true;
+			b64data = base64_encode(UCCP(&mine),sizeof(mine));
+			client->insert(mytable,string(sb.prefix)+"_us",ucol,
+				       b64data,NextStamp(),ONE);
+			for (i = 0; i < dead.size(); ++i) {
+				ucol.column = dead[i].column.name;
+				client->remove(mytable,string(sb.prefix)+"_us",
+					       ucol,NextStamp(),ONE);
+			}
+			CFS_INFO("folded " << dead.size() << " old usage shards");
+		}
+	}
+	catch (TException &tx) {
+		if (lockfd >= 0) {
+			close(lockfd);
+		}
+		throw;
+	}
+	if (lockfd >= 0) {
+		close(lockfd);
+	}
+	
+	shard_slots.insert(slot);
+	usage_slot = slot;
+	usage_shard = name;
+	usage_mine = mine;
+}
+
+// Writes our running totals, with the changes counted so far, to our
+// shard (claiming one first if need be).  Nobody else writes it, so
+// there's nothing to read first.  If anything throws, the changes stay
+// queued for next time.
+void
+CassFs::FlushUsage (void)
+{
+	CfsLocker	guard(&usage_lock);
+	ColumnPath	ucol	= myrow;
+	CfsUsage	delta;
+	CfsUsage	shard;
+	unsigned long	changes;
+	string		b64data;
+	
+	changes = usage_changes;
+	delta = usage_delta;
+	if (!delta.blocks && !delta.inodes) {
+		return;
+	}
+	if (usage_slot < 0) {
+		ClaimUsageShard();
+	}
+	shard.blocks = usage_mine.blocks + delta.blocks;
+	shard.inodes = usage_mine.inodes + delta.inodes;
+	ucol.column = usage_shard;
+	ucol.__isset.column = true;
+	b64data = base64_encode(UCCP(&shard),sizeof(shard));
+	client->insert(mytable,string(sb.prefix)+"_us",ucol,b64data,
+		       NextStamp(),ONE);
+	
+	usage_mine = shard;
+	__sync_fetch_and_sub(&usage_delta.blocks,delta.blocks);
+	__sync_fetch_and_sub(&usage_delta.inodes,delta.inodes);
+	__sync_fetch_and_sub(&usage_changes,changes);
+	
+	// Keep the cached totals in step, so statfs sees them right away.
+	usage_total.blocks += delta.blocks;
+	usage_total.inodes += delta.inodes;
+}
+
+// For when we're done with this filesystem (unmount, or mounting another),
+// so there's no later chance to try again.  Our column is left for the
+// next CassFs to take over.
+void
+CassFs::ReleaseUsageShard (void)
+{
+	if (mounted) {
+		try {
+			FlushUsage();
+		}
+		catch (TException &tx) {
+			CFS_WARN("lost usage counts (" << usage_delta.blocks
+				 << " blocks, " << usage_delta.inodes
+				 << " inodes): " << tx.what());
+		}
+	}
+	
+	pthread_mutex_lock(&shard_lock);
+	if (usage_slot >= 0) {
+		shard_slots.erase(usage_slot);
+	}
+	pthread_mutex_unlock(&shard_lock);
+	
+	pthread_mutex_lock(&usage_lock);
+	usage_slot = -1;
+	usage_shard.clear();
+	memset(&usage_mine,0,sizeof(usage_mine));
+	(void)__sync_lock_test_and_set(&usage_delta.blocks,0);
+	(void)__sync_lock_test_and_set(&usage_delta.inodes,0);
+	(void)__sync_lock_test_and_set(&usage_changes,0);
+	pthread_mutex_unlock(&usage_lock);
+}
+
+// Blocks and inodes are never really full, but there are only so many
+// indices for them (CFS_MAX_INDEX), and those are never reused.  So what's
+// free is whatever index space is left, and the total is that plus what's
+// in use according to the usage counters.
+// Adds up every client's shard of the usage row.
+void
+CassFs::SumUsage (void)
+{
+	vector<ColumnOrSuperColumn>	shards;
+	CfsUsage			shard;
+	CfsUsage			total;
+	size_t				i;
+	
+	ReadUsage(shards);
+	memset(&total,0,sizeof(total));
+	for (i = 0; i < shards.size(); ++i) {
+		if (DecodeUsage(shards[i].column,&shard)) {
+			total.blocks += shard.blocks;
+			total.inodes += shard.inodes;
+		}
+	}
+	usage_total = total;
+}
+
+int
+CassFs::Statfs (struct statvfs * stp)
+{
+	time_t		now	= time(NULL);
+	CfsUsage	used;
+	
+	if (!mounted) {
+		return ENODEV;
+	}
+	
+	if ((now - usage_time) >= CFS_USAGE_CACHE_SECS) {
+		// If the store won't answer, make do with what we had.
+		try {
+			FlushUsage();
+			SumUsage();
+			usage_time = now;
+		}
+		catch (TException &tx) {
+			CFS_WARN("can't update usage: " << tx.what());
+		}
+	}
+	
+	// Our own changes since then count too.
+	used.blocks = usage_total.blocks + usage_delta.blocks;
+	used.inodes = usage_total.inodes + usage_delta.inodes;
+	if (used.blocks < 0) {
+		used.blocks = 0;
+	}
+	if (used.inodes < 0) {
+		used.inodes = 0;
+	}
 	
+	memset(stp,0,sizeof(*stp));
+	stp->f_bsize = sb.block_size;
+	stp->f_frsize = sb.block_size;
+	stp->f_bfree = CFS_MAX_INDEX - sb.next_dalloc;
+	stp->f_bavail = stp->f_bfree;
+	stp->f_blocks = stp->f_bfree + used.blocks;
+	stp->f_ffree = CFS_MAX_INDEX - sb.next_ialloc;
+	stp->f_favail = stp->f_ffree;
+	stp->f_files = stp->f_ffree + used.inodes;
+	stp->f_namemax = CFS_MAX_NAME_LEN - 1;
 	return 0;
 }
 
@@ -104,14 +589,15 @@ CassFs::MountFs (char * prefix)
 {
 	string			sb_name;
 	string			sbdata;
-	string			ridata;
 	ColumnOrSuperColumn	waste;
 	
 	if (mounted && !strcmp(sb.prefix,prefix)) {
-		cout << "already mounted " << prefix << endl;
+		CFS_INFO("already mounted " << prefix);
 		return 0;
 	}
+	ReleaseUsageShard();	// while sb still says where
 	mounted = 0;
+	usage_time = 0;
 	
 	sb_name = prefix;
 	sb_name += "_sb";
@@ -120,40 +606,60 @@ CassFs::MountFs (char * prefix)
 		client->get(waste,mytable,sb_name,mycolumn,ONE);
 	}
 	catch (NotFoundException &tx) {
-		cout << "missing superblock" << endl;
+		CFS_ERROR("missing superblock");
 		return EIO;
 	}
 	
 	sbdata = base64_decode(waste.column.value);
-	if (sbdata.size() != sizeof(sb)) {
-		cout << "got " << sbdata.size() << "/" << sizeof(sb)
-		     << " for superblock" << endl;
+	if ((sbdata.size() < CFS_SB_MIN_SIZE) || (sbdata.size() > sizeof(sb))) {
+		CFS_ERROR("got " << sbdata.size() << "/" << sizeof(sb)
+		          << " for superblock");
+		return EIO;
+	}
+	memset(&sb,0,sizeof(sb));
+	memcpy(&sb,sbdata.data(),sbdata.size());
+	if (!sb.block_size) {
+		sb.block_size = CFS_BLOCK_SIZE;
+	}
+	block_shift = BlockShift(sb.block_size);
+	if (block_shift < 0) {
+		CFS_ERROR("bad block size " << sb.block_size);
 		return EIO;
 	}
-	memcpy(&sb,sbdata.data(),sizeof(sb));
-	cout << "prefix = " << sb.prefix << endl;
-	cout << "root_dir_key = " << sb.root_dir_key << endl;
-	cout << "next_ialloc = " << sb.next_ialloc << endl;
-	cout << "next_dalloc = " << sb.next_dalloc << endl;
+	CFS_INFO("prefix = " << sb.prefix);
+	CFS_INFO("root_dir_key = " << sb.root_dir_key);
+	CFS_INFO("next_ialloc = " << sb.next_ialloc);
+	CFS_INFO("next_dalloc = " << sb.next_dalloc);
+	CFS_INFO("block_size = " << sb.block_size);
+	if (sb.features & CFS_FEAT_BLOCK_HDR) {
+		CFS_INFO("codec = " << CfsCodecName(sb.codec));
+		if (CfsCodecByName(CfsCodecName(sb.codec)) < 0) {
+			CFS_ERROR("codec not supported by this build");
+			return ENOTSUP;
+		}
+	}
+	if (sb.features & CFS_FEAT_DEDUP) {
+		CFS_INFO("dedup enabled");
+	}
+	if (sb.features & CFS_FEAT_CRC32C) {
+		CFS_INFO("checksums enabled");
+	}
 	
 	try {
 		client->get(waste,mytable,sb.root_dir_key,mycolumn,ONE);
 	}
 	catch (NotFoundException &tx) {
-		cout << "missing root inode" << endl;
+		CFS_ERROR("missing root inode");
 	}
 	
-	ridata = base64_decode(waste.column.value);
-	if (ridata.size() != sizeof(root)) {
-		cout << "got " << ridata.size() << "/" << sizeof(root)
-		     << " for root inode" << endl;
+	if (!DecodeInode(waste.column.value,&root)) {
+		CFS_ERROR("bad size for root inode");
 		return EIO;
 	}
-	memcpy(&root,ridata.data(),sizeof(root));
-	cout << "root data = " << root.data << endl;
+	CFS_DEBUG("root data = " << root.data);
 	
 	if (!S_ISDIR(root.type)) {
-		cout << "root is not a dir?!?" << endl;
+		CFS_ERROR("root is not a dir?!?");
 	}
 
 	mounted = 1;
@@ -166,8 +672,8 @@ CassFs::LookupOne (CfsInode * parent, char * elem, CfsInode * child)
 	CfsDirEntry *		r_data;
 	string			rddata;
 	ColumnOrSuperColumn	waste;
-	int			i;
-	string			idata;
+	size_t			i;
+	size_t			n;
 	char			data_key[CFS_MAX_KEY_LEN];
 	
 	try {
@@ -175,42 +681,37 @@ CassFs::LookupOne (CfsInode * parent, char * elem, CfsInode * child)
 		client->get(waste,mytable,data_key,mycolumn,ONE);
 	}
 	catch (NotFoundException &tx) {
-		cout << "missing directory data" << endl;
+		CFS_ERROR("missing directory data");
 		return EIO;
 	}
 	
 	rddata = base64_decode(waste.column.value);
 	if (rddata.size() % sizeof(*r_data)) {
-		cout << "got " << rddata.size() << "%" << sizeof(*r_data)
-		     << " for dir " << data_key << endl;
+		CFS_ERROR("got " << rddata.size() << "%" << sizeof(*r_data)
+		          << " for dir " << data_key);
 		return EIO;
 	}
 	r_data = (CfsDirEntry *)rddata.data();
+	n = rddata.size() / sizeof(*r_data);
 	
-	for (i = 0; i < rddata.size(); i += sizeof(*r_data),++r_data) {
-		if (!strcmp(r_data->name,elem)) {
-			break;
-		}
-	}
-	if (i >= rddata.size()) {
-		cout << "elem " << elem << " not found" << endl;
+	i = CfsFindEntry(r_data,n,elem);
+	if (i >= n) {
+		CFS_DEBUG("elem " << elem << " not found");
 		return ENOENT;
 	}
+	r_data += i;
 	
 	try {
 		client->get(waste,mytable,r_data->inode_key,mycolumn,ONE);
 	}
 	catch (NotFoundException &tx) {
-		cout << "missing inode " << r_data->inode_key << " " << endl;
+		CFS_ERROR("missing inode " << r_data->inode_key);
 	}
 	
-	idata = base64_decode(waste.column.value);
-	if (idata.size() != sizeof(*child)) {
-		cout << "got " << idata.size() << "/" << sizeof(*child)
-		     << " for inode " << r_data->inode_key << endl;
+	if (!DecodeInode(waste.column.value,child)) {
+		CFS_ERROR("bad size for inode " << r_data->inode_key);
 		return EIO;
 	}
-	memcpy(child,idata.data(),sizeof(*child));
 	
 	return 0;
 }
@@ -252,10 +753,10 @@ CassFs::LookupAll (char * path, CfsInode ** an_inode_p)
 			continue;
 		}
 		if (!S_ISDIR(cur_inode->type)) {
-			cout << "tried to traverse non-dir " << elem << endl;
+			CFS_DEBUG("tried to traverse non-dir " << elem);
 			return 0;
 		}
-		cout << "descend into " << elem << endl;
+		CFS_DEBUG("descend into " << elem);
 		rc = LookupOne(cur_inode,elem,new_inode);
 		if (rc != 0) {
 			return rc;
@@ -275,28 +776,41 @@ CassFs::CreateDir (char * parent_key, char * inode_key, cfs_block_idx data_idx)
 	string		b64data;
 	char		data_key[CFS_MAX_KEY_LEN];
 	
+	int		i;
+	
 	r_inode.type = S_IFDIR;
+	r_inode.size = 0;
+	r_inode.version = 0;
 	r_inode.data[0] = data_idx;
+	for (i = 1; i < CFS_MAX_BLOCKS; ++i) {
+		r_inode.data[i] = CFS_NO_BLOCK;
+	}
 	b64data = base64_encode(UCCP(&r_inode),sizeof(r_inode));
-	cout << "writing " << inode_key << endl;
-	client->insert(mytable,inode_key,mycolumn,b64data,timestamp++,ONE);
+	CFS_DEBUG("writing " << inode_key);
+	client->insert(mytable,inode_key,mycolumn,b64data,NextStamp(),ONE);
 	
+	memset(r_data,0,sizeof(r_data));
 	CopyName(r_data[0].name,".");
 	CopyKey(r_data[0].inode_key,inode_key);
+	r_data[0].inum = InodeKeyToIndex(inode_key);
+	r_data[0].mode = S_IFDIR;
 	CopyName(r_data[1].name,"..");
 	CopyKey(r_data[1].inode_key,parent_key);
+	r_data[1].inum = InodeKeyToIndex(parent_key);
+	r_data[1].mode = S_IFDIR;
 	b64data = base64_encode(UCCP(&r_data),sizeof(r_data));
 	IndexToDataKey(data_idx,sb.prefix,data_key);
-	cout << "writing " << data_key << endl;
-	client->insert(mytable,data_key,mycolumn,b64data,timestamp++,ONE);
+	CFS_DEBUG("writing " << data_key);
+	client->insert(mytable,data_key,mycolumn,b64data,NextStamp(),ONE);
 	
+	CountUsage(1,1);
 	return 0;
 }
 
 void
 CassFs::Put (char * key, char * value)
 {	
-	client->insert(mytable,key,mycolumn,value,timestamp++,ONE);
+	client->insert(mytable,key,mycolumn,value,NextStamp(),ONE);
 }
 
 int
@@ -306,11 +820,11 @@ CassFs::Get (ColumnOrSuperColumn &waste, char * key)
 		client->get(waste,mytable,key,mycolumn,ONE);
 	}
 	catch (NotFoundException &tx) {
-		cout << "no such key" << endl;
+		CFS_DEBUG("no such key");
 		return EIO;
 	}
 	catch (TException &tx) {
-		cout << "unknown exception " << tx.what() << endl;
+		CFS_ERROR("unknown exception " << tx.what());
 		return EIO;
 	}
 	
@@ -320,25 +834,49 @@ CassFs::Get (ColumnOrSuperColumn &waste, char * key)
 void
 CassFs::Del (char * key)
 {
-	client->remove(mytable,key,mycolumn,timestamp++,ONE);
+	client->remove(mytable,key,mycolumn,NextStamp(),ONE);
 }
 	
 int
-CassFs::Mkfs (char * prefix)
+CassFs::Mkfs (char * prefix, unsigned long block_size, int codec,
+	      unsigned long features)
 {
 	string		sb_name;
 	string		b64data;
 	int		rc;
 		
 	if (strlen(prefix) > CFS_MAX_PREFIX_LEN) {
-		cerr << "prefix too long" << endl;
+		CFS_ERROR("prefix too long");
 		return E2BIG;
 	}
 	
+	if (BlockShift(block_size) < 0) {
+		CFS_ERROR("block size must be a power of two from "
+		          << CFS_MIN_BLOCK_SIZE << " to " << CFS_MAX_BLOCK_SIZE);
+		return EINVAL;
+	}
+	
+	// Anything we just created isn't mounted any more.
+	ReleaseUsageShard();
+	mounted = 0;
+	usage_time = 0;
+	memset(&sb,0,sizeof(sb));
 	CopyName(sb.prefix,prefix);
 	IndexToInodeKey(1,prefix,sb.root_dir_key);
 	sb.next_ialloc = 2;
 	sb.next_dalloc = 1;
+	sb.block_size = block_size;
+	sb.features = features;
+	sb.codec = codec;
+	if ((codec != CFS_CODEC_NONE) || (features & CFS_FEAT_CRC32C)) {
+		sb.features |= CFS_FEAT_BLOCK_HDR;
+	}
+	
+	// Counts left over from an earlier filesystem of the same name would
+	// only confuse statfs.
+	sb_name = prefix;
+	sb_name += "_us";
+	client->remove(mytable,sb_name,myrow,NextStamp(),ONE);
 	
 	rc = CreateDir(sb.root_dir_key,sb.root_dir_key,0);
 	if (rc != 0) {
@@ -350,441 +888,1709 @@ CassFs::Mkfs (char * prefix)
 		return rc;
 	}
 	
+	FlushUsage();
 	return 0;
 }
 
 int
 CassFs::Mkdir (char * path)
 {
-	CfsDirEntry *		r_data;
-	string			rddata;
-	ColumnOrSuperColumn	waste;
-	int			i;
-	int			rc;
-	CfsInode		my_inode;
-	CfsInode *		cur_inode	= &my_inode;
-	char *			split;
-	char			inode_key[CFS_MAX_KEY_LEN];
-	char			pdata_key[CFS_MAX_KEY_LEN];
-	CfsDirEntry *		new_dir;
-	CfsDirEntry *		new_data;
-	string			b64data;
-	
-	split = rindex(path,'/');
-	if (!split || (split[1] == '\0')) {
-		cout << "no new path component" << endl;
-		return EINVAL;
-	}
-	*(split++) = '\0';
+	char *	name;
+	char	pdata_key[CFS_MAX_KEY_LEN];
+	int	rc;
 	
 	if (!mounted) {
 		return ENODEV;
 	}
-
-	rc = LookupAll(path,&cur_inode);
+	rc = LookupParent(path,&name,pdata_key);
 	if (rc != 0) {
 		return rc;
 	}
+	return MkdirIn(pdata_key,name,NULL);
+}
+
+// Creates directory name in the directory whose data is at pdata_key, and
+// returns its new entry in *entp (if entp isn't NULL).
+int
+CassFs::MkdirIn (char * pdata_key, char * name, CfsDirEntry * entp)
+{
+	CfsDirEntry *	r_data;
+	CfsDirEntry	new_ent;
+	string		rddata;
+	string		b64data;
+	size_t		n;
+	int		rc;
+	char		inode_key[CFS_MAX_KEY_LEN];
 	
-	try {
-		IndexToDataKey(cur_inode->data[0],sb.prefix,pdata_key);
-		client->get(waste,mytable,pdata_key,mycolumn,ONE);
-	}
-	catch (NotFoundException &tx) {
-		cout << "missing dir contents for mkdir" << endl;
+	if (strlen(name) >= CFS_MAX_NAME_LEN) {
+		return ENAMETOOLONG;
 	}
-	
-	rddata = base64_decode(waste.column.value);
-	if (rddata.size() % sizeof(*r_data)) {
-		cout << "got " << rddata.size() << "%" << sizeof(*r_data)
-		     << " for dir " << pdata_key << endl;
-		return EIO;
+	rc = GetDirData(pdata_key,rddata);
+	if (rc != 0) {
+		return rc;
 	}
 	r_data = (CfsDirEntry *)rddata.data();
-	
-	for (i = 0; i < (rddata.size() / sizeof(*r_data)); ++i) {
-		if (!strcmp(r_data->name,split)) {
-			cout << split << " already exists" << endl;
-			return EEXIST;
-		}
-		++r_data;
+	n = rddata.size() / sizeof(*r_data);
+	if (CfsFindEntry(r_data,n,name) < n) {
+		CFS_DEBUG(name << " already exists");
+		return EEXIST;
 	}
 	
-	cout << "checked " << i << " entries" << endl;
-	
-	r_data = (CfsDirEntry *)rddata.data();	// reset to get . entry
+	// r_data[0] is the parent's "." entry.
 	IndexToInodeKey(sb.next_ialloc++,sb.prefix,inode_key);
-	rc = CreateDir(r_data->inode_key,inode_key,sb.next_dalloc++);
+	rc = CreateDir(r_data[0].inode_key,inode_key,sb.next_dalloc++);
 	if (rc != 0) {
 		return rc;
 	}
-
-	new_dir = (CfsDirEntry *)malloc(sizeof(*new_dir)*(i+1));
-	if (!new_dir) {
-		cout << "could not allocate expanded directory" << endl;
-		return ENOMEM;
-	}
-	memcpy(new_dir,r_data,rddata.size());
 	
-	new_data = new_dir + i;
-	CopyName(new_data->name,split);
-	CopyKey(new_data->inode_key,inode_key);
-	new_data->inum = sb.next_ialloc - 1;
-	new_data->mode = S_IFDIR;
-	b64data = base64_encode(UCCP(new_dir),sizeof(*new_dir)*(i+1));
-	cout << "rewriting " << pdata_key << " with " << i+1
-	     << " entries" << endl;
-	client->insert(mytable,pdata_key,mycolumn,b64data,timestamp++,ONE);
+	memset(&new_ent,0,sizeof(new_ent));
+	CopyName(new_ent.name,name);
+	CopyKey(new_ent.inode_key,inode_key);
+	new_ent.inum = sb.next_ialloc - 1;
+	new_ent.mode = S_IFDIR;
+	rddata.append((char *)&new_ent,sizeof(new_ent));
+	b64data = base64_encode(UCCP(rddata.data()),rddata.size());
+	CFS_DEBUG("rewriting " << pdata_key << " with " << n+1
+	          << " entries");
+	client->insert(mytable,pdata_key,mycolumn,b64data,NextStamp(),ONE);
 	
 	(void)WriteSuperBlock();	// ... to update the alloc indices
+	if (entp) {
+		*entp = new_ent;
+	}
 	return 0;
 }
 
 int
-CassFs::List (char * path, cfs_list_cb_t * cb)
+CassFs::GetDirData (const char * data_key, string & rddata)
 {
-	CfsDirEntry *		r_data;
-	string			rddata;
 	ColumnOrSuperColumn	waste;
-	int			i;
-	int			rc;
-	CfsInode		my_inode;
-	CfsInode *		cur_inode	= &my_inode;
-	char			data_key[CFS_MAX_KEY_LEN];
-	
-	if (!mounted) {
-		return ENODEV;
-	}
-	
-	rc = LookupAll(path,&cur_inode);
-	if (rc != 0) {
-		return rc;
-	}
-	
-	if (!S_ISDIR(cur_inode->type)) {
-		cout << path << " not a directory" << endl;
-		return 0;
-	}
 	
 	try {
-		IndexToDataKey(cur_inode->data[0],sb.prefix,data_key);
 		client->get(waste,mytable,data_key,mycolumn,ONE);
 	}
 	catch (NotFoundException &tx) {
-		cout << "missing dir contents for list" << endl;
-	}
-	
-	rddata = base64_decode(waste.column.value);
-	if (rddata.size() % sizeof(*r_data)) {
-		cout << "got " << rddata.size() << "%" << sizeof(*r_data)
-		     << " for dir " << data_key << endl;
+		CFS_ERROR("missing dir contents " << data_key);
 		return EIO;
 	}
-	r_data = (CfsDirEntry *)rddata.data();
 	
-	for (i = 0; i < rddata.size(); i += sizeof(*r_data),++r_data) {
-		cb(r_data->name,r_data->inum,r_data->mode);
+	base64_decode(waste.column.value,rddata);
+	if (rddata.size() % sizeof(CfsDirEntry)) {
+		CFS_ERROR("got " << rddata.size() << "%" << sizeof(CfsDirEntry)
+		          << " for dir " << data_key);
+		return EIO;
 	}
-	
 	return 0;
 }
 
 int
-CassFs::OpenFile (char * dir_key, char * fn, int create,
-		  char * inode_key, CfsInode * inodep)
+CassFs::GetInode (const char * inode_key, CfsInode * inodep)
 {
 	ColumnOrSuperColumn	waste;
-	string			rddata;
-	CfsDirEntry *		r_data;
-	int			i;
-	string			b64data;
-	CfsDirEntry *		new_dir;
-	int			found		= 0;
-
+	
 	try {
-		client->get(waste,mytable,dir_key,mycolumn,ONE);
+		client->get(waste,mytable,inode_key,mycolumn,ONE);
 	}
 	catch (NotFoundException &tx) {
-		cout << "missing dir contents for " << dir_key << endl;
+		CFS_WARN("missing inode " << inode_key);
+		return ENOENT;
 	}
 	
-	rddata = base64_decode(waste.column.value);
-	if (rddata.size() % sizeof(*r_data)) {
-		cout << "got " << rddata.size() << "%" << sizeof(*r_data)
-		     << " for dir " << dir_key << endl;
+	if (!DecodeInode(waste.column.value,inodep)) {
+		CFS_ERROR("bad size for inode " << inode_key);
 		return EIO;
 	}
-	r_data = (CfsDirEntry *)rddata.data();
-	
-	for (i = 0; i < (rddata.size() / sizeof(*r_data)); ++i) {
-		if (!strcmp(r_data->name,fn)) {
-			found = 1;
-			break;
+	return 0;
+}
+
+void
+CassFs::InodeKey (cfs_block_idx inum, char * inode_key)
+{
+	IndexToInodeKey(inum,sb.prefix,inode_key);
+}
+
+cfs_block_idx
+CassFs::InodeIndex (const char * inode_key)
+{
+	return InodeKeyToIndex(inode_key);
+}
+
+void
+CassFs::DirDataKey (const CfsInode * inodep, char * data_key)
+{
+	IndexToDataKey(inodep->data[0],sb.prefix,data_key);
+}
+
+// Finds the directory holding path's last component, which is returned in
+// namep (pointing into path).  That has to be a real name, not "." or "..".
+int
+CassFs::LookupParent (char * path, char ** namep, char * pdata_key)
+{
+	CfsInode	my_inode;
+	CfsInode *	cur_inode	= &my_inode;
+	char *		split;
+	int		rc;
+	
+	split = rindex(path,'/');
+	if (!split || (split[1] == '\0')) {
+		CFS_DEBUG("no path component in " << path);
+		return EINVAL;
+	}
+	if (!strcmp(split+1,".") || !strcmp(split+1,"..")) {
+		return EINVAL;
+	}
+	
+	*split = '\0';
+	rc = LookupAll(path,&cur_inode);
+	*(split++) = '/';
+	if (rc != 0) {
+		return rc;
+	}
+	if (!S_ISDIR(cur_inode->type)) {
+		return ENOTDIR;
+	}
+	
+	IndexToDataKey(cur_inode->data[0],sb.prefix,pdata_key);
+	*namep = split;
+	return 0;
+}
+
+// Returns 0 if the directory has nothing but "." and "..", else ENOTEMPTY
+// (or whatever went wrong looking).
+int
+CassFs::CheckEmptyDir (const char * inode_key)
+{
+	CfsInode	my_inode;
+	string		rddata;
+	char		data_key[CFS_MAX_KEY_LEN];
+	int		rc;
+	
+	rc = GetInode(inode_key,&my_inode);
+	if (rc != 0) {
+		return rc;
+	}
+	IndexToDataKey(my_inode.data[0],sb.prefix,data_key);
+	rc = GetDirData(data_key,rddata);
+	if (rc != 0) {
+		return rc;
+	}
+	if (rddata.size() > (2 * sizeof(CfsDirEntry))) {
+		return ENOTEMPTY;
+	}
+	return 0;
+}
+
+// Finds name in the directory whose data is at pdata_key.
+int
+CassFs::LookupIn (char * pdata_key, char * name, CfsDirEntry * entp)
+{
+	CfsDirEntry *	r_data;
+	string		rddata;
+	size_t		i;
+	size_t		n;
+	int		rc;
+	
+	rc = GetDirData(pdata_key,rddata);
+	if (rc != 0) {
+		return rc;
+	}
+	r_data = (CfsDirEntry *)rddata.data();
+	n = rddata.size() / sizeof(*r_data);
+	i = CfsFindEntry(r_data,n,name);
+	if (i >= n) {
+		return ENOENT;
+	}
+	*entp = r_data[i];
+	return 0;
+}
+
+// Drops path's directory entry and queues its inode for reclaiming (see
+// reclaim.h), so that removing even a huge file costs two small writes.
+// With rmdir, path must be an empty directory; otherwise it must not be a
+// directory at all.
+int
+CassFs::RemoveEntry (char * path, bool rmdir)
+{
+	char *	name;
+	char	pdata_key[CFS_MAX_KEY_LEN];
+	int	rc;
+	
+	if (!mounted) {
+		return ENODEV;
+	}
+	if (!strcmp(path,"/")) {
+		return rmdir ? EBUSY : EISDIR;
+	}
+	
+	rc = LookupParent(path,&name,pdata_key);
+	if (rc != 0) {
+		return rc;
+	}
+	return RemoveIn(pdata_key,name,rmdir,true,NULL);
+}
+
+// The guts of RemoveEntry, for a name in the directory whose data is at
+// pdata_key.  The removed entry is returned in *victimp (if not NULL).
+// Without reclaim, the caller has to queue the inode itself.  Files still
+// open here are safe either way (see CfsOpenCount).
+int
+CassFs::RemoveIn (char * pdata_key, char * name, bool rmdir, bool reclaim,
+		  CfsDirEntry * victimp)
+{
+	CfsDirEntry *		r_data;
+	CfsDirEntry		victim;
+	string			rddata;
+	string			b64data;
+	size_t			i;
+	size_t			n;
+	int			rc;
+	
+	rc = GetDirData(pdata_key,rddata);
+	if (rc != 0) {
+		return rc;
+	}
+	r_data = (CfsDirEntry *)rddata.data();
+	n = rddata.size() / sizeof(*r_data);
+	i = CfsFindEntry(r_data,n,name);
+	if (i >= n) {
+		CFS_DEBUG("elem " << name << " not found");
+		return ENOENT;
+	}
+	victim = r_data[i];
+	
+	if (!rmdir) {
+		if (S_ISDIR(victim.mode)) {
+			return EISDIR;
+		}
+	}
+	else {
+		if (!S_ISDIR(victim.mode)) {
+			return ENOTDIR;
+		}
+		rc = CheckEmptyDir(victim.inode_key);
+		if (rc != 0) {
+			return rc;
 		}
-		++r_data;
 	}
 	
-	if (found) {
-		CopyKey(inode_key,r_data->inode_key);
-		cout << "fetching " << inode_key << endl;
-		try {
-			client->get(waste,mytable,inode_key,mycolumn,ONE);
-		}
-		catch (NotFoundException &tx) {
-			cout << "missing inode " << inode_key << endl;
-		}
-		b64data = base64_decode(waste.column.value);
-		if (b64data.size() != sizeof(*inodep)) {
-			cout << "got " << b64data.size() << "/"
-			     << sizeof(*inodep) << " for " << inode_key << endl;
-			     return EIO;
-		}
-		memcpy(inodep,b64data.data(),sizeof(*inodep));
-		if (!S_ISREG(inodep->type)) {
-			cout << "writing to non-file type "
-			     << hex << inodep->type << endl;
-			return EISDIR;
+	rddata.erase(i*sizeof(*r_data),sizeof(*r_data));
+	b64data = base64_encode(UCCP(rddata.data()),rddata.size());
+	CFS_DEBUG("rewriting " << pdata_key << " with " << n-1
+	          << " entries");
+	client->insert(mytable,pdata_key,mycolumn,b64data,NextStamp(),ONE);
+	
+	if (reclaim) {
+		QueueReclaim(victim.inode_key);
+	}
+	if (victimp) {
+		*victimp = victim;
+	}
+	return 0;
+}
+
+int
+CassFs::Unlink (char * path)
+{
+	return RemoveEntry(path,false);
+}
+
+int
+CassFs::Rmdir (char * path)
+{
+	return RemoveEntry(path,true);
+}
+
+int
+CassFs::Rename (char * from, char * to)
+{
+	char *	src_name;
+	char *	dst_name;
+	char	sdata_key[CFS_MAX_KEY_LEN];
+	char	ddata_key[CFS_MAX_KEY_LEN];
+	int	rc;
+	
+	if (!mounted) {
+		return ENODEV;
+	}
+	rc = LookupParent(from,&src_name,sdata_key);
+	if (rc != 0) {
+		return rc;
+	}
+	rc = LookupParent(to,&dst_name,ddata_key);
+	if (rc != 0) {
+		return rc;
+	}
+	return RenameIn(sdata_key,src_name,ddata_key,dst_name,true,NULL);
+}
+
+// Walks up from the directory whose data is at data_key, by way of the
+// ".." entries, to make sure that inode_key isn't on the way to the root.
+int
+CassFs::CheckNotUnder (char * data_key, const char * inode_key)
+{
+	CfsDirEntry *	r_data;
+	CfsInode	my_inode;
+	string		rddata;
+	char		cur_key[CFS_MAX_KEY_LEN];
+	int		depth;
+	int		rc;
+	
+	CopyKey(cur_key,data_key);
+	for (depth = 0; depth < CFS_MAX_DEPTH; ++depth) {
+		rc = GetDirData(cur_key,rddata);
+		if (rc != 0) {
+			return rc;
+		}
+		if (rddata.size() < (2 * sizeof(*r_data))) {
+			CFS_ERROR("no .. in " << cur_key);
+			return EIO;
+		}
+		r_data = (CfsDirEntry *)rddata.data();
+		if (!strcmp(r_data[0].inode_key,inode_key)) {
+			CFS_DEBUG("can't move " << inode_key
+			          << " under itself");
+			return EINVAL;
+		}
+		if (!strcmp(r_data[0].inode_key,sb.root_dir_key)) {
+			return 0;
+		}
+		rc = GetInode(r_data[1].inode_key,&my_inode);
+		if (rc != 0) {
+			return rc;
+		}
+		IndexToDataKey(my_inode.data[0],sb.prefix,cur_key);
+	}
+	return ELOOP;
+}
+
+// Moves the entry for src_name (in the directory whose data is at
+// sdata_key) to dst_name (likewise at ddata_key), replacing whatever is
+// there the way rename(2) does.  The inode keeps its key, so no inode or
+// data is copied; only directory data changes.  Within one directory
+// that's one write.  Across two it's the target and then the source (and
+// a moved directory's ".." entry).  Cassandra can't batch writes to
+// different rows, so dying in between leaves the entry in both places
+// rather than in neither.  A replaced entry is returned in *replacedp (if
+// not NULL) with an empty inode_key if there was none; reclaim is as for
+// RemoveIn.
+int
+CassFs::RenameIn (char * sdata_key, char * src_name, char * ddata_key,
+		  char * dst_name, bool reclaim, CfsDirEntry * replacedp)
+{
+	CfsDirEntry *		s_ents;
+	CfsDirEntry *		d_ents;
+	CfsDirEntry		moving;
+	CfsDirEntry		replaced;
+	CfsDirEntry *		dotdot;
+	CfsInode		my_inode;
+	string			sdata;
+	string			ddata;
+	string			cdata;
+	string			b64data;
+	char			cdata_key[CFS_MAX_KEY_LEN];
+	size_t			si;
+	size_t			di;
+	size_t			sn;
+	size_t			dn;
+	bool			same_dir;
+	int			rc;
+	
+	if (replacedp) {
+		replacedp->inode_key[0] = '\0';
+	}
+	if (strlen(dst_name) >= CFS_MAX_NAME_LEN) {
+		return ENAMETOOLONG;
+	}
+	
+	rc = GetDirData(sdata_key,sdata);
+	if (rc != 0) {
+		return rc;
+	}
+	s_ents = (CfsDirEntry *)sdata.data();
+	sn = sdata.size() / sizeof(*s_ents);
+	si = CfsFindEntry(s_ents,sn,src_name);
+	if (si >= sn) {
+		CFS_DEBUG("elem " << src_name << " not found");
+		return ENOENT;
+	}
+	moving = s_ents[si];
+	
+	same_dir = !strcmp(sdata_key,ddata_key);
+	if (same_dir) {
+		ddata = sdata;
+	}
+	else {
+		rc = GetDirData(ddata_key,ddata);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+	if (S_ISDIR(moving.mode) && !same_dir) {
+		rc = CheckNotUnder(ddata_key,moving.inode_key);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+	d_ents = (CfsDirEntry *)ddata.data();
+	dn = ddata.size() / sizeof(*d_ents);
+	di = CfsFindEntry(d_ents,dn,dst_name);
+	if (di < dn) {
+		replaced = d_ents[di];
+		if (!strcmp(replaced.inode_key,moving.inode_key)) {
+			return 0;	// same file, nothing to do
+		}
+		if (S_ISDIR(moving.mode)) {
+			if (!S_ISDIR(replaced.mode)) {
+				return ENOTDIR;
+			}
+			rc = CheckEmptyDir(replaced.inode_key);
+			if (rc != 0) {
+				return rc;
+			}
+		}
+		else if (S_ISDIR(replaced.mode)) {
+			return EISDIR;
+		}
+	}
+	
+	if (same_dir) {
+		CopyName(s_ents[si].name,dst_name);
+		if (di < dn) {
+			sdata.erase(di*sizeof(*s_ents),sizeof(*s_ents));
+		}
+		b64data = base64_encode(UCCP(sdata.data()),sdata.size());
+		CFS_DEBUG("rewriting " << sdata_key);
+		client->insert(mytable,sdata_key,mycolumn,b64data,NextStamp(),
+			       ONE);
+	}
+	else {
+		CopyName(moving.name,dst_name);
+		if (di < dn) {
+			d_ents[di] = moving;
+		}
+		else {
+			ddata.append((char *)&moving,sizeof(moving));
+		}
+		b64data = base64_encode(UCCP(ddata.data()),ddata.size());
+		CFS_DEBUG("rewriting " << ddata_key);
+		client->insert(mytable,ddata_key,mycolumn,b64data,NextStamp(),
+			       ONE);
+		
+		sdata.erase(si*sizeof(*s_ents),sizeof(*s_ents));
+		b64data = base64_encode(UCCP(sdata.data()),sdata.size());
+		CFS_DEBUG("rewriting " << sdata_key);
+		client->insert(mytable,sdata_key,mycolumn,b64data,NextStamp(),
+			       ONE);
+		
+		if (S_ISDIR(moving.mode)) {
+			rc = GetInode(moving.inode_key,&my_inode);
+			if (rc != 0) {
+				return rc;
+			}
+			IndexToDataKey(my_inode.data[0],sb.prefix,cdata_key);
+			rc = GetDirData(cdata_key,cdata);
+			if (rc != 0) {
+				return rc;
+			}
+			if (cdata.size() < (2 * sizeof(CfsDirEntry))) {
+				CFS_ERROR("no .. in " << cdata_key);
+				return EIO;
+			}
+			// ddata starts with the target directory's "." entry.
+			d_ents = (CfsDirEntry *)ddata.data();
+			dotdot = (CfsDirEntry *)&cdata[sizeof(CfsDirEntry)];
+			CopyKey(dotdot->inode_key,d_ents[0].inode_key);
+			dotdot->inum = d_ents[0].inum;
+			b64data = base64_encode(UCCP(cdata.data()),cdata.size());
+			client->insert(mytable,cdata_key,mycolumn,b64data,
+				       NextStamp(),ONE);
+		}
+	}
+	
+	if (di < dn) {
+		if (reclaim) {
+			QueueReclaim(replaced.inode_key);
+		}
+		if (replacedp) {
+			*replacedp = replaced;
+		}
+	}
+	return 0;
+}
+
+// Fetches all the entries of the directory at path, packed as stored.
+int
+CassFs::ReadDir (char * path, string & rddata)
+{
+	CfsInode	my_inode;
+	CfsInode *	cur_inode	= &my_inode;
+	char		data_key[CFS_MAX_KEY_LEN];
+	int		rc;
+	
+	if (!mounted) {
+		return ENODEV;
+	}
+	rc = LookupAll(path,&cur_inode);
+	if (rc != 0) {
+		return rc;
+	}
+	if (!S_ISDIR(cur_inode->type)) {
+		return ENOTDIR;
+	}
+	IndexToDataKey(cur_inode->data[0],sb.prefix,data_key);
+	return GetDirData(data_key,rddata);
+}
+
+int
+CassFs::List (char * path, cfs_list_cb_t * cb)
+{
+	CfsDirEntry *		r_data;
+	string			rddata;
+	ColumnOrSuperColumn	waste;
+	int			i;
+	int			rc;
+	CfsInode		my_inode;
+	CfsInode *		cur_inode	= &my_inode;
+	char			data_key[CFS_MAX_KEY_LEN];
+	
+	if (!mounted) {
+		return ENODEV;
+	}
+	
+	rc = LookupAll(path,&cur_inode);
+	if (rc != 0) {
+		return rc;
+	}
+	
+	if (!S_ISDIR(cur_inode->type)) {
+		CFS_DEBUG(path << " not a directory");
+		return 0;
+	}
+	
+	try {
+		IndexToDataKey(cur_inode->data[0],sb.prefix,data_key);
+		client->get(waste,mytable,data_key,mycolumn,ONE);
+	}
+	catch (NotFoundException &tx) {
+		CFS_ERROR("missing dir contents for list");
+	}
+	
+	rddata = base64_decode(waste.column.value);
+	if (rddata.size() % sizeof(*r_data)) {
+		CFS_ERROR("got " << rddata.size() << "%" << sizeof(*r_data)
+		          << " for dir " << data_key);
+		return EIO;
+	}
+	r_data = (CfsDirEntry *)rddata.data();
+	
+	for (i = 0; i < rddata.size(); i += sizeof(*r_data),++r_data) {
+		cb(r_data->name,r_data->inum,r_data->mode);
+	}
+	
+	return 0;
+}
+
+int
+CassFs::OpenFile (char * dir_key, char * fn, int create,
+		  char * inode_key, CfsInode * inodep)
+{
+	ColumnOrSuperColumn	waste;
+	string			rddata;
+	CfsDirEntry *		r_data;
+	size_t			i;
+	size_t			n;
+	string			b64data;
+	CfsDirEntry *		new_dir;
+	int			found		= 0;
+
+	try {
+		client->get(waste,mytable,dir_key,mycolumn,ONE);
+	}
+	catch (NotFoundException &tx) {
+		CFS_ERROR("missing dir contents for " << dir_key);
+	}
+	
+	rddata = base64_decode(waste.column.value);
+	if (rddata.size() % sizeof(*r_data)) {
+		CFS_ERROR("got " << rddata.size() << "%" << sizeof(*r_data)
+		          << " for dir " << dir_key);
+		return EIO;
+	}
+	r_data = (CfsDirEntry *)rddata.data();
+	n = rddata.size() / sizeof(*r_data);
+	
+	i = CfsFindEntry(r_data,n,fn);
+	if (i < n) {
+		found = 1;
+		r_data += i;
+	}
+	
+	if (found) {
+		CopyKey(inode_key,r_data->inode_key);
+		CFS_DEBUG("fetching " << inode_key);
+		try {
+			client->get(waste,mytable,inode_key,mycolumn,ONE);
+		}
+		catch (NotFoundException &tx) {
+			CFS_WARN("missing inode " << inode_key);
+		}
+		if (!DecodeInode(waste.column.value,inodep)) {
+			CFS_ERROR("bad size for " << inode_key);
+			return EIO;
+		}
+		if (!S_ISREG(inodep->type)) {
+			CFS_DEBUG("writing to non-file type "
+			          << hex << inodep->type);
+			return EISDIR;
+		}
+	}
+	else {
+		if (!create) {
+			return ENOENT;
+		}
+		CFS_DEBUG("creating new " << fn);
+		IndexToInodeKey(sb.next_ialloc++,sb.prefix,inode_key);
+			
+		new_dir = (CfsDirEntry *)malloc(sizeof(*new_dir)*(i+1));
+		if (!new_dir) {
+			CFS_ERROR("could not allocate expanded directory");
+			return ENOMEM;
+		}
+		memcpy(new_dir,rddata.data(),rddata.size());
+		
+		CopyName(new_dir[i].name,fn);
+		CopyKey(new_dir[i].inode_key,inode_key);
+		new_dir[i].inum = sb.next_ialloc - 1;
+		new_dir[i].mode = S_IFREG;
+		b64data = base64_encode(UCCP(new_dir),sizeof(*new_dir)*(i+1));
+		CFS_DEBUG("rewriting " << dir_key << " with " << i+1
+		          << " entries");
+		client->insert(mytable,dir_key,mycolumn,b64data,NextStamp(),ONE);
+		free(new_dir);
+		
+		inodep->type = S_IFREG;
+		inodep->size = 0;
+		inodep->version = 0;
+		for (i = 0; i < CFS_MAX_BLOCKS; ++i) {
+			inodep->data[i] = CFS_NO_BLOCK;
+		}
+		b64data = base64_encode(UCCP(inodep),sizeof(*inodep));
+		CFS_DEBUG("writing " << inode_key);
+		client->insert(mytable,inode_key,mycolumn,b64data,NextStamp(),ONE);
+		CountUsage(0,1);
+		(void)WriteSuperBlock();	// ... to update next_ialloc
+	}
+	
+	return 0;
+}
+
+// Decodes bytes [off,off+len) of whatever b64data encodes, touching only
+// the base64 characters that cover them.  The caller makes sure they exist.
+static int
+DecodeRange (const string & b64data, cfs_offset_t off, cfs_size_t len,
+	     char * out)
+{
+	const char *	in	= b64data.data() + (off / 3) * 4;
+	char		tmp[3];
+	cfs_size_t	skip	= off % 3;
+	cfs_size_t	n;
+	
+	// Leading partial group.
+	if (skip) {
+		n = (len < (3 - skip)) ? len : (3 - skip);
+		if (base64_decode(in,4,tmp,3) < (int)(skip + n)) {
+			return EIO;
+		}
+		memcpy(out,tmp+skip,n);
+		in += 4;
+		out += n;
+		len -= n;
+	}
+	
+	// Whole groups go straight to out.
+	n = len - (len % 3);
+	if (n) {
+		if (base64_decode(in,n/3*4,out,n) != (int)n) {
+			return EIO;
+		}
+		in += n / 3 * 4;
+		out += n;
+		len -= n;
+	}
+	
+	// Trailing partial group.
+	if (len) {
+		if (base64_decode(in,4,tmp,3) < (int)len) {
+			return EIO;
+		}
+		memcpy(out,tmp,len);
+	}
+	return 0;
+}
+
+// Fetches one data block's stored (base64) value.
+int
+CassFs::GetBlock (char * data_key, string & b64data)
+{
+	ColumnOrSuperColumn	waste;
+	
+	// Let Thrift read the value straight into the caller's buffer.
+	waste.column.value.swap(b64data);
+	try {
+		client->get(waste,mytable,data_key,mycolumn,ONE);
+	}
+	catch (NotFoundException &tx) {
+		CFS_ERROR("missing data for " << data_key);
+		return ENOENT;
+	}
+	waste.column.value.swap(b64data);
+	return 0;
+}
+
+// Decodes a stored block into out, which must have room for sb.block_size
+// bytes.
+int
+CassFs::DecodeBlock (char * data_key, const string & b64data, char * out)
+{
+	CfsBuf	raw;
+	int	rc;
+	
+	if (!(sb.features & CFS_FEAT_BLOCK_HDR)) {
+		if (base64_decode(b64data,out,sb.block_size)
+		    != (int)sb.block_size) {
+			CFS_ERROR("bad size for " << data_key);
+			return EIO;
+		}
+		return 0;
+	}
+	
+	base64_decode(b64data,*raw);
+	rc = CfsDecodeBlock(raw->data(),raw->size(),out,sb.block_size);
+	if (rc == EBADMSG) {
+		__sync_fetch_and_add(&crc_errors,1);
+		CFS_ERROR("checksum mismatch for " << data_key);
+		return EIO;
+	}
+	if (rc != 0) {
+		CFS_ERROR("bad block data for " << data_key);
+		return EIO;
+	}
+	return 0;
+}
+
+// Fetches and decodes one data block into out, which must have room for
+// sb.block_size bytes.
+int
+CassFs::FetchBlock (char * data_key, char * out)
+{
+	CfsBuf	b64data;
+	int	rc;
+	
+	rc = GetBlock(data_key,*b64data);
+	if (rc != 0) {
+		return rc;
+	}
+	return DecodeBlock(data_key,*b64data,out);
+}
+
+// Decodes bytes [off,off+len) of a stored block into out.  If the block is
+// stored raw (no compression, no checksum) only the base64 covering that
+// range is decoded; otherwise the whole block has to be decoded first.
+int
+CassFs::ExtractRange (char * data_key, const string & b64data,
+		      cfs_offset_t off, cfs_size_t len, char * out)
+{
+	CfsBuf		blk;
+	CfsBlockHeader	hdr;
+	cfs_size_t	hdr_len		= 0;
+	bool		raw;
+	int		rc;
+	
+	if ((off == 0) && (len == sb.block_size)) {
+		return DecodeBlock(data_key,b64data,out);
+	}
+	
+	if (sb.features & CFS_FEAT_BLOCK_HDR) {
+		hdr_len = sizeof(hdr);
+	}
+	raw = (b64data.size() == (4 * ((hdr_len + sb.block_size + 2) / 3)));
+	if (raw && hdr_len) {
+		raw = (DecodeRange(b64data,0,sizeof(hdr),(char *)&hdr) == 0)
+		      && (hdr.codec == CFS_CODEC_NONE)
+		      && !(hdr.flags & CFS_BLK_CRC32C)
+		      && (hdr.length == sb.block_size);
+	}
+	if (raw) {
+		if (DecodeRange(b64data,hdr_len+off,len,out) != 0) {
+			CFS_ERROR("bad block data for " << data_key);
+			return EIO;
+		}
+		return 0;
+	}
+	
+	blk->resize(sb.block_size);
+	rc = DecodeBlock(data_key,b64data,&(*blk)[0]);
+	if (rc != 0) {
+		return rc;
+	}
+	memcpy(out,blk->data()+off,len);
+	return 0;
+}
+
+// Fetches bytes [off,off+len) of one data block into out.
+int
+CassFs::FetchRange (char * data_key, cfs_offset_t off, cfs_size_t len,
+		    char * out)
+{
+	CfsBuf	b64data;
+	int	rc;
+	
+	rc = GetBlock(data_key,*b64data);
+	if (rc != 0) {
+		return rc;
+	}
+	return ExtractRange(data_key,*b64data,off,len,out);
+}
+
+void
+CassFs::EncodeBlock (const char * data, string & b64data)
+{
+	CfsBuf	encoded;
+	
+	if (sb.features & CFS_FEAT_BLOCK_HDR) {
+		CfsEncodeBlock(sb.codec,data,sb.block_size,*encoded,
+			       (sb.features & CFS_FEAT_CRC32C) ? CFS_BLK_CRC32C : 0);
+		base64_encode(UCCP(encoded->data()),encoded->size(),b64data);
+	}
+	else {
+		base64_encode(UCCP(data),sb.block_size,b64data);
+	}
+}
+
+// Encodes and stores one data block over the given connection.  Only reads
+// sb, so the write pipeline's workers can call it concurrently.
+void
+CassFs::PutBlock (CassandraIf * via, const string & data_key,
+		  const char * data, int64_t ts)
+{
+	CfsBuf	b64data;
+	
+	EncodeBlock(data,*b64data);
+	CFS_DEBUG("writing " << data_key);
+	via->insert(mytable,data_key,mycolumn,*b64data,ts,ONE);
+}
+
+void
+CassFs::StoreBlock (char * data_key, const char * data)
+{
+	PutBlock(client,data_key,data,NextStamp());
+}
+
+void
+CassFs::RemoveBlock (CassandraIf * via, const string & data_key, int64_t ts)
+{
+	CFS_DEBUG("removing " << data_key);
+	via->remove(mytable,data_key,mycolumn,ts,ONE);
+}
+
+// Dedup mode: finds or creates the data block holding these contents and
+// takes a reference to it.  Only a brand new block costs an upload;
+// otherwise it's one small read and one small write of the content record.
+// NB: like next_dalloc, this assumes a single writer; ref_lock only keeps
+// it from racing the reclaimer.
+int
+CassFs::DedupStore (const char * data, cfs_block_idx * idxp, bool * allocp)
+{
+	CfsLocker				guard(&ref_lock);
+	ColumnOrSuperColumn			waste;
+	string					ckey;
+	string					rdata;
+	string					b64data;
+	CfsBuf					b64block;
+	CfsContentRef				ref;
+	char					data_key[CFS_MAX_KEY_LEN];
+	map<string,vector<ColumnOrSuperColumn> > cfmap;
+	vector<ColumnOrSuperColumn> &		cols	= cfmap["Standard1"];
+	
+	ContentKey(data,sb.block_size,sb.prefix,ckey);
+	try {
+		client->get(waste,mytable,ckey,mycolumn,ONE);
+		rdata = base64_decode(waste.column.value);
+		if (rdata.size() != sizeof(ref)) {
+			CFS_ERROR("got " << rdata.size() << "/" << sizeof(ref)
+			          << " for " << ckey);
+			return EIO;
+		}
+		memcpy(&ref,rdata.data(),sizeof(ref));
+		++ref.refs;
+		CFS_DEBUG("dedup hit " << ckey << " refs " << ref.refs);
+	}
+	catch (NotFoundException &tx) {
+		ref.index = sb.next_dalloc++;
+		ref.refs = 1;
+		*allocp = true;
+		
+		// Data and hash go in one row, so store them in one call.
+		IndexToDataKey(ref.index,sb.prefix,data_key);
+		cols.resize(2);
+		EncodeBlock(data,*b64block);
+		cols[0].column.value.swap(*b64block);
+		cols[0].column.name = mycolumn.column;
+		cols[1].column.value = ckey;
+		cols[1].column.name = hashcolumn.column;
+		cols[0].column.timestamp = cols[1].column.timestamp
+			= NextStamp();
+		cols[0].__isset.column = cols[1].__isset.column = true;
+		CFS_DEBUG("writing " << data_key << " for " << ckey);
+		client->batch_insert(mytable,data_key,cfmap,ONE);
+		CountUsage(1,0);
+		cols[0].column.value.swap(*b64block);	// back to the pool
+	}
+	
+	b64data = base64_encode(UCCP(&ref),sizeof(ref));
+	client->insert(mytable,ckey,mycolumn,b64data,NextStamp(),ONE);
+	*idxp = ref.index;
+	return 0;
+}
+
+// Dedup mode: drops a reference to a data block, and removes the block and
+// its content record along with the last reference.
+int
+CassFs::DedupRelease (CassandraIf * via, cfs_block_idx idx)
+{
+	CfsLocker		guard(&ref_lock);
+	ColumnOrSuperColumn	waste;
+	string			ckey;
+	string			rdata;
+	string			b64data;
+	CfsContentRef		ref;
+	char			data_key[CFS_MAX_KEY_LEN];
+	
+	IndexToDataKey(idx,sb.prefix,data_key);
+	try {
+		via->get(waste,mytable,data_key,hashcolumn,ONE);
+		ckey = waste.column.value;
+		via->get(waste,mytable,ckey,mycolumn,ONE);
+	}
+	catch (NotFoundException &tx) {
+		CFS_ERROR("missing content record for " << data_key);
+		return EIO;
+	}
+	rdata = base64_decode(waste.column.value);
+	if (rdata.size() != sizeof(ref)) {
+		CFS_ERROR("got " << rdata.size() << "/" << sizeof(ref)
+		          << " for " << ckey);
+		return EIO;
+	}
+	memcpy(&ref,rdata.data(),sizeof(ref));
+	
+	if (--ref.refs > 0) {
+		b64data = base64_encode(UCCP(&ref),sizeof(ref));
+		via->insert(mytable,ckey,mycolumn,b64data,NextStamp(),ONE);
+		return 0;
+	}
+	
+	CFS_DEBUG("last reference to " << data_key);
+	via->remove(mytable,ckey,mycolumn,NextStamp(),ONE);
+	via->remove(mytable,data_key,myrow,NextStamp(),ONE);
+	CountUsage(-1,0);
+	return 0;
+}
+
+// Drops a file's reference to a data block that's no longer needed.
+void
+CassFs::ReleaseBlock (cfs_block_idx idx)
+{
+	char	data_key[CFS_MAX_KEY_LEN];
+	
+	if (sb.features & CFS_FEAT_DEDUP) {
+		(void)DedupRelease(client,idx);
+		return;
+	}
+	IndexToDataKey(idx,sb.prefix,data_key);
+	if (pipe) {
+		pipe->SubmitRemove(data_key,NextStamp());
+	}
+	else {
+		RemoveBlock(client,data_key,NextStamp());
+	}
+	CountUsage(-1,0);
+}
+
+// The reclaim queue is one row, with a column named after each inode key
+// whose space is still to be freed.  Being in the queue is what marks an
+// inode as deleted, so a crash between dropping the directory entry and
+// freeing the blocks leaves nothing behind once the queue is worked off.
+void
+CassFs::QueueReclaim (const char * inode_key)
+{
+	ColumnPath	qcol	= myrow;
+	string		rq_key	= string(sb.prefix) + "_rq";
+	
+	qcol.column = inode_key;
+	qcol.__isset.column = true;
+	CFS_DEBUG("queueing " << inode_key << " for reclaim");
+	client->insert(mytable,rq_key,qcol,"",NextStamp(),ONE);
+	if (reclaimer) {
+		reclaimer->Kick();
+	}
+}
+
+// Frees a queued inode: its blocks, then the inode itself.  Removing a key
+// twice is harmless, so a plain inode can be reclaimed again from the top
+// after a crash.  Dropping a dedup reference twice isn't, so in dedup mode
+// the block map is cleared first; a crash part-way through then leaks
+// blocks rather than freeing somebody else's.
+void
+CassFs::ReclaimInode (CassandraIf * via, const string & inode_key,
+		      CfsReclaimer * pacer)
+{
+	ColumnOrSuperColumn	waste;
+	CfsInode		my_inode;
+	CfsInode		empty;
+	string			b64data;
+	char			data_key[CFS_MAX_KEY_LEN];
+	cfs_block_idx		bnum;
+	unsigned long		freed		= 0;
+	
+	try {
+		via->get(waste,mytable,inode_key,mycolumn,ONE);
+	}
+	catch (NotFoundException &tx) {
+		CFS_DEBUG(inode_key << " already reclaimed");
+		return;
+	}
+	if (!DecodeInode(waste.column.value,&my_inode)) {
+		CFS_ERROR("bad size for inode " << inode_key
+		          << ", leaking its blocks");
+		via->remove(mytable,inode_key,mycolumn,NextStamp(),ONE);
+		CountUsage(0,-1);
+		return;
+	}
+	
+	if (S_ISDIR(my_inode.type)) {
+		IndexToDataKey(my_inode.data[0],sb.prefix,data_key);
+		if (pacer) {
+			pacer->Pace();
 		}
+		via->remove(mytable,data_key,mycolumn,NextStamp(),ONE);
+		CountUsage(-1,0);
+		++freed;
 	}
 	else {
-		if (!create) {
-			return ENOENT;
-		}
-		cout << "creating new " << fn << endl;
-		IndexToInodeKey(sb.next_ialloc++,sb.prefix,inode_key);
-			
-		new_dir = (CfsDirEntry *)malloc(sizeof(*new_dir)*(i+1));
-		if (!new_dir) {
-			cout << "could not allocate expanded directory" << endl;
-			return ENOMEM;
+		if (sb.features & CFS_FEAT_DEDUP) {
+			empty.type = my_inode.type;
+			empty.size = 0;
+			empty.version = my_inode.version + 1;
+			for (bnum = 0; bnum < CFS_MAX_BLOCKS; ++bnum) {
+				empty.data[bnum] = CFS_NO_BLOCK;
+			}
+			b64data = base64_encode(UCCP(&empty),sizeof(empty));
+			via->insert(mytable,inode_key,mycolumn,b64data,
+				    NextStamp(),ONE);
 		}
-		memcpy(new_dir,rddata.data(),rddata.size());
-		
-		CopyName(new_dir[i].name,fn);
-		CopyKey(new_dir[i].inode_key,inode_key);
-		new_dir[i].inum = sb.next_ialloc - 1;
-		new_dir[i].mode = S_IFREG;
-		b64data = base64_encode(UCCP(new_dir),sizeof(*new_dir)*(i+1));
-		cout << "rewriting " << dir_key << " with " << i+1
-		     << " entries" << endl;
-		client->insert(mytable,dir_key,mycolumn,b64data,timestamp++,ONE);
-		free(new_dir);
-		
-		inodep->type = S_IFREG;
-		inodep->size - 0;
-		for (i = 0; i < CFS_MAX_BLOCKS; ++i) {
-			inodep->data[i] = CFS_NO_BLOCK;
+		for (bnum = 0; bnum < CFS_MAX_BLOCKS; ++bnum) {
+			if (my_inode.data[bnum] == CFS_NO_BLOCK) {
+				continue;
+			}
+			if (pacer) {
+				pacer->Pace();
+			}
+			if (sb.features & CFS_FEAT_DEDUP) {
+				(void)DedupRelease(via,my_inode.data[bnum]);
+			}
+			else {
+				IndexToDataKey(my_inode.data[bnum],sb.prefix,
+					       data_key);
+				RemoveBlock(via,data_key,NextStamp());
+				CountUsage(-1,0);
+			}
+			++freed;
 		}
-		(void)WriteSuperBlock();	// ... to update next_ialloc
 	}
 	
-	return 0;
+	CFS_DEBUG("reclaimed " << inode_key << " and " << freed << " blocks");
+	via->remove(mytable,inode_key,mycolumn,NextStamp(),ONE);
+	CountUsage(0,-1);
 }
 
+// Reclaims up to max inodes from the queue, through via (NULL for our own
+// connection), pacing removals with pacer if there is one.  Inodes we have
+// open stay queued until they're closed.  Returns how many were done; 0
+// means there's nothing to do for now (or we're stopping).
 int
-CassFs::Write (char * path, cfs_offset_t off, char * buf, cfs_size_t len)
+CassFs::ReclaimSome (CassandraIf * via, int max, CfsReclaimer * pacer)
 {
-	char *			split;
-	CfsInode		my_inode;
-	CfsInode *		cur_inode	= &my_inode;
-	int			rc;
-	char			dir_key[CFS_MAX_KEY_LEN];
-	char			inode_key[CFS_MAX_KEY_LEN];
-	char			data_key[CFS_MAX_KEY_LEN];
-	string			b64data;
-	string			odata;
-	cfs_offset_t		ib_off;
-	cfs_size_t		ib_len;
-	cfs_block_idx		bnum;
-	ColumnOrSuperColumn	waste;
-	bool			allocated	= false;
+	vector<ColumnOrSuperColumn>	queue;
+	ColumnParent			parent;
+	SlicePredicate			pred;
+	ColumnPath			qcol	= myrow;
+	string				rq_key;
+	size_t				busy;
+	size_t				i;
+	int				done	= 0;
 	
-	// TBD: Putting this much data on the stack makes my skin crawl.
-	char			data[CFS_BLOCK_SIZE];
-	char *			datap;
+	if (!mounted) {
+		return 0;
+	}
+	if (!via) {
+		via = client;
+	}
+	
+	// Ask for enough that the open ones can't crowd out the rest.
+	pthread_mutex_lock(&open_lock);
+	busy = open_counts.size();
+	pthread_mutex_unlock(&open_lock);
+	
+	rq_key = string(sb.prefix) + "_rq";
+	parent.column_family = myrow.column_family;
+	pred.slice_range.start = "";
+	pred.slice_range.finish = "";
+	pred.slice_range.reversed = false;
+	pred.slice_range.count = max + busy;
+	pred.__isset.slice_range = true;
+	via->get_slice(queue,mytable,rq_key,parent,pred,ONE);
+	
+	qcol.__isset.column = true;
+	for (i = 0; (i < queue.size()) && (done < max); ++i) {
+		// Only ever stop between inodes (see ReclaimInode).
+		if (pacer && pacer->Stopping()) {
+			break;
+		}
+		if (IsOpen(queue[i].column.name)) {
+			continue;
+		}
+		ReclaimInode(via,queue[i].column.name,pacer);
+		qcol.column = queue[i].column.name;
+		via->remove(mytable,rq_key,qcol,NextStamp(),ONE);
+		++done;
+	}
+	return done;
+}
+
+void
+CassFs::CountOpen (const char * inode_key)
+{
+	CfsLocker	guard(&open_lock);
+	CfsOpenCount &	count	= open_counts[inode_key];	// zeroed if new
+	
+	++count.opens;
+}
+
+// If so, notes that the inode is waiting, so that Close can kick the
+// reclaimer once it isn't.
+bool
+CassFs::IsOpen (const string & inode_key)
+{
+	CfsLocker				guard(&open_lock);
+	map<string,CfsOpenCount>::iterator	it;
+	
+	it = open_counts.find(inode_key);
+	if (it == open_counts.end()) {
+		return false;
+	}
+	it->second.queued = true;
+	return true;
+}
+
+// Resolves path once, so that ReadFile/WriteFile on the result needn't
+// look anything up again.  With create, a missing file (but not a missing
+// directory) is created.
+int
+CassFs::Open (char * path, int create, CfsFile ** filep)
+{
+	char *	name;
+	char	dir_key[CFS_MAX_KEY_LEN];
+	int	rc;
 		
 	if (!mounted) {
 		return ENODEV;
 	}
-
-	split = rindex(path,'/');
-	if (!split || (split[1] == '\0')) {
-		cout << "no new path component" << endl;
-		return EINVAL;
+	rc = LookupParent(path,&name,dir_key);
+	if (rc != 0) {
+		return rc;
 	}
-	*split = '\0';
+	return OpenIn(dir_key,name,create,filep);
+}
+
+// Opens (or with create, maybe creates) name in the directory whose data
+// is at dir_key.
+int
+CassFs::OpenIn (char * dir_key, char * name, int create, CfsFile ** filep)
+{
+	CfsFile *	file;
+	int		rc;
 	
-	rc = LookupAll(path,&cur_inode);
-	*split = '/';
+	file = new CfsFile;
+	file->dirty = false;
+	rc = OpenFile(dir_key,name,create,file->inode_key,&file->inode);
 	if (rc != 0) {
+		delete file;
 		return rc;
 	}
+	CountOpen(file->inode_key);
+	
+	*filep = file;
+	return 0;
+}
+
+// Opens a file that's already been looked up, by its inode key.
+int
+CassFs::OpenInode (const char * inode_key, CfsFile ** filep)
+{
+	CfsFile *	file;
+	int		rc;
 	
-	IndexToDataKey(cur_inode->data[0],sb.prefix,dir_key);
-	rc = OpenFile(dir_key,split+1,1,inode_key,&my_inode);
+	if (!mounted) {
+		return ENODEV;
+	}
+	file = new CfsFile;
+	file->dirty = false;
+	rc = GetInode(inode_key,&file->inode);
+	if ((rc == 0) && !S_ISREG(file->inode.type)) {
+		rc = EISDIR;
+	}
 	if (rc != 0) {
+		delete file;
 		return rc;
 	}
+	CopyKey(file->inode_key,inode_key);
+	CountOpen(file->inode_key);
+	
+	*filep = file;
+	return 0;
+}
+
+// Makes everything written to file so far durable: waits for its blocks
+// to be stored, then writes the inode if it changed.  Blocks WriteFile took
+// out of the inode are only released after that, so the stored inode never
+// points at one that's gone.
+int
+CassFs::SyncFile (CfsFile * file)
+{
+	CfsBuf	b64data;
+	size_t	i;
+	int	rc;
+	
+	if (pipe) {
+		rc = pipe->Drain();
+		if (rc != 0) {
+			return rc;
+		}
+	}
+	if (file->dirty) {
+		++file->inode.version;
+		base64_encode(UCCP(&file->inode),sizeof(file->inode),*b64data);
+		CFS_DEBUG("writing " << file->inode_key);
+		client->insert(mytable,file->inode_key,mycolumn,*b64data,
+			       NextStamp(),ONE);
+		file->dirty = false;
+	}
+	for (i = 0; i < file->freed.size(); ++i) {
+		ReleaseBlock(file->freed[i]);
+	}
+	file->freed.clear();
+	return 0;
+}
+
+void
+CassFs::Close (CfsFile * file)
+{
+	map<string,CfsOpenCount>::iterator	it;
+	bool					kick	= false;
+	
+	if ((file->dirty || !file->freed.empty()) && (SyncFile(file) != 0)) {
+		CFS_ERROR("lost changes to " << file->inode_key);
+	}
+	
+	pthread_mutex_lock(&open_lock);
+	it = open_counts.find(file->inode_key);
+	if ((it != open_counts.end()) && (--it->second.opens == 0)) {
+		kick = it->second.queued;
+		open_counts.erase(it);
+	}
+	pthread_mutex_unlock(&open_lock);
+	if (kick && reclaimer) {
+		reclaimer->Kick();
+	}
+	delete file;
+}
+
+int
+CassFs::WriteFile (CfsFile * file, cfs_offset_t off, char * buf,
+		   cfs_size_t len)
+{
+	CfsInode &		my_inode	= file->inode;
+	int			rc		= 0;
+	char			data_key[CFS_MAX_KEY_LEN];
+	CfsBuf			blk;
+	string &		odata		= *blk;
+	cfs_offset_t		ib_off;
+	cfs_size_t		ib_len;
+	cfs_block_idx		bnum;
+	cfs_block_idx		new_idx;
+	bool			allocated	= false;
+	bool			changed		= false;
+	cfs_size_t		bsize		= sb.block_size;
+	char *			datap;
+		
+	if ((off + len) > ((cfs_size_t)CFS_MAX_BLOCKS << block_shift)) {
+		CFS_DEBUG("write past maximum file size");
+		return EFBIG;
+	}
 	if (my_inode.size < (off+len)) {
-		cout << "increasing size to " << off+len << endl;
+		CFS_DEBUG("increasing size to " << off+len);
 		my_inode.size = off + len;
+		changed = true;
 	}
 	
 	while (len > 0) {
 		// ib_ = Intra Block
-		ib_off = off % CFS_BLOCK_SIZE;
-		ib_len = CFS_BLOCK_SIZE - ib_off;
+		ib_off = off & (bsize - 1);
+		ib_len = bsize - ib_off;
 		if (ib_len > len) {
 			ib_len = len;
 		}
-		bnum = off / CFS_BLOCK_SIZE;
+		bnum = off >> block_shift;
 		if (my_inode.data[bnum] == CFS_NO_BLOCK) {
-			cout << "allocating block " << bnum << endl;
-			my_inode.data[bnum] = sb.next_dalloc++;
+			if (CfsIsZero(buf,ib_len)) {
+				CFS_DEBUG("leaving hole at " << bnum);
+				goto next;
+			}
+			CFS_DEBUG("new block " << bnum);
+			odata.assign(bsize,'\0');
+		}
+		else if (ib_len == bsize) {
+			// Whole block overwritten, so no need to fetch it.
+			CFS_DEBUG("replacing block " << bnum);
 			IndexToDataKey(my_inode.data[bnum],sb.prefix,data_key);
-			memset(data,0,sizeof(data));
-			datap = data;
-			allocated = true;
+			odata.resize(bsize);
 		}
 		else {
-			cout << "modifying block " << bnum << endl;
+			CFS_DEBUG("modifying block " << bnum);
 			IndexToDataKey(my_inode.data[bnum],sb.prefix,data_key);
-			try {
-				client->get(waste,mytable,data_key,mycolumn,ONE);
+			odata.resize(bsize);
+			if (pipe) {
+				pipe->Wait();	// it might be on its way
 			}
-			catch (NotFoundException &tx) {
-				cout << "missing data for " << data_key << endl;
+			if (FetchBlock(data_key,&odata[0]) != 0) {
+				rc = EIO;
 				break;
 			}
-			odata = base64_decode(waste.column.value);
-			if (odata.size() != CFS_BLOCK_SIZE) {
-				cout << "bad size " << odata.size() << " for "
-				     << data_key << endl;
+		}
+		datap = (char *)odata.data();
+		CFS_DEBUG("updating " << ib_off << ":" << ib_len);
+		memcpy(datap+ib_off,buf,ib_len);
+		if (CfsIsZero(datap,bsize)) {
+			// It was mapped (or we'd have left the hole above).
+			CFS_DEBUG("punching hole at " << bnum);
+			file->freed.push_back(my_inode.data[bnum]);
+			my_inode.data[bnum] = CFS_NO_BLOCK;
+			changed = true;
+		}
+		else if (sb.features & CFS_FEAT_DEDUP) {
+			// Never modify a shared block in place.  Take the new
+			// reference first, in case it's the same block.
+			if (DedupStore(datap,&new_idx,&allocated) != 0) {
+				rc = EIO;
 				break;
 			}
-			datap = (char *)odata.data();
+			if (my_inode.data[bnum] != CFS_NO_BLOCK) {
+				file->freed.push_back(my_inode.data[bnum]);
+			}
+			if (my_inode.data[bnum] != new_idx) {
+				my_inode.data[bnum] = new_idx;
+				changed = true;
+			}
 		}
-		cout << "updating " << ib_off << ":" << ib_len << endl;
-		memcpy(datap+ib_off,buf,ib_len);
-		cout << "writing " << data_key << endl;
-		b64data = base64_encode(UCCP(datap),CFS_BLOCK_SIZE);
-		client->insert(mytable,data_key,mycolumn,b64data,timestamp++,ONE);
+		else {
+			if (my_inode.data[bnum] == CFS_NO_BLOCK) {
+				CFS_DEBUG("allocating block " << bnum);
+				my_inode.data[bnum] = sb.next_dalloc++;
+				CountUsage(1,0);
+				IndexToDataKey(my_inode.data[bnum],sb.prefix,
+					       data_key);
+				allocated = true;
+				changed = true;
+			}
+			if (pipe) {
+				pipe->Submit(data_key,datap,bsize,
+					     NextStamp());
+			}
+			else {
+				StoreBlock(data_key,datap);
+			}
+			changed = true;		// for the version, at least
+		}
+	next:
 		off += ib_len;
 		len -= ib_len;
 		buf += ib_len;
 	}
 	
-	// TBD: we really don't have to rewrite the inode if it's an old one,
-	// we haven't changed the size, etc.  We'd have to redo the OpenFile
-	// interface to know that, though.
-	b64data = base64_encode(UCCP(&my_inode),sizeof(my_inode));
-	cout << "writing " << inode_key << endl;
-	client->insert(mytable,inode_key,mycolumn,b64data,timestamp++,ONE);
+	// Even overwriting blocks in place means an inode write, to bump the
+	// version that tells cached copies they're stale.  With a pipeline,
+	// that waits for SyncFile, after the blocks it points to have landed.
+	if (changed) {
+		file->dirty = true;
+	}
+	if (!pipe) {
+		(void)SyncFile(file);	// only fails with a pipeline
+	}
 	
 	if (allocated) {
 		WriteSuperBlock();
 	}
 	
-	return 0;
+	return rc;
 }
 
 // TBD: use common routing for read and write since they're so similar
 
 int
-CassFs::Read (char * path, cfs_offset_t off, char * buf, cfs_size_t &in_len)
+CassFs::ReadFile (CfsFile * file, cfs_offset_t off, char * buf,
+		  cfs_size_t &in_len)
 {
-	char *			split;
-	CfsInode		my_inode;
-	CfsInode *		cur_inode	= &my_inode;
-	int			rc;
-	char			dir_key[CFS_MAX_KEY_LEN];
-	char			inode_key[CFS_MAX_KEY_LEN];
+	CfsInode &		my_inode	= file->inode;
 	char			data_key[CFS_MAX_KEY_LEN];
-	string			b64data;
-	string			odata;
 	cfs_offset_t		ib_off;
 	cfs_size_t		ib_len;
 	cfs_block_idx		bnum;
-	ColumnOrSuperColumn	waste;
 	cfs_size_t		len;
-	
-	// TBD: Putting this much data on the stack makes my skin crawl.
-	char			data[CFS_BLOCK_SIZE];
-	char *			datap;
+	cfs_size_t		bsize		= sb.block_size;
+	cfs_offset_t		batch_end;
+	size_t			batch_max;
+	vector<string>		keys;
+	map<string,ColumnOrSuperColumn>			values;
+	map<string,ColumnOrSuperColumn>::iterator	it;
 		
-	if (!mounted) {
-		return ENODEV;
-	}
-	
-	split = rindex(path,'/');
-	if (!split || (split[1] == '\0')) {
-		cout << "no new path component" << endl;
-		return EINVAL;
-	}
-	*split = '\0';
-	
-	rc = LookupAll(path,&cur_inode);
-	*split = '/';
-	if (rc != 0) {
-		return rc;
-	}
-	
-	IndexToDataKey(cur_inode->data[0],sb.prefix,dir_key);
-	rc = OpenFile(dir_key,split+1,0,inode_key,&my_inode);
-	if (rc != 0) {
-		return rc;
+	if (pipe) {
+		pipe->Wait();	// don't race our own pending writes
 	}
 	
 	if (off >= my_inode.size) {
-		cout << "read past EOF" << endl;
+		CFS_DEBUG("read past EOF");
 		in_len = 0;
 		return 0;
 	}
 	
 	if (in_len > (my_inode.size - off)) {
 		in_len = my_inode.size - off;
-		cout << "read crossed EOF - shortened to " << in_len << endl;
+		CFS_DEBUG("read crossed EOF - shortened to " << in_len);
 	}
 	
 	len = in_len;
+	batch_max = CFS_READ_BATCH_BYTES >> block_shift;
+	if (batch_max < 1) {
+		batch_max = 1;
+	}
 	
 	while (len > 0) {
-		// ib_ = Intra Block
-		ib_off = off % CFS_BLOCK_SIZE;
-		ib_len = CFS_BLOCK_SIZE - ib_off;
-		if (ib_len > len) {
-			ib_len = len;
+		// Ask for all the blocks in the next batch at once, so a big
+		// read costs one round trip per batch instead of per block.
+		keys.clear();
+		for (batch_end = off; (batch_end < (off + len))
+		     && (keys.size() < batch_max);
+		     batch_end = (batch_end | (bsize - 1)) + 1) {
+			bnum = batch_end >> block_shift;
+			if (my_inode.data[bnum] != CFS_NO_BLOCK) {
+				IndexToDataKey(my_inode.data[bnum],sb.prefix,
+					       data_key);
+				keys.push_back(data_key);
+			}
 		}
-		bnum = off / CFS_BLOCK_SIZE;
-		if (my_inode.data[bnum] == CFS_NO_BLOCK) {
-			cout << "empty block " << bnum << endl;
-			memset(data,0,sizeof(data));
-			datap = data;
+		if (keys.size() > 1) {
+			CFS_DEBUG("reading " << keys.size() << " blocks");
+			client->multiget(values,mytable,keys,mycolumn,ONE);
 		}
-		else {
-			cout << "reading block " << bnum << endl;
-			IndexToDataKey(my_inode.data[bnum],sb.prefix,data_key);
-			try {
-				client->get(waste,mytable,data_key,mycolumn,ONE);
+		
+		while ((off < batch_end) && (len > 0)) {
+			// ib_ = Intra Block
+			ib_off = off & (bsize - 1);
+			ib_len = bsize - ib_off;
+			if (ib_len > len) {
+				ib_len = len;
 			}
-			catch (NotFoundException &tx) {
-				cout << "missing data for " << data_key << endl;
-				break;
+			bnum = off >> block_shift;
+			if (my_inode.data[bnum] == CFS_NO_BLOCK) {
+				CFS_DEBUG("empty block " << bnum);
+				memset(buf,0,ib_len);
 			}
-			odata = base64_decode(waste.column.value);
-			if (odata.size() != CFS_BLOCK_SIZE) {
-				cout << "bad size " << odata.size() << " for "
-				     << data_key << endl;
-				break;
+			else if (keys.size() == 1) {
+				CFS_DEBUG("reading block " << bnum);
+				// Don't hand back zeroes (or worse) for a block
+				// we couldn't read or that failed its checksum.
+				if (FetchRange(&keys[0][0],ib_off,ib_len,
+					       buf) != 0) {
+					return EIO;
+				}
+			}
+			else {
+				IndexToDataKey(my_inode.data[bnum],sb.prefix,
+					       data_key);
+				it = values.find(data_key);
+				if ((it == values.end())
+				    || !it->second.__isset.column) {
+					CFS_ERROR("missing data for "
+					          << data_key);
+					return EIO;
+				}
+				if (ExtractRange(data_key,it->second.column.value,
+						 ib_off,ib_len,buf) != 0) {
+					return EIO;
+				}
+			}
+			off += ib_len;
+			len -= ib_len;
+			buf += ib_len;
+		}
+	}
+	
+	return 0;
+}
+
+// Sets file's size.  Blocks wholly past the new end are released, and the
+// rest of the new last block is zeroed so that growing the file again
+// reads back zeroes.  The shrunken inode is written before any blocks are
+// released, so it never points at a block that's gone; with a pipeline
+// the releases themselves happen in the background.
+int
+CassFs::TruncateFile (CfsFile * file, cfs_size_t size)
+{
+	CfsInode &		my_inode	= file->inode;
+	int			rc;
+	char			data_key[CFS_MAX_KEY_LEN];
+	CfsBuf			blk;
+	string &		odata		= *blk;
+	cfs_offset_t		ib_off;
+	cfs_block_idx		bnum;
+	cfs_block_idx		old_end;
+	cfs_block_idx		new_idx;
+	vector<cfs_block_idx>	freed;
+	bool			allocated	= false;
+	cfs_size_t		bsize		= sb.block_size;
+	char *			datap;
+	
+	if (size > ((cfs_size_t)CFS_MAX_BLOCKS << block_shift)) {
+		CFS_DEBUG("truncate past maximum file size");
+		return EFBIG;
+	}
+	if (size >= my_inode.size) {
+		if (size > my_inode.size) {
+			// Growing just makes a hole.
+			my_inode.size = size;
+			file->dirty = true;
+		}
+		return SyncFile(file);
+	}
+	
+	old_end = (my_inode.size + bsize - 1) >> block_shift;
+	bnum = size >> block_shift;
+	ib_off = size & (bsize - 1);
+	if (ib_off) {
+		if (my_inode.data[bnum] != CFS_NO_BLOCK) {
+			CFS_DEBUG("trimming block " << bnum);
+			IndexToDataKey(my_inode.data[bnum],sb.prefix,data_key);
+			odata.resize(bsize);
+			if (pipe) {
+				pipe->Wait();	// it might be on its way
+			}
+			if (FetchBlock(data_key,&odata[0]) != 0) {
+				return EIO;
 			}
 			datap = (char *)odata.data();
+			memset(datap+ib_off,0,bsize-ib_off);
+			if (CfsIsZero(datap,bsize)) {
+				freed.push_back(my_inode.data[bnum]);
+				my_inode.data[bnum] = CFS_NO_BLOCK;
+			}
+			else if (sb.features & CFS_FEAT_DEDUP) {
+				if (DedupStore(datap,&new_idx,&allocated) != 0) {
+					return EIO;
+				}
+				freed.push_back(my_inode.data[bnum]);
+				my_inode.data[bnum] = new_idx;
+			}
+			else {
+				StoreBlock(data_key,datap);
+			}
+		}
+		++bnum;
+	}
+	for (; bnum < old_end; ++bnum) {
+		if (my_inode.data[bnum] != CFS_NO_BLOCK) {
+			freed.push_back(my_inode.data[bnum]);
+			my_inode.data[bnum] = CFS_NO_BLOCK;
 		}
-		cout << "updating " << ib_off << ":" << ib_len << endl;
-		memcpy(buf,datap+ib_off,ib_len);
-		off += ib_len;
-		len -= ib_len;
-		buf += ib_len;
 	}
 	
+	CFS_DEBUG("truncating to " << size << ", freeing " << freed.size()
+	          << " blocks");
+	my_inode.size = size;
+	file->dirty = true;
+	rc = SyncFile(file);
+	if (rc != 0) {
+		return rc;
+	}
+	if (allocated) {
+		WriteSuperBlock();
+	}
+	
+	for (bnum = 0; bnum < freed.size(); ++bnum) {
+		ReleaseBlock(freed[bnum]);
+	}
 	return 0;
 }
+
+// Path-based versions, for callers without an open file.
+
+int
+CassFs::Write (char * path, cfs_offset_t off, char * buf, cfs_size_t len)
+{
+	CfsFile *	file;
+	int		rc;
+	
+	rc = Open(path,1,&file);
+	if (rc != 0) {
+		return rc;
+	}
+	rc = WriteFile(file,off,buf,len);
+	if ((SyncFile(file) != 0) && !rc) {
+		rc = EIO;
+	}
+	Close(file);
+	return rc;
+}
+
+int
+CassFs::Read (char * path, cfs_offset_t off, char * buf, cfs_size_t &in_len)
+{
+	CfsFile *	file;
+	int		rc;
+	
+	rc = Open(path,0,&file);
+	if (rc != 0) {
+		return rc;
+	}
+	rc = ReadFile(file,off,buf,in_len);
+	Close(file);
+	return rc;
+}
+
+int
+CassFs::Truncate (char * path, cfs_size_t size)
+{
+	CfsFile *	file;
+	int		rc;
+	
+	rc = Open(path,0,&file);
+	if (rc != 0) {
+		return rc;
+	}
+	rc = TruncateFile(file,size);
+	if ((SyncFile(file) != 0) && !rc) {
+		rc = EIO;
+	}
+	Close(file);
+	return rc;
+}
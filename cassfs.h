@@ -18,22 +18,102 @@
 
 typedef void cfs_list_cb_t (char * name, int inum, int mode);
 
+// Small helpers with a cost on every operation, out here so that
+// cassfs_microbench can time them.
+void	IndexToDataKey	(cfs_block_idx index, char * pfx, char * key);
+void	IndexToInodeKey	(cfs_block_idx index, char * pfx, char * key);
+char *	mysplit		(char * haystack, char * &work);
+size_t	CfsFindEntry	(const CfsDirEntry * ents, size_t n,
+			 const char * name);
+
+// An open file, resolved once so that I/O on it needs no more lookups.
+// Each handle has its own copy of the inode (and so the block map), so
+// anyone with several handles to one file should share them instead.
+typedef struct {
+	char		inode_key[CFS_MAX_KEY_LEN];
+	CfsInode	inode;
+	bool		dirty;		// inode not written yet (see SyncFile)
+	vector<cfs_block_idx> freed;	// released once it is
+} CfsFile;
+
+// How many handles this CassFs has open to an inode.  ReclaimSome leaves
+// those alone, so a file unlinked while open (queued for reclaim right
+// away, so that a crash can't leak it) keeps its blocks until closed.
+typedef struct {
+	int	opens;
+	bool	queued;		// passed over by ReclaimSome
+} CfsOpenCount;
+
+class CfsPipeline;
+class CfsReclaimer;
+struct statvfs;
+
 class CassFs {
 private:
-	shared_ptr<TTransport>	socket;
-	shared_ptr<TTransport>	transport;
-	shared_ptr<TProtocol>	protocol;
-	CassandraClient *	client;
+	CfsConnector *		connector;	// a CfsTimedConnector
+	CassandraIf *		client;
+	CfsPipeline *		pipe;		// NULL unless StartPipeline
+	CfsReclaimer *		reclaimer;	// NULL unless StartReclaimer
+	pthread_mutex_t		ref_lock;	// dedup reference counts
+	pthread_mutex_t		open_lock;	// for open_counts
+	map<string,CfsOpenCount> open_counts;	// by inode key
 	string			mytable;
 	ColumnPath		mycolumn;
+	ColumnPath		hashcolumn;	// content hash, in dedup mode
+	ColumnPath		myrow;		// all columns, for removal
 	int			timestamp;
 	CfsSuperBlock		sb;
+	int			block_shift;	// log2(sb.block_size)
 	CfsInode		root;
 	int			mounted;
+	unsigned long		crc_errors;	// blocks that failed CRC32C
+	pthread_mutex_t		usage_lock;	// one FlushUsage at a time
+	int			usage_slot;	// -1 until ClaimUsageShard
+	string			usage_shard;	// our column of the usage row
+	CfsUsage		usage_mine;	// what it says
+	CfsUsage		usage_delta;	// not yet in it
+	unsigned long		usage_changes;	// ... in this many updates
+	CfsUsage		usage_total;	// as of usage_time
+	time_t			usage_time;
+	
+	void	Init		(void);
+	int64_t	NextStamp	(void)
+	{
+		return __sync_fetch_and_add(&timestamp,1);
+	}
+	// Safe from any thread; the counts get to the store with FlushUsage.
+	void	CountUsage	(long blocks, long inodes)
+	{
+		__sync_fetch_and_add(&usage_delta.blocks,blocks);
+		__sync_fetch_and_add(&usage_delta.inodes,inodes);
+		__sync_fetch_and_add(&usage_changes,1);
+	}
+	// So that what we write next supersedes a stamp another client used.
+	void	SkipStamp	(int64_t stamp)
+	{
+		int	cur;
+		
+		while ((cur = timestamp) <= stamp) {
+			if (__sync_bool_compare_and_swap(&timestamp,cur,
+							 (int)stamp+1)) {
+				break;
+			}
+		}
+	}
+	void	ReadUsage	(vector<ColumnOrSuperColumn> & shards);
+	void	ClaimUsageShard	(void);
+	void	FlushUsage	(void);
+	void	CountOpen	(const char * inode_key);
+	bool	IsOpen		(const string & inode_key);
+	void	ReleaseUsageShard (void);
+	void	SumUsage	(void);
 	
 public:
 		CassFs		();
+		CassFs		(CfsConnector * a_connector);
 		~CassFs		();
+	int	StartPipeline	(int nthreads, int window);
+	int	StartReclaimer	(int rate);
 	int	WriteSuperBlock	(void);
 	int	MountFs		(char * prefix);
 	int	LookupOne	(CfsInode * parent, char * elem,
@@ -43,18 +123,86 @@ public:
 				 cfs_block_idx data_idx);
 	int	OpenFile	(char * dir_key, char * fn, int create,
 				 char * inode_key, CfsInode * inodep);
+	int	GetBlock	(char * data_key, string & b64data);
+	int	DecodeBlock	(char * data_key, const string & b64data,
+				 char * out);
+	int	FetchBlock	(char * data_key, char * out);
+	int	ExtractRange	(char * data_key, const string & b64data,
+				 cfs_offset_t off, cfs_size_t len, char * out);
+	int	FetchRange	(char * data_key, cfs_offset_t off,
+				 cfs_size_t len, char * out);
+	void	EncodeBlock	(const char * data, string & b64data);
+	void	PutBlock	(CassandraIf * via, const string & data_key,
+				 const char * data, int64_t ts);
+	void	StoreBlock	(char * data_key, const char * data);
+	void	RemoveBlock	(CassandraIf * via, const string & data_key,
+				 int64_t ts);
+	int	DedupStore	(const char * data, cfs_block_idx * idxp,
+				 bool * allocp);
+	int	DedupRelease	(CassandraIf * via, cfs_block_idx idx);
+	void	ReleaseBlock	(cfs_block_idx idx);
 				 
 	void	Put		(char * key, char * value);
 	int	Get		(ColumnOrSuperColumn &waste, char * key);
 	void	Del		(char * key);
 	
-	int	Mkfs		(char * prefix);
+	int	Mkfs		(char * prefix,
+				 unsigned long block_size = CFS_BLOCK_SIZE,
+				 int codec = CFS_CODEC_NONE,
+				 unsigned long features = 0);
 	int	Mount		(char * prefix);
 	int	Mkdir		(char * path);
+	int	GetDirData	(const char * data_key, string & rddata);
+	int	GetInode	(const char * inode_key, CfsInode * inodep);
+	void	InodeKey	(cfs_block_idx inum, char * inode_key);
+	cfs_block_idx	InodeIndex	(const char * inode_key);
+	void	DirDataKey	(const CfsInode * inodep, char * data_key);
+	int	LookupParent	(char * path, char ** namep,
+				 char * pdata_key);
+	int	CheckEmptyDir	(const char * inode_key);
+	int	CheckNotUnder	(char * data_key, const char * inode_key);
+	int	RemoveEntry	(char * path, bool rmdir);
+	int	Unlink		(char * path);
+	int	Rmdir		(char * path);
+	int	Rename		(char * from, char * to);
+	
+	// The same, for callers that already know the directory (by the
+	// key of its data), e.g. a frontend working with inode numbers.
+	int	LookupIn	(char * pdata_key, char * name,
+				 CfsDirEntry * entp);
+	int	MkdirIn		(char * pdata_key, char * name,
+				 CfsDirEntry * entp);
+	int	RemoveIn	(char * pdata_key, char * name, bool rmdir,
+				 bool reclaim, CfsDirEntry * victimp);
+	int	RenameIn	(char * sdata_key, char * src_name,
+				 char * ddata_key, char * dst_name,
+				 bool reclaim, CfsDirEntry * replacedp);
+	int	OpenIn		(char * dir_key, char * name, int create,
+				 CfsFile ** filep);
+	int	OpenInode	(const char * inode_key, CfsFile ** filep);
+	void	QueueReclaim	(const char * inode_key);
+	void	ReclaimInode	(CassandraIf * via, const string & inode_key,
+				 CfsReclaimer * pacer);
+	int	ReclaimSome	(CassandraIf * via, int max,
+				 CfsReclaimer * pacer);
+	int	Statfs		(struct statvfs * stp);
+	int	ReadDir		(char * path, string & rddata);
 	int	List		(char * path, cfs_list_cb_t * cb);
+	int	Open		(char * path, int create, CfsFile ** filep);
+	int	SyncFile	(CfsFile * file);
+	void	Close		(CfsFile * file);
+	int	WriteFile	(CfsFile * file, cfs_offset_t off,
+				 char * buf, cfs_size_t len);
+	int	ReadFile	(CfsFile * file, cfs_offset_t off,
+				 char * buf, cfs_size_t &in_len);
+	int	TruncateFile	(CfsFile * file, cfs_size_t size);
+	int	Truncate	(char * path, cfs_size_t size);
 	int	Write		(char * path, cfs_offset_t off,
 				 char * buf, cfs_size_t len);
 	int	Read		(char * path, cfs_offset_t off,
 				 char * buf, cfs_size_t &in_len);
+	
+	unsigned long	CrcErrors	(void) { return crc_errors; }
+	cfs_size_t	BlockSize	(void) { return sb.block_size; }
 };
 
@@ -18,6 +18,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stddef.h>
 
 // Maximum length (including NUL) of a key in the underlying key/value store.
 // NB: a zero-length string means no key, e.g. for a zero-length file.
@@ -32,7 +33,11 @@
 // inodes are stored as <prefix>_i_NNN
 // data blocks are stored as <prefix>_d_NNN
 // NNN is up to CFS_INDEX_DIGITS long.
+// in dedup mode, content records are stored as <prefix>_c_<sha256 hex>
+// inodes waiting to be reclaimed are columns of the row <prefix>_rq
+// usage counters are columns of the row <prefix>_us (see CfsUsage)
 #define CFS_INDEX_DIGITS	9
+#define CFS_MAX_INDEX		1000000000UL	// 10^CFS_INDEX_DIGITS
 #define CFS_MAX_PREFIX_LEN	(CFS_MAX_KEY_LEN - CFS_INDEX_DIGITS - 4)
 
 typedef unsigned long	cfs_block_idx;
@@ -45,8 +50,13 @@ typedef unsigned long	cfs_size_t;
 // to rewrite the one key for the whole file.
 
 // TBD: to handle larger files we'll need indirect blocks etc.  Blech.
-#define CFS_MAX_BLOCKS	2048
-#define CFS_BLOCK_SIZE	8192
+// The block size is chosen per filesystem at mkfs time and recorded in the
+// superblock.  It must be a power of two between the min and max below;
+// CFS_BLOCK_SIZE is only the default.
+#define CFS_MAX_BLOCKS		2048
+#define CFS_BLOCK_SIZE		8192
+#define CFS_MIN_BLOCK_SIZE	4096
+#define CFS_MAX_BLOCK_SIZE	(1024*1024)
 #define CFS_NO_BLOCK	~0
 
 typedef struct {
@@ -54,8 +64,13 @@ typedef struct {
 	unsigned long	size;
 	// TBD: perms, times, etc. should go here.
 	cfs_block_idx	data[CFS_MAX_BLOCKS];
+	// Added after the original format, like the superblock fields below.
+	unsigned long	version;	// bumped on every change to the file
 } CfsInode;
 
+// Size of an inode written before the version field existed.
+#define CFS_INODE_MIN_SIZE	offsetof(CfsInode,version)
+
 typedef struct {
 	char	name[CFS_MAX_NAME_LEN];
 	char	inode_key[CFS_MAX_KEY_LEN];
@@ -65,9 +80,63 @@ typedef struct {
 	int	mode;
 } CfsDirEntry;
 
+// Optional on-disk features, chosen at mkfs time.
+#define CFS_FEAT_BLOCK_HDR	0x1	// data blocks start with a CfsBlockHeader
+#define CFS_FEAT_DEDUP		0x2	// data blocks are shared by content
+#define CFS_FEAT_CRC32C		0x4	// data blocks carry a CRC32C (implies
+					// CFS_FEAT_BLOCK_HDR)
+
+// Data block codecs (see codec.h).
+#define CFS_CODEC_NONE	0
+#define CFS_CODEC_LZ4	1
+#define CFS_CODEC_ZSTD	2
+
+typedef struct {
+	unsigned char	codec;		// how the payload is encoded
+	unsigned char	flags;		// CFS_BLK_*
+	unsigned short	spare;
+	unsigned int	length;		// bytes of payload after the header
+} CfsBlockHeader;
+
+// The header is followed by a CRC32C of the decoded block, then the payload.
+#define CFS_BLK_CRC32C	0x1
+
+// In dedup mode, each distinct block's contents are recorded once, under a
+// key derived from their hash, pointing at the one data block holding them.
+// The data block in turn carries the record's key (in a "hash" column) so
+// that we can find the record again when a reference is dropped.
+typedef struct {
+	cfs_block_idx	index;
+	unsigned long	refs;
+} CfsContentRef;
+
 typedef struct {
 	char		prefix[CFS_MAX_NAME_LEN];
 	char		root_dir_key[CFS_MAX_KEY_LEN];
 	unsigned long	next_ialloc;
 	unsigned long	next_dalloc;
+	// Fields below were added after the original format.  Superblocks
+	// written before them are shorter, and the missing fields read as
+	// zero, so zero must always mean "the old behavior".
+	unsigned long	block_size;	// 0 => CFS_BLOCK_SIZE
+	unsigned long	features;	// CFS_FEAT_*
+	unsigned long	codec;		// CFS_CODEC_* for new data blocks
 } CfsSuperBlock;
+
+// How much space a filesystem is using, for statfs.  Rather than have every
+// allocation update one hot key, each client adds up its own changes and
+// now and then writes its running totals to a column of its own, named
+// host:pid:slot; statfs adds the columns up.  With one writer per column
+// there's no read-modify-write to race.  Columns of processes that have
+// exited are taken over by the next CassFs on the same host.  A column can
+// go negative if its client freed more than it allocated.
+// Filesystems made before the counters existed start out counting from
+// zero.
+
+typedef struct {
+	long	blocks;		// data blocks, including directory contents
+	long	inodes;
+} CfsUsage;
+
+// Size of a superblock written before any of the optional fields existed.
+#define CFS_SB_MIN_SIZE	offsetof(CfsSuperBlock,block_size)
@@ -17,7 +17,9 @@
 */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <sys/statvfs.h>
 #include <iostream>
 
 #include <boost/shared_ptr.hpp>
@@ -27,6 +29,7 @@
 #include "Cassandra.h"
 #include "base64.h"
 #include "cfs_types.h"
+#include "codec.h"
 
 using namespace std;
 using namespace boost;
@@ -35,6 +38,7 @@ using namespace apache::thrift::protocol;
 using namespace apache::thrift::transport;
 using namespace org::apache::cassandra;
 
+#include "connect.h"
 #include "cassfs.h"
 
 
@@ -45,15 +49,21 @@ ExitWithUsage (char * prog)
 	cerr << "  put key value" << endl;
 	cerr << "  get key" << endl;
 	cerr << "  del key" << endl;
-	cerr << "  mkfs fs_name" << endl;
+	cerr << "  mkfs fs_name [bsize=N[k|m]] [codec=none|lz4|zstd] [dedup] [crc]"
+	     << endl;
 	cerr << "  mount fs_name" << endl;
 	cerr << "  mkdir path" << endl;
 	cerr << "  list path" << endl;
 	cerr << "  write path data [offset]" << endl;
 	cerr << "  read path len [offset]" << endl;
-	cerr << "--- NOT IMPLEMENTED YET ---" << endl;
+	cerr << "  truncate path size" << endl;
 	cerr << "  rmdir path" << endl;
 	cerr << "  unlink path" << endl;
+	cerr << "  rename from to" << endl;
+	cerr << "  reclaim" << endl;
+	cerr << "  stats" << endl;
+	cerr << "  df" << endl;
+	cerr << "--- NOT IMPLEMENTED YET ---" << endl;
 	cerr << "  stat path" << endl;
 	return EINVAL;
 }
@@ -99,14 +109,63 @@ DelCommand (int argc, char ** argv, CassFs * cfs)
 	return 0;
 }
 
+// Parses a size with an optional k/m suffix, e.g. "4k" or "1m".
+unsigned long
+ParseSize (char * str)
+{
+	unsigned long	val;
+	char *		end;
+	
+	val = strtoul(str,&end,10);
+	switch (*end) {
+	case 'k':
+	case 'K':
+		return val << 10;
+	case 'm':
+	case 'M':
+		return val << 20;
+	case '\0':
+		return val;
+	default:
+		return 0;
+	}
+}
+
 int
 MkfsCommand (int argc, char ** argv, CassFs * cfs)
 {
-	if (argc != 3) {
+	unsigned long	block_size	= CFS_BLOCK_SIZE;
+	int		codec		= CFS_CODEC_NONE;
+	unsigned long	features	= 0;
+	int		i;
+	
+	if (argc < 3) {
 		return ExitWithUsage(argv[0]);
 	}
 	
-	return cfs->Mkfs(argv[2]);
+	for (i = 3; i < argc; ++i) {
+		if (!strncmp(argv[i],"bsize=",6)) {
+			block_size = ParseSize(argv[i]+6);
+		}
+		else if (!strncmp(argv[i],"codec=",6)) {
+			codec = CfsCodecByName(argv[i]+6);
+			if (codec < 0) {
+				cout << "unknown codec " << argv[i]+6 << endl;
+				return EINVAL;
+			}
+		}
+		else if (!strcmp(argv[i],"dedup")) {
+			features |= CFS_FEAT_DEDUP;
+		}
+		else if (!strcmp(argv[i],"crc")) {
+			features |= CFS_FEAT_CRC32C;
+		}
+		else {
+			return ExitWithUsage(argv[0]);
+		}
+	}
+	
+	return cfs->Mkfs(argv[2],block_size,codec,features);
 }
 
 int
@@ -132,8 +191,11 @@ MkdirCommand (int argc, char ** argv, CassFs * cfs)
 int
 RmdirCommand (int argc, char ** argv, CassFs * cfs)
 {
-	printf("in %s\n",__func__);
-	return 0;
+	if (argc != 3) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	return cfs->Rmdir(argv[2]);
 }
 
 void
@@ -237,10 +299,83 @@ ReadCommand (int argc, char ** argv, CassFs * cfs)
 	return 0;
 }
 
+int
+TruncateCommand (int argc, char ** argv, CassFs * cfs)
+{
+	if (argc != 4) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	return cfs->Truncate(argv[2],strtoul(argv[3],NULL,10));
+}
+
+int
+StatsCommand (int argc, char ** argv, CassFs * cfs)
+{
+	if (argc != 2) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	cout << "crc_errors " << cfs->CrcErrors() << endl;
+	return 0;
+}
+
+int
+DfCommand (int argc, char ** argv, CassFs * cfs)
+{
+	struct statvfs	st;
+	int		rc;
+	
+	if (argc != 2) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	rc = cfs->Statfs(&st);
+	if (rc != 0) {
+		return rc;
+	}
+	cout << "blocks " << st.f_blocks - st.f_bfree << " used, "
+	     << st.f_bfree << " free" << endl;
+	cout << "inodes " << st.f_files - st.f_ffree << " used, "
+	     << st.f_ffree << " free" << endl;
+	return 0;
+}
+
 int
 UnlinkCommand (int argc, char ** argv, CassFs * cfs)
 {
-	printf("in %s\n",__func__);
+	if (argc != 3) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	return cfs->Unlink(argv[2]);
+}
+
+int
+RenameCommand (int argc, char ** argv, CassFs * cfs)
+{
+	if (argc != 4) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	return cfs->Rename(argv[2],argv[3]);
+}
+
+// Frees everything unlinked so far, without waiting for a reclaimer.
+int
+ReclaimCommand (int argc, char ** argv, CassFs * cfs)
+{
+	int	done;
+	int	total	= 0;
+	
+	if (argc != 2) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	while ((done = cfs->ReclaimSome(NULL,100,NULL)) > 0) {
+		total += done;
+	}
+	cout << "reclaimed " << total << " inodes" << endl;
 	return 0;
 }
 
@@ -266,8 +401,13 @@ struct _gcc_sucks {
 	{ "list",	ListCommand	},
 	{ "write",	WriteCommand	},
 	{ "read",	ReadCommand	},
+	{ "truncate",	TruncateCommand	},
 	{ "unlink",	UnlinkCommand	},
+	{ "rename",	RenameCommand	},
+	{ "reclaim",	ReclaimCommand	},
 	{ "stat",	StatCommand	},
+	{ "stats",	StatsCommand	},
+	{ "df",		DfCommand	},
 	{ "quit",	NULL		},
 	{ NULL }
 };
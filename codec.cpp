@@ -0,0 +1,214 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "cfs_types.h"
+#include "codec.h"
+#include "crc32c.h"
+#include "lz4.h"
+
+using namespace std;
+
+#define ZSTD_LEVEL	3
+
+int
+CfsCodecByName (const char * name)
+{
+	if (!strcmp(name,"none")) {
+		return CFS_CODEC_NONE;
+	}
+	if (!strcmp(name,"lz4")) {
+		return CFS_CODEC_LZ4;
+	}
+#ifdef HAVE_ZSTD
+	if (!strcmp(name,"zstd")) {
+		return CFS_CODEC_ZSTD;
+	}
+#endif
+	return -1;
+}
+
+const char *
+CfsCodecName (int codec)
+{
+	switch (codec) {
+	case CFS_CODEC_NONE:
+		return "none";
+	case CFS_CODEC_LZ4:
+		return "lz4";
+	case CFS_CODEC_ZSTD:
+		return "zstd";
+	default:
+		return "unknown";
+	}
+}
+
+void
+CfsEncodeBlock (int codec, const char * data, size_t len, string & out,
+		int flags)
+{
+	CfsBlockHeader	hdr;
+	size_t		hdr_len		= sizeof(hdr);
+	uint32_t	crc;
+	char *		payload;
+	long		clen		= 0;
+	
+	if (flags & CFS_BLK_CRC32C) {
+		hdr_len += sizeof(crc);
+	}
+	out.resize(hdr_len+len);
+	payload = &out[hdr_len];
+	
+	// Only accept output that's strictly smaller than the input, so a
+	// codec that can't fit in len-1 bytes means "store it raw".
+	switch (codec) {
+	case CFS_CODEC_LZ4:
+		clen = cfs_lz4_compress(data,len,payload,len-1);
+		break;
+#ifdef HAVE_ZSTD
+	case CFS_CODEC_ZSTD:
+		clen = ZSTD_compress(payload,len-1,data,len,ZSTD_LEVEL);
+		if (ZSTD_isError(clen)) {
+			clen = 0;
+		}
+		break;
+#endif
+	}
+	if (clen <= 0) {
+		codec = CFS_CODEC_NONE;
+		memcpy(payload,data,len);
+		clen = len;
+	}
+	
+	memset(&hdr,0,sizeof(hdr));
+	hdr.codec = codec;
+	hdr.flags = flags & CFS_BLK_CRC32C;
+	hdr.length = clen;
+	memcpy(&out[0],&hdr,sizeof(hdr));
+	if (flags & CFS_BLK_CRC32C) {
+		crc = cfs_crc32c(data,len);
+		memcpy(&out[sizeof(hdr)],&crc,sizeof(crc));
+	}
+	out.resize(hdr_len+clen);
+}
+
+int
+CfsDecodeBlock (const char * in, size_t in_len, char * out, size_t len)
+{
+	CfsBlockHeader	hdr;
+	size_t		hdr_len		= sizeof(hdr);
+	uint32_t	crc		= 0;
+	const char *	payload;
+	long		dlen;
+	
+	if (in_len < sizeof(hdr)) {
+		return EIO;
+	}
+	memcpy(&hdr,in,sizeof(hdr));
+	if (hdr.flags & CFS_BLK_CRC32C) {
+		hdr_len += sizeof(crc);
+		if (in_len < hdr_len) {
+			return EIO;
+		}
+		memcpy(&crc,in+sizeof(hdr),sizeof(crc));
+	}
+	if (hdr.length != (in_len - hdr_len)) {
+		return EIO;
+	}
+	payload = in + hdr_len;
+	
+	switch (hdr.codec) {
+	case CFS_CODEC_NONE:
+		if (hdr.length != len) {
+			return EIO;
+		}
+		memcpy(out,payload,len);
+		dlen = len;
+		break;
+	case CFS_CODEC_LZ4:
+		dlen = cfs_lz4_decompress(payload,hdr.length,out,len);
+		break;
+#ifdef HAVE_ZSTD
+	case CFS_CODEC_ZSTD:
+		dlen = ZSTD_decompress(out,len,payload,hdr.length);
+		if (ZSTD_isError(dlen)) {
+			return EIO;
+		}
+		break;
+#endif
+	default:
+		return EIO;
+	}
+	if (dlen != (long)len) {
+		return EIO;
+	}
+	
+	if ((hdr.flags & CFS_BLK_CRC32C) && (cfs_crc32c(out,len) != crc)) {
+		return EBADMSG;
+	}
+	return 0;
+}
+
+bool
+CfsIsZero (const char * data, size_t len)
+{
+	const char *	end	= data + len;
+	uint64_t	word;
+	uint64_t	acc	= 0;
+	
+	// Most blocks that aren't zero say so in the first few bytes.
+	while ((data < end) && ((uintptr_t)data & 15)) {
+		if (*data++) {
+			return false;
+		}
+	}
+	
+#ifdef __SSE2__
+	__m128i		zero	= _mm_setzero_si128();
+	__m128i		vacc;
+	
+	for (; (end - data) >= 64; data += 64) {
+		vacc = _mm_or_si128(
+			_mm_or_si128(_mm_load_si128((const __m128i *)data),
+				     _mm_load_si128((const __m128i *)data+1)),
+			_mm_or_si128(_mm_load_si128((const __m128i *)data+2),
+				     _mm_load_si128((const __m128i *)data+3)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(vacc,zero)) != 0xffff) {
+			return false;
+		}
+	}
+#endif
+	
+	for (; (end - data) >= (long)sizeof(word); data += sizeof(word)) {
+		memcpy(&word,data,sizeof(word));
+		acc |= word;
+	}
+	while (data < end) {
+		acc |= *data++;
+	}
+	return !acc;
+}
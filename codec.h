@@ -0,0 +1,42 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+
+// Data block encoding.  The codec a filesystem uses is chosen at mkfs time,
+// but every stored block starts with a CfsBlockHeader naming the codec that
+// was actually used, so a block that doesn't compress is just stored raw.
+
+// Returns a CFS_CODEC_* value, or -1 if the name is unknown or the codec
+// wasn't compiled in.
+int		CfsCodecByName	(const char * name);
+const char *	CfsCodecName	(int codec);
+
+// Encodes len bytes of data as header + payload into out.  flags may
+// include CFS_BLK_CRC32C to have the block checksummed.
+void		CfsEncodeBlock	(int codec, const char * data, size_t len,
+				 std::string & out, int flags = 0);
+
+// Decodes a header + payload into exactly len bytes at out.  Returns 0,
+// EBADMSG if the block has a checksum and it doesn't match, or EIO if the
+// block is malformed or the wrong size.
+int		CfsDecodeBlock	(const char * in, size_t in_len,
+				 char * out, size_t len);
+
+// True if all len bytes are zero, i.e. the block can be a hole.
+bool		CfsIsZero	(const char * data, size_t len);
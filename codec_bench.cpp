@@ -0,0 +1,228 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measures data block codec throughput vs. compression ratio on sample
+// files, e.g. "cassfs_codec_bench -b 64k /var/log/app/*.json".  Files are
+// cut into blocks exactly as CassFS would store them; a trailing partial
+// block is zero-filled, just like the tail of a file.  Each codec is run
+// with and without per-block CRC32C, to show what checksums cost.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+#include "base64.h"
+#include "cfs_types.h"
+#include "codec.h"
+#include "crc32c.h"
+
+using namespace std;
+
+#define MIN_SECONDS	1.0
+
+double
+Now (void)
+{
+	struct timeval	tv;
+	
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int
+LoadFile (char * path, size_t bsize, vector<string> &blocks)
+{
+	FILE *	fp;
+	string	block;
+	size_t	got;
+	
+	fp = fopen(path,"r");
+	if (!fp) {
+		perror(path);
+		return errno;
+	}
+	for (;;) {
+		block.assign(bsize,'\0');
+		got = fread(&block[0],1,bsize,fp);
+		if (!got) {
+			break;
+		}
+		blocks.push_back(block);
+	}
+	fclose(fp);
+	return 0;
+}
+
+void
+RunCodec (int codec, int flags, size_t bsize, vector<string> &blocks)
+{
+	vector<string>	encoded(blocks.size());
+	string		decoded(bsize,'\0');
+	double		start;
+	double		enc_secs;
+	double		dec_secs;
+	unsigned long	passes;
+	size_t		i;
+	size_t		stored		= 0;
+	size_t		wire		= 0;
+	size_t		raw		= 0;
+	double		in_mb;
+	CfsBlockHeader	hdr;
+	
+	in_mb = (double)blocks.size() * bsize / (1024 * 1024);
+	
+	start = Now();
+	for (passes = 0; (passes == 0) || ((Now() - start) < MIN_SECONDS);
+	     ++passes) {
+		for (i = 0; i < blocks.size(); ++i) {
+			CfsEncodeBlock(codec,blocks[i].data(),bsize,encoded[i],
+				       flags);
+		}
+	}
+	enc_secs = (Now() - start) / passes;
+	
+	for (i = 0; i < encoded.size(); ++i) {
+		stored += encoded[i].size();
+		wire += base64_encode(UCCP(encoded[i].data()),
+				      encoded[i].size()).size();
+		memcpy(&hdr,encoded[i].data(),sizeof(hdr));
+		if (hdr.codec == CFS_CODEC_NONE) {
+			++raw;
+		}
+	}
+	
+	start = Now();
+	for (passes = 0; (passes == 0) || ((Now() - start) < MIN_SECONDS);
+	     ++passes) {
+		for (i = 0; i < encoded.size(); ++i) {
+			if (CfsDecodeBlock(encoded[i].data(),encoded[i].size(),
+					   &decoded[0],bsize)
+			    || (decoded != blocks[i])) {
+				printf("%s: block %lu did not round-trip\n",
+				       CfsCodecName(codec),(unsigned long)i);
+				return;
+			}
+		}
+	}
+	dec_secs = (Now() - start) / passes;
+	
+	printf("%-6s %-4s %8.2f %10.1f %10.1f %12lu %12lu %8lu\n",
+	       CfsCodecName(codec),(flags & CFS_BLK_CRC32C) ? "yes" : "no",
+	       (double)blocks.size() * bsize / stored,
+	       in_mb / enc_secs, in_mb / dec_secs,
+	       (unsigned long)stored, (unsigned long)wire,
+	       (unsigned long)raw);
+}
+
+// For scale: CRC32C by itself, and the base64 encoding every block goes
+// through on its way to Cassandra anyway.
+void
+RunBaseline (size_t bsize, vector<string> &blocks)
+{
+	double		start;
+	double		secs;
+	unsigned long	passes;
+	uint32_t	sum		= 0;
+	size_t		i;
+	double		in_mb;
+	
+	in_mb = (double)blocks.size() * bsize / (1024 * 1024);
+	
+	start = Now();
+	for (passes = 0; (passes == 0) || ((Now() - start) < MIN_SECONDS);
+	     ++passes) {
+		for (i = 0; i < blocks.size(); ++i) {
+			sum ^= cfs_crc32c(blocks[i].data(),bsize);
+		}
+	}
+	secs = (Now() - start) / passes;
+	printf("crc32c (%s): %.1f MB/s (%08x)\n",cfs_crc32c_impl(),
+	       in_mb / secs,sum);
+	
+	start = Now();
+	for (passes = 0; (passes == 0) || ((Now() - start) < MIN_SECONDS);
+	     ++passes) {
+		for (i = 0; i < blocks.size(); ++i) {
+			base64_encode(UCCP(blocks[i].data()),bsize);
+		}
+	}
+	secs = (Now() - start) / passes;
+	printf("base64 encode: %.1f MB/s\n",in_mb / secs);
+}
+
+int
+main (int argc, char ** argv)
+{
+	size_t		bsize		= CFS_BLOCK_SIZE;
+	vector<string>	blocks;
+	int		opt;
+	int		codec;
+	const char *	names[]		= { "none", "lz4", "zstd", NULL };
+	int		i;
+	
+	while ((opt = getopt(argc,argv,"b:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bsize = strtoul(optarg,NULL,10);
+			if (strchr(optarg,'k')) {
+				bsize <<= 10;
+			}
+			else if (strchr(optarg,'m')) {
+				bsize <<= 20;
+			}
+			break;
+		default:
+			fprintf(stderr,"Usage: %s [-b bsize] file...\n",argv[0]);
+			return EINVAL;
+		}
+	}
+	if ((optind >= argc) || !bsize) {
+		fprintf(stderr,"Usage: %s [-b bsize] file...\n",argv[0]);
+		return EINVAL;
+	}
+	
+	for (i = optind; i < argc; ++i) {
+		if (LoadFile(argv[i],bsize,blocks) != 0) {
+			return EIO;
+		}
+	}
+	if (blocks.empty()) {
+		fprintf(stderr,"no data\n");
+		return EINVAL;
+	}
+	
+	printf("%lu blocks of %lu bytes\n",
+	       (unsigned long)blocks.size(),(unsigned long)bsize);
+	RunBaseline(bsize,blocks);
+	printf("%-6s %-4s %8s %10s %10s %12s %12s %8s\n","codec","crc",
+	       "ratio","enc MB/s","dec MB/s","stored","on-wire","raw");
+	for (i = 0; names[i]; ++i) {
+		codec = CfsCodecByName(names[i]);
+		if (codec >= 0) {
+			RunCodec(codec,0,bsize,blocks);
+			RunCodec(codec,CFS_BLK_CRC32C,bsize,blocks);
+		}
+	}
+	
+	return 0;
+}
@@ -0,0 +1,1019 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TTransportUtils.h>
+#include "Cassandra.h"
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace org::apache::cassandra;
+
+#include "connect.h"
+#include "stats.h"
+
+CfsThriftConnector::CfsThriftConnector (const char * a_host, int a_port) :
+	host(a_host), port(a_port)
+{
+}
+
+// Throws TTransportException if the connection can't be made.
+CassandraIf *
+CfsThriftConnector::Connect (void)
+{
+	shared_ptr<TTransport>	socket(new TSocket(host,port));
+	shared_ptr<TTransport>	transport(new TBufferedTransport(socket));
+	shared_ptr<TProtocol>	protocol(new TBinaryProtocol(transport));
+	
+	transport->open();
+	return new CassandraClient(protocol);
+}
+
+void
+CfsThriftConnector::Disconnect (CassandraIf * client)
+{
+	CassandraClient *	tclient	= dynamic_cast<CassandraClient *>(client);
+	
+	tclient->getInputProtocol()->getTransport()->close();
+	delete tclient;
+}
+
+CfsTimedConnector::CfsTimedConnector (CfsConnector * an_inner,
+				      bool an_own_inner) :
+	inner(an_inner), own_inner(an_own_inner)
+{
+}
+
+CfsTimedConnector::~CfsTimedConnector ()
+{
+	if (own_inner) {
+		delete inner;
+	}
+}
+
+CassandraIf *
+CfsTimedConnector::Connect (void)
+{
+	return new CfsTimedClient(inner->Connect());
+}
+
+void
+CfsTimedConnector::Disconnect (CassandraIf * client)
+{
+	CfsTimedClient *	tclient	= static_cast<CfsTimedClient *>(client);
+	
+	inner->Disconnect(tclient->Inner());
+	delete tclient;
+}
+
+// Counts an exception on its way past.  Not finding a key is part of the
+// normal course of things (e.g. holes, new files), so it's kept apart.
+#define CFS_TIMED_CALL(op,call)						\
+do {									\
+	CfsTimer	timer(op);					\
+	try {								\
+		call;							\
+	}								\
+	catch (NotFoundException &tx) {					\
+		CfsStatCount(CFS_CTR_BE_NOT_FOUND,1);			\
+		throw;							\
+	}								\
+	catch (...) {							\
+		CfsStatCount(CFS_CTR_BE_ERRORS,1);			\
+		throw;							\
+	}								\
+} while (0)
+
+static uint64_t
+SliceBytes (const vector<ColumnOrSuperColumn> & cols)
+{
+	uint64_t	n	= 0;
+	size_t		i;
+	
+	for (i = 0; i < cols.size(); ++i) {
+		n += cols[i].column.value.size();
+	}
+	return n;
+}
+
+void
+CfsTimedClient::get (ColumnOrSuperColumn & _return, const string & keyspace,
+		     const string & key, const ColumnPath & column_path,
+		     const ConsistencyLevel consistency_level)
+{
+	CFS_TIMED_CALL(CFS_OP_BE_GET,
+		       inner->get(_return,keyspace,key,column_path,
+				  consistency_level));
+	CfsStatCount(CFS_CTR_BE_BYTES_IN,_return.column.value.size());
+}
+
+void
+CfsTimedClient::get_slice (vector<ColumnOrSuperColumn> & _return,
+			   const string & keyspace, const string & key,
+			   const ColumnParent & column_parent,
+			   const SlicePredicate & predicate,
+			   const ConsistencyLevel consistency_level)
+{
+	CFS_TIMED_CALL(CFS_OP_BE_GET_SLICE,
+		       inner->get_slice(_return,keyspace,key,column_parent,
+					predicate,consistency_level));
+	CfsStatCount(CFS_CTR_BE_BYTES_IN,SliceBytes(_return));
+}
+
+void
+CfsTimedClient::multiget (map<string,ColumnOrSuperColumn> & _return,
+			  const string & keyspace,
+			  const vector<string> & keys,
+			  const ColumnPath & column_path,
+			  const ConsistencyLevel consistency_level)
+{
+	map<string,ColumnOrSuperColumn>::iterator	it;
+	uint64_t					n	= 0;
+	
+	CFS_TIMED_CALL(CFS_OP_BE_MULTIGET,
+		       inner->multiget(_return,keyspace,keys,column_path,
+				       consistency_level));
+	for (it = _return.begin(); it != _return.end(); ++it) {
+		n += it->second.column.value.size();
+	}
+	CfsStatCount(CFS_CTR_BE_BYTES_IN,n);
+}
+
+void
+CfsTimedClient::multiget_slice (map<string,vector<ColumnOrSuperColumn> > &
+				_return,
+				const string & keyspace,
+				const vector<string> & keys,
+				const ColumnParent & column_parent,
+				const SlicePredicate & predicate,
+				const ConsistencyLevel consistency_level)
+{
+	map<string,vector<ColumnOrSuperColumn> >::iterator	it;
+	uint64_t						n	= 0;
+	
+	CFS_TIMED_CALL(CFS_OP_BE_MULTIGET_SLICE,
+		       inner->multiget_slice(_return,keyspace,keys,
+					     column_parent,predicate,
+					     consistency_level));
+	for (it = _return.begin(); it != _return.end(); ++it) {
+		n += SliceBytes(it->second);
+	}
+	CfsStatCount(CFS_CTR_BE_BYTES_IN,n);
+}
+
+int32_t
+CfsTimedClient::get_count (const string & keyspace, const string & key,
+			   const ColumnParent & column_parent,
+			   const ConsistencyLevel consistency_level)
+{
+	int32_t	n	= 0;
+	
+	CFS_TIMED_CALL(CFS_OP_BE_GET_COUNT,
+		       n = inner->get_count(keyspace,key,column_parent,
+					    consistency_level));
+	return n;
+}
+
+void
+CfsTimedClient::get_key_range (vector<string> & _return,
+			       const string & keyspace,
+			       const string & column_family,
+			       const string & start, const string & finish,
+			       const int32_t count,
+			       const ConsistencyLevel consistency_level)
+{
+	CFS_TIMED_CALL(CFS_OP_BE_GET_KEY_RANGE,
+		       inner->get_key_range(_return,keyspace,column_family,
+					    start,finish,count,
+					    consistency_level));
+}
+
+void
+CfsTimedClient::insert (const string & keyspace, const string & key,
+			const ColumnPath & column_path, const string & value,
+			const int64_t timestamp,
+			const ConsistencyLevel consistency_level)
+{
+	CFS_TIMED_CALL(CFS_OP_BE_INSERT,
+		       inner->insert(keyspace,key,column_path,value,timestamp,
+				     consistency_level));
+	CfsStatCount(CFS_CTR_BE_BYTES_OUT,value.size());
+}
+
+void
+CfsTimedClient::batch_insert (const string & keyspace, const string & key,
+			      const map<string,vector<ColumnOrSuperColumn> > &
+			      cfmap,
+			      const ConsistencyLevel consistency_level)
+{
+	map<string,vector<ColumnOrSuperColumn> >::const_iterator	it;
+	uint64_t							n = 0;
+	
+	CFS_TIMED_CALL(CFS_OP_BE_BATCH_INSERT,
+		       inner->batch_insert(keyspace,key,cfmap,
+					   consistency_level));
+	for (it = cfmap.begin(); it != cfmap.end(); ++it) {
+		n += SliceBytes(it->second);
+	}
+	CfsStatCount(CFS_CTR_BE_BYTES_OUT,n);
+}
+
+void
+CfsTimedClient::remove (const string & keyspace, const string & key,
+			const ColumnPath & column_path,
+			const int64_t timestamp,
+			const ConsistencyLevel consistency_level)
+{
+	CFS_TIMED_CALL(CFS_OP_BE_REMOVE,
+		       inner->remove(keyspace,key,column_path,timestamp,
+				     consistency_level));
+}
+
+// The rest are rare enough not to bother timing.
+
+void
+CfsTimedClient::get_string_property (string & _return,
+				     const string & property)
+{
+	inner->get_string_property(_return,property);
+}
+
+void
+CfsTimedClient::get_string_list_property (vector<string> & _return,
+					  const string & property)
+{
+	inner->get_string_list_property(_return,property);
+}
+
+void
+CfsTimedClient::describe_keyspace (map<string,map<string,string> > &
+				   _return, const string & keyspace)
+{
+	inner->describe_keyspace(_return,keyspace);
+}
+
+CfsMemConnector::CfsMemConnector ()
+{
+	pthread_mutex_init(&store.lock,NULL);
+}
+
+CfsMemConnector::~CfsMemConnector ()
+{
+	pthread_mutex_destroy(&store.lock);
+}
+
+CassandraIf *
+CfsMemConnector::Connect (void)
+{
+	return new CfsMemClient(&store);
+}
+
+void
+CfsMemConnector::Disconnect (CassandraIf * client)
+{
+	delete client;
+}
+
+// Caller holds store->lock.
+void
+CfsMemClient::Put (CfsMemRow & row, const string & name, const string & value,
+		   int64_t timestamp)
+{
+	CfsMemRow::iterator	it	= row.find(name);
+	
+	if (it == row.end()) {
+		it = row.insert(make_pair(name,Column())).first;
+		it->second.name = name;
+	}
+	else if (it->second.timestamp > timestamp) {
+		return;		// a newer write already won
+	}
+	it->second.value = value;
+	it->second.timestamp = timestamp;
+}
+
+static void
+MemColumn (const Column & col, ColumnOrSuperColumn & out)
+{
+	out.column = col;
+	out.__isset.column = true;
+}
+
+// Caller holds the store's lock.
+static void
+MemSlice (const CfsMemRow & row, const SlicePredicate & predicate,
+	  vector<ColumnOrSuperColumn> & out)
+{
+	const SliceRange &		range	= predicate.slice_range;
+	CfsMemRow::const_iterator	it;
+	CfsMemRow::const_reverse_iterator	rit;
+	ColumnOrSuperColumn		cosc;
+	size_t				i;
+	
+	out.clear();
+	if (predicate.__isset.column_names) {
+		for (i = 0; i < predicate.column_names.size(); ++i) {
+			it = row.find(predicate.column_names[i]);
+			if (it != row.end()) {
+				MemColumn(it->second,cosc);
+				out.push_back(cosc);
+			}
+		}
+		return;
+	}
+	
+	if (!range.reversed) {
+		it = range.start.empty() ? row.begin()
+					 : row.lower_bound(range.start);
+		for (; it != row.end(); ++it) {
+			if ((int32_t)out.size() >= range.count) {
+				break;
+			}
+			if (!range.finish.empty() && (it->first > range.finish)) {
+				break;
+			}
+			MemColumn(it->second,cosc);
+			out.push_back(cosc);
+		}
+	}
+	else {
+		rit = range.start.empty() ? row.rbegin()
+			: CfsMemRow::const_reverse_iterator(
+				row.upper_bound(range.start));
+		for (; rit != row.rend(); ++rit) {
+			if ((int32_t)out.size() >= range.count) {
+				break;
+			}
+			if (!range.finish.empty() && (rit->first < range.finish)) {
+				break;
+			}
+			MemColumn(rit->second,cosc);
+			out.push_back(cosc);
+		}
+	}
+}
+
+void
+CfsMemClient::get (ColumnOrSuperColumn & _return, const string & keyspace,
+		   const string & key, const ColumnPath & column_path,
+		   const ConsistencyLevel consistency_level)
+{
+	map<string,CfsMemRow>::iterator	rit;
+	CfsMemRow::iterator		cit;
+	bool				found	= false;
+	
+	pthread_mutex_lock(&store->lock);
+	rit = store->rows.find(key);
+	if (rit != store->rows.end()) {
+		cit = rit->second.find(column_path.column);
+		if (cit != rit->second.end()) {
+			MemColumn(cit->second,_return);
+			found = true;
+		}
+	}
+	pthread_mutex_unlock(&store->lock);
+	if (!found) {
+		throw NotFoundException();
+	}
+}
+
+void
+CfsMemClient::get_slice (vector<ColumnOrSuperColumn> & _return,
+			 const string & keyspace, const string & key,
+			 const ColumnParent & column_parent,
+			 const SlicePredicate & predicate,
+			 const ConsistencyLevel consistency_level)
+{
+	map<string,CfsMemRow>::iterator	rit;
+	
+	_return.clear();
+	pthread_mutex_lock(&store->lock);
+	rit = store->rows.find(key);
+	if (rit != store->rows.end()) {
+		MemSlice(rit->second,predicate,_return);
+	}
+	pthread_mutex_unlock(&store->lock);
+}
+
+// Keys that aren't there are left out, as with the real thing.
+void
+CfsMemClient::multiget (map<string,ColumnOrSuperColumn> & _return,
+			const string & keyspace, const vector<string> & keys,
+			const ColumnPath & column_path,
+			const ConsistencyLevel consistency_level)
+{
+	map<string,CfsMemRow>::iterator	rit;
+	CfsMemRow::iterator		cit;
+	size_t				i;
+	
+	_return.clear();
+	pthread_mutex_lock(&store->lock);
+	for (i = 0; i < keys.size(); ++i) {
+		rit = store->rows.find(keys[i]);
+		if (rit == store->rows.end()) {
+			continue;
+		}
+		cit = rit->second.find(column_path.column);
+		if (cit != rit->second.end()) {
+			MemColumn(cit->second,_return[keys[i]]);
+		}
+	}
+	pthread_mutex_unlock(&store->lock);
+}
+
+void
+CfsMemClient::multiget_slice (map<string,vector<ColumnOrSuperColumn> > &
+			      _return,
+			      const string & keyspace,
+			      const vector<string> & keys,
+			      const ColumnParent & column_parent,
+			      const SlicePredicate & predicate,
+			      const ConsistencyLevel consistency_level)
+{
+	map<string,CfsMemRow>::iterator	rit;
+	size_t				i;
+	
+	_return.clear();
+	pthread_mutex_lock(&store->lock);
+	for (i = 0; i < keys.size(); ++i) {
+		rit = store->rows.find(keys[i]);
+		if (rit != store->rows.end()) {
+			MemSlice(rit->second,predicate,_return[keys[i]]);
+		}
+		else {
+			_return[keys[i]].clear();
+		}
+	}
+	pthread_mutex_unlock(&store->lock);
+}
+
+int32_t
+CfsMemClient::get_count (const string & keyspace, const string & key,
+			 const ColumnParent & column_parent,
+			 const ConsistencyLevel consistency_level)
+{
+	map<string,CfsMemRow>::iterator	rit;
+	int32_t				n	= 0;
+	
+	pthread_mutex_lock(&store->lock);
+	rit = store->rows.find(key);
+	if (rit != store->rows.end()) {
+		n = rit->second.size();
+	}
+	pthread_mutex_unlock(&store->lock);
+	return n;
+}
+
+// In key order, as with OrderPreservingPartitioner.
+void
+CfsMemClient::get_key_range (vector<string> & _return,
+			     const string & keyspace,
+			     const string & column_family,
+			     const string & start, const string & finish,
+			     const int32_t count,
+			     const ConsistencyLevel consistency_level)
+{
+	map<string,CfsMemRow>::iterator	rit;
+	
+	_return.clear();
+	pthread_mutex_lock(&store->lock);
+	for (rit = store->rows.lower_bound(start); rit != store->rows.end();
+	     ++rit) {
+		if ((int32_t)_return.size() >= count) {
+			break;
+		}
+		if (!finish.empty() && (rit->first > finish)) {
+			break;
+		}
+		_return.push_back(rit->first);
+	}
+	pthread_mutex_unlock(&store->lock);
+}
+
+void
+CfsMemClient::insert (const string & keyspace, const string & key,
+		      const ColumnPath & column_path, const string & value,
+		      const int64_t timestamp,
+		      const ConsistencyLevel consistency_level)
+{
+	pthread_mutex_lock(&store->lock);
+	Put(store->rows[key],column_path.column,value,timestamp);
+	pthread_mutex_unlock(&store->lock);
+}
+
+void
+CfsMemClient::batch_insert (const string & keyspace, const string & key,
+			    const map<string,vector<ColumnOrSuperColumn> > &
+			    cfmap,
+			    const ConsistencyLevel consistency_level)
+{
+	map<string,vector<ColumnOrSuperColumn> >::const_iterator	it;
+	CfsMemRow *							row;
+	size_t								i;
+	
+	pthread_mutex_lock(&store->lock);
+	row = &store->rows[key];
+	for (it = cfmap.begin(); it != cfmap.end(); ++it) {
+		for (i = 0; i < it->second.size(); ++i) {
+			const Column &	col	= it->second[i].column;
+			
+			Put(*row,col.name,col.value,col.timestamp);
+		}
+	}
+	pthread_mutex_unlock(&store->lock);
+}
+
+// Without a column, removes whatever in the row is no newer than timestamp.
+void
+CfsMemClient::remove (const string & keyspace, const string & key,
+		      const ColumnPath & column_path, const int64_t timestamp,
+		      const ConsistencyLevel consistency_level)
+{
+	map<string,CfsMemRow>::iterator	rit;
+	CfsMemRow::iterator		cit;
+	
+	pthread_mutex_lock(&store->lock);
+	rit = store->rows.find(key);
+	if (rit == store->rows.end()) {
+		pthread_mutex_unlock(&store->lock);
+		return;
+	}
+	if (column_path.__isset.column) {
+		cit = rit->second.find(column_path.column);
+		if ((cit != rit->second.end())
+		    && (cit->second.timestamp <= timestamp)) {
+			rit->second.erase(cit);
+		}
+	}
+	else {
+		for (cit = rit->second.begin(); cit != rit->second.end(); ) {
+			if (cit->second.timestamp <= timestamp) {
+				rit->second.erase(cit++);
+			}
+			else {
+				++cit;
+			}
+		}
+	}
+	if (rit->second.empty()) {
+		store->rows.erase(rit);
+	}
+	pthread_mutex_unlock(&store->lock);
+}
+
+void
+CfsMemClient::get_string_property (string & _return, const string & property)
+{
+	_return.clear();
+}
+
+void
+CfsMemClient::get_string_list_property (vector<string> & _return,
+					const string & property)
+{
+	_return.clear();
+}
+
+void
+CfsMemClient::describe_keyspace (map<string,map<string,string> > & _return,
+				 const string & keyspace)
+{
+	_return.clear();
+}
+
+static int
+LatencyOp (const char * name)
+{
+	int	op;
+	
+	for (op = CFS_OP_BE_GET; op < CFS_OP_COUNT; ++op) {
+		if (!strcmp(name,CfsStatOpName(op)+3)) {	// less "be_"
+			return op - CFS_OP_BE_GET;
+		}
+	}
+	return -1;
+}
+
+// Splits "kind:x:y" into kind and its numbers, returning how many numbers
+// there were, or -1 for more than max or anything that isn't one.
+static int
+ClauseArgs (char * clause, double * args, int max)
+{
+	char *	p	= strchr(clause,':');
+	char *	end;
+	int	n	= 0;
+	
+	if (!p) {
+		return 0;
+	}
+	*p = '\0';
+	while (p) {
+		if (n == max) {
+			return -1;
+		}
+		args[n++] = strtod(p+1,&end);
+		if ((end == p+1) || (*end && (*end != ':'))) {
+			return -1;
+		}
+		p = *end ? end : NULL;
+	}
+	return n;
+}
+
+int
+CfsParseLatency (const char * spec, CfsLatencySpec * lsp)
+{
+	string		copy	= spec;
+	CfsDelay	none	= { CFS_DELAY_NONE, 0, 0, 0, 0 };
+	char *		save;
+	char *		clause;
+	char *		eq;
+	double		args[2];
+	int		nargs;
+	int		first;
+	int		last;
+	int		dist;
+	int		op;
+	
+	lsp->delays.assign(CFS_OP_COUNT-CFS_OP_BE_GET,none);
+	lsp->ns_per_byte = 0;
+	lsp->fail = false;
+	for (clause = strtok_r(&copy[0],"/",&save); clause;
+	     clause = strtok_r(NULL,"/",&save)) {
+		first = 0;
+		last = lsp->delays.size() - 1;
+		eq = strchr(clause,'=');
+		if (eq) {
+			*eq = '\0';
+			first = last = LatencyOp(clause);
+			if (first < 0) {
+				return EINVAL;
+			}
+			clause = eq + 1;
+		}
+		nargs = ClauseArgs(clause,args,2);
+		if (!strcmp(clause,"timeout") && (nargs == 2)
+		    && (args[0] >= 0) && (args[0] <= 1) && (args[1] >= 0)) {
+			for (op = first; op <= last; ++op) {
+				lsp->delays[op].timeout_prob = args[0];
+				lsp->delays[op].timeout_ms = args[1];
+			}
+			continue;
+		}
+		if (!strcmp(clause,"bw") && !eq && (nargs == 1)
+		    && (args[0] > 0)) {
+			lsp->ns_per_byte = 1e9 / (args[0] * 1024 * 1024);
+			continue;
+		}
+		if (!strcmp(clause,"fail") && !eq && (nargs == 0)) {
+			lsp->fail = true;
+			continue;
+		}
+		if (!strcmp(clause,"fixed") && (nargs == 1) && (args[0] >= 0)) {
+			dist = CFS_DELAY_FIXED;
+			args[1] = 0;
+		}
+		else if (!strcmp(clause,"normal") && (nargs == 2)
+			 && (args[0] >= 0) && (args[1] >= 0)) {
+			dist = CFS_DELAY_NORMAL;
+		}
+		else if (!strcmp(clause,"pareto") && (nargs == 2)
+			 && (args[0] > 0) && (args[1] > 0)) {
+			dist = CFS_DELAY_PARETO;
+		}
+		else {
+			return EINVAL;
+		}
+		for (op = first; op <= last; ++op) {
+			lsp->delays[op].dist = dist;
+			lsp->delays[op].a = args[0];
+			lsp->delays[op].b = args[1];
+		}
+	}
+	return 0;
+}
+
+static void
+SleepUntil (uint64_t when)
+{
+	uint64_t	now;
+	struct timespec	ts;
+	
+	for (now = CfsNowNs(); now < when; now = CfsNowNs()) {
+		ts.tv_sec = (when - now) / 1000000000;
+		ts.tv_nsec = (when - now) % 1000000000;
+		(void)nanosleep(&ts,NULL);
+	}
+}
+
+CfsLatencyConnector::CfsLatencyConnector (CfsConnector * an_inner,
+					  bool an_own_inner,
+					  const CfsLatencySpec & a_spec) :
+	inner(an_inner), own_inner(an_own_inner), spec(a_spec), link_free(0),
+	next_seed(1)
+{
+	pthread_mutex_init(&link_lock,NULL);
+}
+
+CfsLatencyConnector::~CfsLatencyConnector ()
+{
+	if (own_inner) {
+		delete inner;
+	}
+	pthread_mutex_destroy(&link_lock);
+}
+
+// Each connection gets its own seed, so that runs can be repeated.
+CassandraIf *
+CfsLatencyConnector::Connect (void)
+{
+	return new CfsLatencyClient(this,inner->Connect(),
+				    __sync_fetch_and_add(&next_seed,1));
+}
+
+void
+CfsLatencyConnector::Disconnect (CassandraIf * client)
+{
+	CfsLatencyClient *	lclient	= static_cast<CfsLatencyClient *>(client);
+	
+	inner->Disconnect(lclient->Inner());
+	delete lclient;
+}
+
+// Books bytes on the link, starting no earlier than when, and returns
+// when they'll be through.
+uint64_t
+CfsLatencyConnector::Transfer (uint64_t when, uint64_t bytes)
+{
+	uint64_t	done;
+	
+	if (!spec.ns_per_byte || !bytes) {
+		return when;
+	}
+	pthread_mutex_lock(&link_lock);
+	done = ((when > link_free) ? when : link_free)
+		+ (uint64_t)(bytes * spec.ns_per_byte);
+	link_free = done;
+	pthread_mutex_unlock(&link_lock);
+	return done;
+}
+
+// In (0,1), so it's safe to take the log of.
+double
+CfsLatencyClient::Uniform (void)
+{
+	return (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+}
+
+// In us.
+double
+CfsLatencyClient::Draw (const CfsDelay & delay)
+{
+	double	us;
+	
+	switch (delay.dist) {
+	case CFS_DELAY_FIXED:
+		return delay.a;
+	case CFS_DELAY_NORMAL:
+		us = delay.a + delay.b * sqrt(-2 * log(Uniform()))
+			* cos(2 * M_PI * Uniform());
+		return (us > 0) ? us : 0;
+	case CFS_DELAY_PARETO:
+		return delay.a / pow(Uniform(),1 / delay.b);
+	}
+	return 0;
+}
+
+// Maybe times out; returns when the call (really) started.
+uint64_t
+CfsLatencyClient::Before (int op)
+{
+	const CfsDelay &	delay	= conn->Spec().delays[op-CFS_OP_BE_GET];
+	
+	if (delay.timeout_prob && (Uniform() < delay.timeout_prob)) {
+		SleepUntil(CfsNowNs() + (uint64_t)(delay.timeout_ms * 1e6));
+		if (conn->Spec().fail) {
+			throw TTransportException(TTransportException::TIMED_OUT,
+						  "simulated timeout");
+		}
+	}
+	return CfsNowNs();
+}
+
+// Time spent in the inner call counts towards the delay.
+void
+CfsLatencyClient::After (int op, uint64_t start, uint64_t bytes)
+{
+	const CfsDelay &	delay	= conn->Spec().delays[op-CFS_OP_BE_GET];
+	uint64_t		when;
+	
+	when = start + (uint64_t)(Draw(delay) * 1000);
+	SleepUntil(conn->Transfer(when,bytes));
+}
+
+// A miss costs a round trip too.
+#define CFS_DELAYED_CALL(op,call,bytes)					\
+do {									\
+	uint64_t	began	= Before(op);				\
+	try {								\
+		call;							\
+	}								\
+	catch (...) {							\
+		After(op,began,0);					\
+		throw;							\
+	}								\
+	After(op,began,bytes);						\
+} while (0)
+
+static uint64_t
+ColumnsBytes (const map<string,ColumnOrSuperColumn> & cols)
+{
+	map<string,ColumnOrSuperColumn>::const_iterator	it;
+	uint64_t					n	= 0;
+	
+	for (it = cols.begin(); it != cols.end(); ++it) {
+		n += it->second.column.value.size();
+	}
+	return n;
+}
+
+static uint64_t
+MapBytes (const map<string,vector<ColumnOrSuperColumn> > & cfmap)
+{
+	map<string,vector<ColumnOrSuperColumn> >::const_iterator	it;
+	uint64_t							n = 0;
+	
+	for (it = cfmap.begin(); it != cfmap.end(); ++it) {
+		n += SliceBytes(it->second);
+	}
+	return n;
+}
+
+void
+CfsLatencyClient::get (ColumnOrSuperColumn & _return,
+		       const string & keyspace, const string & key,
+		       const ColumnPath & column_path,
+		       const ConsistencyLevel consistency_level)
+{
+	CFS_DELAYED_CALL(CFS_OP_BE_GET,
+			 inner->get(_return,keyspace,key,column_path,
+				    consistency_level),
+			 _return.column.value.size());
+}
+
+void
+CfsLatencyClient::get_slice (vector<ColumnOrSuperColumn> & _return,
+			     const string & keyspace, const string & key,
+			     const ColumnParent & column_parent,
+			     const SlicePredicate & predicate,
+			     const ConsistencyLevel consistency_level)
+{
+	CFS_DELAYED_CALL(CFS_OP_BE_GET_SLICE,
+			 inner->get_slice(_return,keyspace,key,column_parent,
+					  predicate,consistency_level),
+			 SliceBytes(_return));
+}
+
+void
+CfsLatencyClient::multiget (map<string,ColumnOrSuperColumn> & _return,
+			    const string & keyspace,
+			    const vector<string> & keys,
+			    const ColumnPath & column_path,
+			    const ConsistencyLevel consistency_level)
+{
+	CFS_DELAYED_CALL(CFS_OP_BE_MULTIGET,
+			 inner->multiget(_return,keyspace,keys,column_path,
+					 consistency_level),
+			 ColumnsBytes(_return));
+}
+
+void
+CfsLatencyClient::multiget_slice (map<string,vector<ColumnOrSuperColumn> > &
+				  _return,
+				  const string & keyspace,
+				  const vector<string> & keys,
+				  const ColumnParent & column_parent,
+				  const SlicePredicate & predicate,
+				  const ConsistencyLevel consistency_level)
+{
+	CFS_DELAYED_CALL(CFS_OP_BE_MULTIGET_SLICE,
+			 inner->multiget_slice(_return,keyspace,keys,
+					       column_parent,predicate,
+					       consistency_level),
+			 MapBytes(_return));
+}
+
+int32_t
+CfsLatencyClient::get_count (const string & keyspace, const string & key,
+			     const ColumnParent & column_parent,
+			     const ConsistencyLevel consistency_level)
+{
+	int32_t	n	= 0;
+	
+	CFS_DELAYED_CALL(CFS_OP_BE_GET_COUNT,
+			 n = inner->get_count(keyspace,key,column_parent,
+					      consistency_level),
+			 0);
+	return n;
+}
+
+void
+CfsLatencyClient::get_key_range (vector<string> & _return,
+				 const string & keyspace,
+				 const string & column_family,
+				 const string & start, const string & finish,
+				 const int32_t count,
+				 const ConsistencyLevel consistency_level)
+{
+	CFS_DELAYED_CALL(CFS_OP_BE_GET_KEY_RANGE,
+			 inner->get_key_range(_return,keyspace,column_family,
+					      start,finish,count,
+					      consistency_level),
+			 0);
+}
+
+void
+CfsLatencyClient::insert (const string & keyspace, const string & key,
+			  const ColumnPath & column_path,
+			  const string & value, const int64_t timestamp,
+			  const ConsistencyLevel consistency_level)
+{
+	CFS_DELAYED_CALL(CFS_OP_BE_INSERT,
+			 inner->insert(keyspace,key,column_path,value,
+				       timestamp,consistency_level),
+			 value.size());
+}
+
+void
+CfsLatencyClient::batch_insert (const string & keyspace,
+				const string & key,
+				const map<string,vector<ColumnOrSuperColumn> > &
+				cfmap,
+				const ConsistencyLevel consistency_level)
+{
+	CFS_DELAYED_CALL(CFS_OP_BE_BATCH_INSERT,
+			 inner->batch_insert(keyspace,key,cfmap,
+					     consistency_level),
+			 MapBytes(cfmap));
+}
+
+void
+CfsLatencyClient::remove (const string & keyspace, const string & key,
+			  const ColumnPath & column_path,
+			  const int64_t timestamp,
+			  const ConsistencyLevel consistency_level)
+{
+	CFS_DELAYED_CALL(CFS_OP_BE_REMOVE,
+			 inner->remove(keyspace,key,column_path,timestamp,
+				       consistency_level),
+			 0);
+}
+
+// As in CfsTimedClient, the rest go straight through.
+
+void
+CfsLatencyClient::get_string_property (string & _return,
+				       const string & property)
+{
+	inner->get_string_property(_return,property);
+}
+
+void
+CfsLatencyClient::get_string_list_property (vector<string> & _return,
+					    const string & property)
+{
+	inner->get_string_list_property(_return,property);
+}
+
+void
+CfsLatencyClient::describe_keyspace (map<string,map<string,string> > &
+				     _return, const string & keyspace)
+{
+	inner->describe_keyspace(_return,keyspace);
+}
@@ -0,0 +1,339 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Where CassFs gets its connections to the store.  It keeps one for its
+// own requests, and the write pipeline asks for one per worker thread.
+// Anything implementing CassandraIf will do, so a test or benchmark can
+// plug in something other than a real cluster.
+
+#include <pthread.h>
+
+class CfsConnector {
+public:
+	virtual			~CfsConnector	() {}
+	virtual CassandraIf *	Connect		(void) = 0;
+	virtual void		Disconnect	(CassandraIf * client) = 0;
+};
+
+// Where CassFs() and the daemons look for a cluster.
+#define THRIFT_HOST "localhost"
+#define THRIFT_PORT 9160
+
+// Real connections, over Thrift.
+class CfsThriftConnector : public CfsConnector {
+private:
+	string		host;
+	int		port;
+	
+public:
+			CfsThriftConnector	(const char * a_host, int a_port);
+	CassandraIf *	Connect			(void);
+	void		Disconnect		(CassandraIf * client);
+};
+
+// Wraps another connector so that every call on its connections is timed
+// and counted (see stats.h).  CassFs puts one around whatever connector it
+// is given.
+class CfsTimedConnector : public CfsConnector {
+private:
+	CfsConnector *	inner;
+	bool		own_inner;
+	
+public:
+			CfsTimedConnector	(CfsConnector * an_inner,
+						 bool an_own_inner);
+			~CfsTimedConnector	();
+	CassandraIf *	Connect			(void);
+	void		Disconnect		(CassandraIf * client);
+};
+
+class CfsTimedClient : public CassandraIf {
+private:
+	CassandraIf *	inner;
+	
+public:
+		CfsTimedClient	(CassandraIf * an_inner) : inner(an_inner) {}
+	CassandraIf *	Inner	(void) { return inner; }
+	
+	void	get		(ColumnOrSuperColumn & _return,
+				 const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const ConsistencyLevel consistency_level);
+	void	get_slice	(vector<ColumnOrSuperColumn> & _return,
+				 const string & keyspace, const string & key,
+				 const ColumnParent & column_parent,
+				 const SlicePredicate & predicate,
+				 const ConsistencyLevel consistency_level);
+	void	multiget	(map<string,ColumnOrSuperColumn> & _return,
+				 const string & keyspace,
+				 const vector<string> & keys,
+				 const ColumnPath & column_path,
+				 const ConsistencyLevel consistency_level);
+	void	multiget_slice	(map<string,vector<ColumnOrSuperColumn> > &
+				 _return,
+				 const string & keyspace,
+				 const vector<string> & keys,
+				 const ColumnParent & column_parent,
+				 const SlicePredicate & predicate,
+				 const ConsistencyLevel consistency_level);
+	int32_t	get_count	(const string & keyspace, const string & key,
+				 const ColumnParent & column_parent,
+				 const ConsistencyLevel consistency_level);
+	void	get_key_range	(vector<string> & _return,
+				 const string & keyspace,
+				 const string & column_family,
+				 const string & start, const string & finish,
+				 const int32_t count,
+				 const ConsistencyLevel consistency_level);
+	void	insert		(const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const string & value, const int64_t timestamp,
+				 const ConsistencyLevel consistency_level);
+	void	batch_insert	(const string & keyspace, const string & key,
+				 const map<string,vector<ColumnOrSuperColumn> > &
+				 cfmap,
+				 const ConsistencyLevel consistency_level);
+	void	remove		(const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const int64_t timestamp,
+				 const ConsistencyLevel consistency_level);
+	void	get_string_property	(string & _return,
+					 const string & property);
+	void	get_string_list_property	(vector<string> & _return,
+						 const string & property);
+	void	describe_keyspace	(map<string,map<string,string> > &
+					 _return, const string & keyspace);
+};
+
+// A stand-in for a cluster, all in memory, for benchmarks and tests.  The
+// store belongs to the connector and is shared by every connection made
+// from it, so the pipeline's workers see the same data as CassFs.  It
+// follows Cassandra where CassFs could tell the difference (a write only
+// replaces a column if its timestamp is no older, get throws
+// NotFoundException) but ignores keyspaces and column families, and a
+// remove leaves no tombstone.
+typedef map<string,Column>	CfsMemRow;
+
+struct CfsMemStore {
+	pthread_mutex_t		lock;
+	map<string,CfsMemRow>	rows;
+};
+
+class CfsMemConnector : public CfsConnector {
+private:
+	CfsMemStore	store;
+	
+public:
+			CfsMemConnector		();
+			~CfsMemConnector	();
+	CassandraIf *	Connect			(void);
+	void		Disconnect		(CassandraIf * client);
+};
+
+class CfsMemClient : public CassandraIf {
+private:
+	CfsMemStore *	store;
+	
+	void	Put		(CfsMemRow & row, const string & name,
+				 const string & value, int64_t timestamp);
+	
+public:
+		CfsMemClient	(CfsMemStore * a_store) : store(a_store) {}
+	
+	void	get		(ColumnOrSuperColumn & _return,
+				 const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const ConsistencyLevel consistency_level);
+	void	get_slice	(vector<ColumnOrSuperColumn> & _return,
+				 const string & keyspace, const string & key,
+				 const ColumnParent & column_parent,
+				 const SlicePredicate & predicate,
+				 const ConsistencyLevel consistency_level);
+	void	multiget	(map<string,ColumnOrSuperColumn> & _return,
+				 const string & keyspace,
+				 const vector<string> & keys,
+				 const ColumnPath & column_path,
+				 const ConsistencyLevel consistency_level);
+	void	multiget_slice	(map<string,vector<ColumnOrSuperColumn> > &
+				 _return,
+				 const string & keyspace,
+				 const vector<string> & keys,
+				 const ColumnParent & column_parent,
+				 const SlicePredicate & predicate,
+				 const ConsistencyLevel consistency_level);
+	int32_t	get_count	(const string & keyspace, const string & key,
+				 const ColumnParent & column_parent,
+				 const ConsistencyLevel consistency_level);
+	void	get_key_range	(vector<string> & _return,
+				 const string & keyspace,
+				 const string & column_family,
+				 const string & start, const string & finish,
+				 const int32_t count,
+				 const ConsistencyLevel consistency_level);
+	void	insert		(const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const string & value, const int64_t timestamp,
+				 const ConsistencyLevel consistency_level);
+	void	batch_insert	(const string & keyspace, const string & key,
+				 const map<string,vector<ColumnOrSuperColumn> > &
+				 cfmap,
+				 const ConsistencyLevel consistency_level);
+	void	remove		(const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const int64_t timestamp,
+				 const ConsistencyLevel consistency_level);
+	void	get_string_property	(string & _return,
+					 const string & property);
+	void	get_string_list_property	(vector<string> & _return,
+						 const string & property);
+	void	describe_keyspace	(map<string,map<string,string> > &
+					 _return, const string & keyspace);
+};
+
+// Makes another connector's connections behave like ones to a cluster
+// across a real network, for trying out things like pipelining and
+// caching on one machine: each call is held up by a delay drawn from a
+// distribution, then by the time its data takes over a link of limited
+// bandwidth (one link, shared by every connection made from the
+// connector), and now and then it times out first.  A spec is a list of
+// clauses separated by '/':
+//
+//	fixed:US		always US microseconds
+//	normal:MEAN:SD		normally distributed, in microseconds
+//	pareto:MIN:SHAPE	long-tailed, never less than MIN (shape 1-3)
+//	timeout:PROB:MS		with probability PROB, stall MS milliseconds
+//	bw:MBS			MB/s over the link, in both directions
+//	fail			timeouts throw TTransportException
+//
+// The first four apply to every call unless prefixed with a call's name
+// (as in stats.h, less "be_"), e.g. "normal:500:100/insert=fixed:2000".
+// A later clause overrides an earlier one.  By default a call that times
+// out goes through once the stall is over, as if retried; most of CassFs
+// doesn't handle store errors yet, so "fail" is for testing that.
+
+#define CFS_DELAY_NONE		0
+#define CFS_DELAY_FIXED		1
+#define CFS_DELAY_NORMAL	2
+#define CFS_DELAY_PARETO	3
+
+typedef struct {
+	int	dist;		// CFS_DELAY_*
+	double	a;		// fixed, mean or minimum (us)
+	double	b;		// standard deviation (us) or shape
+	double	timeout_prob;
+	double	timeout_ms;
+} CfsDelay;
+
+struct CfsLatencySpec {
+	vector<CfsDelay>	delays;		// by CFS_OP_BE_* - CFS_OP_BE_GET
+	double			ns_per_byte;	// 0 for no limit
+	bool			fail;
+};
+
+// Returns EINVAL if spec doesn't parse.
+int	CfsParseLatency	(const char * spec, CfsLatencySpec * lsp);
+
+class CfsLatencyConnector : public CfsConnector {
+private:
+	CfsConnector *	inner;
+	bool		own_inner;
+	CfsLatencySpec	spec;
+	pthread_mutex_t	link_lock;
+	uint64_t	link_free;	// when the link is next idle (ns)
+	unsigned int	next_seed;
+	
+public:
+			CfsLatencyConnector	(CfsConnector * an_inner,
+						 bool an_own_inner,
+						 const CfsLatencySpec & a_spec);
+			~CfsLatencyConnector	();
+	CassandraIf *	Connect			(void);
+	void		Disconnect		(CassandraIf * client);
+	
+	const CfsLatencySpec &	Spec		(void) { return spec; }
+	uint64_t		Transfer	(uint64_t when,
+						 uint64_t bytes);
+};
+
+class CfsLatencyClient : public CassandraIf {
+private:
+	CfsLatencyConnector *	conn;
+	CassandraIf *		inner;
+	unsigned int		seed;		// for rand_r
+	
+	double		Uniform	(void);
+	double		Draw	(const CfsDelay & delay);
+	uint64_t	Before	(int op);
+	void		After	(int op, uint64_t start, uint64_t bytes);
+	
+public:
+		CfsLatencyClient	(CfsLatencyConnector * a_conn,
+					 CassandraIf * an_inner,
+					 unsigned int a_seed) :
+			conn(a_conn), inner(an_inner), seed(a_seed) {}
+	CassandraIf *	Inner	(void) { return inner; }
+	
+	void	get		(ColumnOrSuperColumn & _return,
+				 const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const ConsistencyLevel consistency_level);
+	void	get_slice	(vector<ColumnOrSuperColumn> & _return,
+				 const string & keyspace, const string & key,
+				 const ColumnParent & column_parent,
+				 const SlicePredicate & predicate,
+				 const ConsistencyLevel consistency_level);
+	void	multiget	(map<string,ColumnOrSuperColumn> & _return,
+				 const string & keyspace,
+				 const vector<string> & keys,
+				 const ColumnPath & column_path,
+				 const ConsistencyLevel consistency_level);
+	void	multiget_slice	(map<string,vector<ColumnOrSuperColumn> > &
+				 _return,
+				 const string & keyspace,
+				 const vector<string> & keys,
+				 const ColumnParent & column_parent,
+				 const SlicePredicate & predicate,
+				 const ConsistencyLevel consistency_level);
+	int32_t	get_count	(const string & keyspace, const string & key,
+				 const ColumnParent & column_parent,
+				 const ConsistencyLevel consistency_level);
+	void	get_key_range	(vector<string> & _return,
+				 const string & keyspace,
+				 const string & column_family,
+				 const string & start, const string & finish,
+				 const int32_t count,
+				 const ConsistencyLevel consistency_level);
+	void	insert		(const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const string & value, const int64_t timestamp,
+				 const ConsistencyLevel consistency_level);
+	void	batch_insert	(const string & keyspace, const string & key,
+				 const map<string,vector<ColumnOrSuperColumn> > &
+				 cfmap,
+				 const ConsistencyLevel consistency_level);
+	void	remove		(const string & keyspace, const string & key,
+				 const ColumnPath & column_path,
+				 const int64_t timestamp,
+				 const ConsistencyLevel consistency_level);
+	void	get_string_property	(string & _return,
+					 const string & property);
+	void	get_string_list_property	(vector<string> & _return,
+						 const string & property);
+	void	describe_keyspace	(map<string,map<string,string> > &
+					 _return, const string & keyspace);
+};
@@ -0,0 +1,130 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+#define POLY	0x82f63b78	// reflected Castagnoli polynomial
+
+typedef uint32_t crc_fn_t (uint32_t crc, const unsigned char * p, size_t len);
+
+static uint32_t	table[8][256];
+
+static uint32_t
+Crc32cSoft (uint32_t crc, const unsigned char * p, size_t len)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t	w;
+	
+	while (len && ((uintptr_t)p & 7)) {
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		--len;
+	}
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&w,p,sizeof(w));
+		w ^= crc;
+		crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff]
+		    ^ table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff]
+		    ^ table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff]
+		    ^ table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+	}
+#endif
+	while (len--) {
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t
+Crc32cHw (uint32_t crc, const unsigned char * p, size_t len)
+{
+	uint64_t	c;
+	uint64_t	w;
+	
+	while (len && ((uintptr_t)p & 7)) {
+		crc = _mm_crc32_u8(crc,*p++);
+		--len;
+	}
+	c = crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&w,p,sizeof(w));
+		c = _mm_crc32_u64(c,w);
+	}
+	crc = c;
+	while (len--) {
+		crc = _mm_crc32_u8(crc,*p++);
+	}
+	return crc;
+}
+#endif
+
+static crc_fn_t *	impl;
+static const char *	impl_name;
+
+// Builds the tables and picks an implementation when the library loads,
+// before any other threads could be calling us.
+static struct Crc32cInit {
+	Crc32cInit ()
+	{
+		uint32_t	crc;
+		int		i;
+		int		j;
+	
+		for (i = 0; i < 256; ++i) {
+			crc = i;
+			for (j = 0; j < 8; ++j) {
+				crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+			}
+			table[0][i] = crc;
+		}
+		for (i = 0; i < 256; ++i) {
+			for (j = 1; j < 8; ++j) {
+				table[j][i] = table[0][table[j-1][i] & 0xff]
+					    ^ (table[j-1][i] >> 8);
+			}
+		}
+	
+		impl = Crc32cSoft;
+		impl_name = "table";
+#if defined(__x86_64__)
+		if (__builtin_cpu_supports("sse4.2")) {
+			impl = Crc32cHw;
+			impl_name = "sse4.2";
+		}
+#endif
+	}
+} crc32c_init;
+
+uint32_t
+cfs_crc32c (const void * data, size_t len)
+{
+	return ~impl(~0U,(const unsigned char *)data,len);
+}
+
+const char *
+cfs_crc32c_impl (void)
+{
+	return impl_name;
+}
@@ -0,0 +1,27 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+// CRC32C (Castagnoli), as used by iSCSI, ext4 and btrfs.  Uses the SSE4.2
+// crc32 instruction when the CPU has it, else a slice-by-8 table.
+
+uint32_t	cfs_crc32c	(const void * data, size_t len);
+
+// Which implementation cfs_crc32c is using, e.g. for benchmark output.
+const char *	cfs_crc32c_impl	(void);
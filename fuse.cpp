@@ -17,6 +17,8 @@
 */
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <iostream>
 
@@ -35,7 +37,12 @@ using namespace apache::thrift::protocol;
 using namespace apache::thrift::transport;
 using namespace org::apache::cassandra;
 
+#include "connect.h"
 #include "cassfs.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "writebuf.h"
 
 extern "C" {
 
@@ -58,6 +65,7 @@ extern "C" {
 
 #include <fuse.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -68,37 +76,236 @@ extern "C" {
 #include <sys/xattr.h>
 #endif
 
+// Removals per second for freeing the space of unlinked files, unless the
+// reclaim option says otherwise.
+#define CFS_DEFAULT_RECLAIM	500
+
 struct my_opts {
 	char *	host;
 	char *	port;
 	char *	name;
+	char *	writers;	// write pipeline threads, if any
+	char *	window;		// blocks in flight (default 4 per thread)
+	char *	reclaim;	// removals/sec for freeing space (0 = off)
+	int	keep_cache;	// let the kernel keep unchanged files' pages
+	char *	log;		// error, warn, info or debug
+	char *	backend;	// cassandra (default) or mem
+	char *	trace;		// file to record calls to (see trace.h)
+	char *	latency;	// simulated, see CfsLatencyConnector
 };
 
 struct my_opts opts = { (char *)"localhost", (char *)"7777" };
 
+static CfsLatencySpec	latency_spec;
+
 struct fuse_opt my_opt_descs[] = {
 	{ "host=%s", offsetof(struct my_opts,host) },
 	{ "port=%s", offsetof(struct my_opts,port) },
 	{ "name=%s", offsetof(struct my_opts,name) },
+	{ "writers=%s", offsetof(struct my_opts,writers) },
+	{ "window=%s", offsetof(struct my_opts,window) },
+	{ "reclaim=%s", offsetof(struct my_opts,reclaim) },
+	{ "keep_cache", offsetof(struct my_opts,keep_cache), 1 },
+	{ "log=%s", offsetof(struct my_opts,log) },
+	{ "backend=%s", offsetof(struct my_opts,backend) },
+	{ "trace=%s", offsetof(struct my_opts,trace) },
+	{ "latency=%s", offsetof(struct my_opts,latency) },
 	{ NULL }
 };
 
+// Open files, by path.  Every open of a path shares one handle (kept in
+// fi->fh), so that all its descriptors see the same block map, and reads
+// and writes need no lookups at all.  Small writes are held in the
+// handle's write buffer until they fill a block (see writebuf.h).  A
+// partial block goes out on flush/fsync/release, before a read or getattr
+// of the file, or once it's older than CFS_WB_MAX_AGE.  CassFs isn't
+// thread-safe, so rather than a timer thread the age check piggybacks on
+// later callbacks.
+#define CFS_WB_MAX_AGE	0.5	// seconds
+
+struct cfs_handle {
+	string			path;
+	CfsFile *		file;
+	CfsWriteBuffer *	wbuf;
+	int			refs;
+	string *		stats;		// only for CFS_STATS_FILE
+};
+
+map<string,cfs_handle *>	handles;
+
+#define FI_HANDLE(fi)	((cfs_handle *)(uintptr_t)(fi)->fh)
+
+// A hidden directory for files that aren't in the store.  For now that's
+// just the stats file, which shows operation latencies and counters (see
+// stats.h) and resets them when written to.  Each open of it gets its own
+// snapshot, so a reader sees one consistent set of numbers.
+#define CFS_META_DIR	"/.cassfs"
+#define CFS_STATS_FILE	"/.cassfs/stats"
+
+// With keep_cache, the kernel may keep a file's pages from one open to the
+// next, but only if the file hasn't changed in between.  So we remember
+// each file's inode version as of its last close (when the kernel's pages
+// matched it, since our own writes go through them) and compare on open.
+// Forgetting a version only costs a re-read.
+#define CFS_MAX_CACHED_VERSIONS	65536
+
+map<string,unsigned long>	cached_versions;	// by inode key
+
+static int
+cfs_cache_valid (CfsFile * file)
+{
+	map<string,unsigned long>::iterator	it;
+	
+	if (!opts.keep_cache) {
+		return 0;
+	}
+	it = cached_versions.find(file->inode_key);
+	return (it != cached_versions.end())
+	    && (it->second == file->inode.version);
+}
+
+static void
+cfs_cache_note (CfsFile * file)
+{
+	if (!opts.keep_cache) {
+		return;
+	}
+	if (cached_versions.size() >= CFS_MAX_CACHED_VERSIONS) {
+		cached_versions.clear();
+	}
+	cached_versions[file->inode_key] = file->inode.version;
+}
+
+static cfs_handle *
+cfs_find_handle (const char * path)
+{
+	map<string,cfs_handle *>::iterator	it;
+	
+	it = handles.find(path);
+	return (it == handles.end()) ? NULL : it->second;
+}
+
+static int
+cfs_get_handle (const char * path, int create, struct fuse_file_info * fi)
+{
+	CassFs *	cfs;
+	CfsFile *	file;
+	cfs_handle *	h;
+	int		rc;
+	
+	h = cfs_find_handle(path);
+	if (!h) {
+		cfs = (CassFs *)fuse_get_context()->private_data;
+		rc = cfs->Open((char *)path,create,&file);
+		if (rc != 0) {
+			return rc;
+		}
+		h = new cfs_handle;
+		h->path = path;
+		h->file = file;
+		h->wbuf = new CfsWriteBuffer(cfs,file);
+		h->refs = 0;
+		h->stats = NULL;
+		handles[h->path] = h;
+		fi->keep_cache = cfs_cache_valid(file);
+		CfsStatCount(CFS_CTR_HANDLE_MISSES,1);
+		if (opts.keep_cache) {
+			CfsStatCount(fi->keep_cache ? CFS_CTR_PAGES_KEPT
+						    : CFS_CTR_PAGES_DROPPED,1);
+		}
+	}
+	else {
+		fi->keep_cache = opts.keep_cache;	// it's open already
+		CfsStatCount(CFS_CTR_HANDLE_HITS,1);
+	}
+	++h->refs;
+	fi->fh = (uintptr_t)h;
+	return 0;
+}
+
+static int
+cfs_put_handle (cfs_handle * h)
+{
+	CassFs *	cfs;
+	int		rc;
+	
+	rc = h->wbuf->Flush();
+	if (--h->refs == 0) {
+		cfs = (CassFs *)fuse_get_context()->private_data;
+		if (rc == 0) {
+			cfs_cache_note(h->file);
+		}
+		delete h->wbuf;
+		cfs->Close(h->file);
+		if (cfs_find_handle(h->path.c_str()) == h) {
+			handles.erase(h->path);
+		}
+		delete h;
+	}
+	return rc;
+}
+
+static int
+cfs_open_stats (struct fuse_file_info * fi)
+{
+	cfs_handle *	h	= new cfs_handle;
+	
+	h->file = NULL;
+	h->wbuf = NULL;
+	h->refs = 1;
+	h->stats = new string;
+	CfsStatsRender(*h->stats);
+	fi->fh = (uintptr_t)h;
+	fi->direct_io = 1;	// its size is whatever it turns out to be
+	return 0;
+}
+
+static void
+cfs_wb_age (void)
+{
+	map<string,cfs_handle *>::iterator	it;
+	
+	for (it = handles.begin(); it != handles.end(); ++it) {
+		it->second->wbuf->FlushIfOlder(CFS_WB_MAX_AGE);
+	}
+}
+
 static int cfs_getattr(const char *path, struct stat *stbuf)
 {
 	CassFs *	cfs;
 	int		rc;
 	CfsInode	tmp;
 	CfsInode *	my_inode	= &tmp;
+	cfs_handle *	h;
+	CfsTimer	timer(CFS_OP_GETATTR);
 	
-	printf("in %s(%s)\n",__func__,path);
+	CFS_DEBUG("in " << __func__ << "(" << path << ")");
 	
-	cfs = (CassFs *)fuse_get_context()->private_data;
-	rc = cfs->LookupAll((char *)path,&my_inode);
-	if (rc) {
-		return -rc;
+	if (!strcmp(path,CFS_META_DIR)) {
+		stbuf->st_mode = S_IFDIR | 0755;
+		return 0;
 	}
-	cout << path << " => type " << hex << my_inode->type << ", size "
-	     << dec << my_inode->size << endl;
+	if (!strcmp(path,CFS_STATS_FILE)) {
+		stbuf->st_mode = S_IFREG | 0644;
+		return 0;
+	}
+	
+	cfs_wb_age();
+	h = cfs_find_handle(path);
+	if (h) {
+		// Open files are already up to date here.
+		(void)h->wbuf->Flush();
+		my_inode = &h->file->inode;
+	}
+	else {
+		cfs = (CassFs *)fuse_get_context()->private_data;
+		rc = cfs->LookupAll((char *)path,&my_inode);
+		if (rc) {
+			return -rc;
+		}
+	}
+	CFS_DEBUG(path << " => type " << hex << my_inode->type << ", size "
+	          << dec << my_inode->size);
 	     
 	stbuf->st_mode = my_inode->type | 0644;
 	stbuf->st_size = my_inode->size;
@@ -107,51 +314,92 @@ static int cfs_getattr(const char *path, struct stat *stbuf)
 
 static int cfs_access(const char *path, int mask)
 {
-	printf("in %s\n",__func__);
+	CFS_DEBUG("in " << __func__);
 	return 0;
 }
 
 static int cfs_readlink(const char *path, char *buf, size_t size)
 {
-	printf("in %s(%s,%p,%u)\n",__func__,path,buf,size);
+	CFS_DEBUG("in " << __func__ << "(" << path << "," << (void *)buf << ","
+	          << size << ")");
 	return 0;
 }
 
-// TBD: Blech.  Pass this as an arg through CassFs::List and back.
-void *		rd_buf;
-fuse_fill_dir_t	rd_fnc;
+// An open directory holds a snapshot of its entries, taken at opendir (and
+// again on rewinddir), so each readdir carries on where the last stopped
+// instead of fetching and walking the whole directory again.  An entry's
+// offset cookie is its index in the snapshot plus one.
+struct cfs_dir_handle {
+	string	entries;	// packed CfsDirEntry array, as stored
+	bool	fresh;		// not read from yet
+};
+
+#define FI_DIR(fi)	((cfs_dir_handle *)(uintptr_t)(fi)->fh)
 
-void
-cfs_list_cb (char * name, int inum, int mode)
+static int cfs_opendir(const char *path, struct fuse_file_info *fi)
 {
-	struct stat	st;
+	CassFs *		cfs;
+	cfs_dir_handle *	dh;
+	int			rc;
+	CfsTimer		timer(CFS_OP_OPENDIR);
 	
-	if (rd_fnc) {
-		cout << "returning " << name << endl;
-		st.st_ino = inum;
-		st.st_mode = mode >> 12;
-		if (rd_fnc(rd_buf,name,&st,0)) {
-			rd_fnc = NULL;
-		}
-	}
-	else {
-		cout << "skipping " << name << endl;
+	CFS_DEBUG("in " << __func__ << "(" << path << ")");
+	
+	cfs = (CassFs *)fuse_get_context()->private_data;
+	dh = new cfs_dir_handle;
+	rc = cfs->ReadDir((char *)path,dh->entries);
+	if (rc != 0) {
+		delete dh;
+		return -rc;
 	}
-}		
+	dh->fresh = true;
+	fi->fh = (uintptr_t)dh;
+	return 0;
+}
 
 static int cfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		       off_t offset, struct fuse_file_info *fi)
 {
-	CassFs *	cfs;
+	CassFs *		cfs;
+	cfs_dir_handle *	dh	= FI_DIR(fi);
+	CfsDirEntry *		r_data;
+	struct stat		st;
+	size_t			i;
+	size_t			n;
+	int			rc;
+	CfsTimer		timer(CFS_OP_READDIR);
 
-	(void) offset;
-	(void) fi;
+	CFS_DEBUG("in " << __func__ << "(" << path << "," << (void *)buf << ","
+	          << (long)offset << ")");
+	cfs_wb_age();
+	if (!offset && !dh->fresh) {
+		cfs = (CassFs *)fuse_get_context()->private_data;
+		rc = cfs->ReadDir((char *)path,dh->entries);
+		if (rc != 0) {
+			return -rc;
+		}
+	}
+	dh->fresh = false;
+	
+	memset(&st,0,sizeof(st));
+	r_data = (CfsDirEntry *)dh->entries.data();
+	n = dh->entries.size() / sizeof(*r_data);
+	for (i = offset; i < n; ++i) {
+		st.st_ino = r_data[i].inum;
+		st.st_mode = r_data[i].mode;
+		if (filler(buf,r_data[i].name,&st,i+1)) {
+			break;
+		}
+	}
+	return 0;
+}
 
-	printf("in %s(%s,%p,%d)\n",__func__,path,buf,offset);
-	cfs = (CassFs *)fuse_get_context()->private_data;
-	rd_buf = buf;
-	rd_fnc = filler;
-	cfs->List((char *)path,cfs_list_cb);
+static int cfs_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	CfsTimer	timer(CFS_OP_RELEASEDIR);
+	
+	CFS_DEBUG("in " << __func__ << "(" << path << ")");
+	delete FI_DIR(fi);
 	return 0;
 }
 
@@ -159,92 +407,205 @@ static int cfs_mknod(const char *path, mode_t mode, dev_t rdev)
 {
 	CassFs *	cfs;
 	int		rc;
+	CfsFile *	file;
+	CfsTimer	timer(CFS_OP_MKNOD);
 	
-	printf("in %s(%s)\n",__func__,path);
+	CFS_DEBUG("in " << __func__ << "(" << path << ")");
 	
 	if (!S_ISREG(mode)) {
 		return -EOPNOTSUPP;
 	}
 	
 	cfs = (CassFs *)fuse_get_context()->private_data;
-	// TBD: fix the interface to CassFs::OpenFile, because this way is
-	// cheesy as hell.
-	rc = cfs->Write((char *)path,0,NULL,0);
-	cout << __func__ << " got " << rc << " back from Write(0) for "
-	     << path << endl;
-	return -rc;
+	rc = cfs->Open((char *)path,1,&file);
+	CFS_DEBUG(__func__ << " got " << rc << " back from Open for "
+	          << path);
+	if (rc != 0) {
+		return -rc;
+	}
+	cfs->Close(file);
+	return 0;
 }
 
 static int cfs_mkdir(const char *path, mode_t mode)
 {
 	CassFs *	cfs;
 	int		rc;
+	CfsTimer	timer(CFS_OP_MKDIR);
 	
-	printf("in %s\n",__func__);
+	CFS_DEBUG("in " << __func__);
 	
 	cfs = (CassFs *)fuse_get_context()->private_data;
 	rc = cfs->Mkdir((char *)path);
 	return rc ? -rc : 0;
 }
 
+// Open files are never unlinked here (FUSE renames them out of the way
+// until they're released), so there's no handle to worry about.
 static int cfs_unlink(const char *path)
 {
-	printf("in %s\n",__func__);
-	return 0;
+	CassFs *	cfs;
+	int		rc;
+	CfsTimer	timer(CFS_OP_UNLINK);
+	
+	CFS_DEBUG("in " << __func__);
+	
+	cfs = (CassFs *)fuse_get_context()->private_data;
+	rc = cfs->Unlink((char *)path);
+	return rc ? -rc : 0;
 }
 
 static int cfs_rmdir(const char *path)
 {
-	printf("in %s\n",__func__);
-	return 0;
+	CassFs *	cfs;
+	int		rc;
+	CfsTimer	timer(CFS_OP_RMDIR);
+	
+	CFS_DEBUG("in " << __func__);
+	
+	cfs = (CassFs *)fuse_get_context()->private_data;
+	rc = cfs->Rmdir((char *)path);
+	return rc ? -rc : 0;
 }
 
 static int cfs_symlink(const char *from, const char *to)
 {
-	printf("in %s\n",__func__);
+	CFS_DEBUG("in " << __func__);
 	return 0;
 }
 
+// Open files keep their inode across a rename, so only their handles'
+// paths need fixing, including those of files under a moved directory.
+// A handle for a replaced target is dropped from the table (it lives on
+// until released) so that it won't be found under its old name.
 static int cfs_rename(const char *from, const char *to)
 {
-	printf("in %s\n",__func__);
+	CassFs *				cfs;
+	int					rc;
+	map<string,cfs_handle *>::iterator	it;
+	vector<cfs_handle *>			moved;
+	string					under	= string(from) + "/";
+	cfs_handle *				h;
+	size_t					i;
+	CfsTimer				timer(CFS_OP_RENAME);
+	
+	CFS_DEBUG("in " << __func__);
+	
+	cfs = (CassFs *)fuse_get_context()->private_data;
+	rc = cfs->Rename((char *)from,(char *)to);
+	if (rc) {
+		return -rc;
+	}
+	
+	handles.erase(to);
+	for (it = handles.begin(); it != handles.end(); ++it) {
+		if ((it->first == from)
+		    || !it->first.compare(0,under.size(),under)) {
+			moved.push_back(it->second);
+		}
+	}
+	for (i = 0; i < moved.size(); ++i) {
+		h = moved[i];
+		handles.erase(h->path);
+		h->path = to + h->path.substr(strlen(from));
+		handles[h->path] = h;
+	}
 	return 0;
 }
 
 static int cfs_link(const char *from, const char *to)
 {
-	printf("in %s\n",__func__);
+	CFS_DEBUG("in " << __func__);
 	return 0;
 }
 
 static int cfs_chmod(const char *path, mode_t mode)
 {
-	printf("in %s\n",__func__);
+	CFS_DEBUG("in " << __func__);
 	return 0;
 }
 
 static int cfs_chown(const char *path, uid_t uid, gid_t gid)
 {
-	printf("in %s\n",__func__);
+	CFS_DEBUG("in " << __func__);
 	return 0;
 }
 
 static int cfs_truncate(const char *path, off_t size)
 {
-	printf("in %s\n",__func__);
-	return 0;
+	CassFs *	cfs;
+	cfs_handle *	h;
+	int		rc;
+	CfsTimer	timer(CFS_OP_TRUNCATE);
+	
+	CFS_DEBUG("in " << __func__ << "(" << path << "," << (long)size << ")");
+	
+	if (!strcmp(path,CFS_STATS_FILE)) {
+		return 0;	// e.g. "echo > stats"; the write resets
+	}
+	cfs = (CassFs *)fuse_get_context()->private_data;
+	h = cfs_find_handle(path);
+	if (!h) {
+		return -cfs->Truncate((char *)path,(cfs_size_t)size);
+	}
+	// Keep the open handle's copy of the inode current.
+	rc = h->wbuf->Flush();
+	if (rc == 0) {
+		rc = cfs->TruncateFile(h->file,(cfs_size_t)size);
+	}
+	return -rc;
+}
+
+static int cfs_ftruncate(const char *path, off_t size,
+			 struct fuse_file_info *fi)
+{
+	CassFs *	cfs;
+	cfs_handle *	h	= FI_HANDLE(fi);
+	int		rc;
+	CfsTimer	timer(CFS_OP_TRUNCATE);
+	
+	CFS_DEBUG("in " << __func__ << "(" << path << "," << (long)size << ")");
+	
+	if (h->stats) {
+		return 0;
+	}
+	cfs = (CassFs *)fuse_get_context()->private_data;
+	rc = h->wbuf->Flush();
+	if (rc == 0) {
+		rc = cfs->TruncateFile(h->file,(cfs_size_t)size);
+	}
+	return -rc;
 }
 
 static int cfs_utimens(const char *path, const struct timespec ts[2])
 {
-	printf("in %s\n",__func__);
+	CFS_DEBUG("in " << __func__);
 	return 0;
 }
 
 static int cfs_open(const char *path, struct fuse_file_info *fi)
 {
-	printf("in %s\n",__func__);
-	return 0;
+	CfsTimer	timer(CFS_OP_OPEN);
+	
+	CFS_DEBUG("in " << __func__);
+	
+	if (!strcmp(path,CFS_STATS_FILE)) {
+		return cfs_open_stats(fi);
+	}
+	return -cfs_get_handle(path,0,fi);
+}
+
+static int cfs_create(const char *path, mode_t mode,
+		      struct fuse_file_info *fi)
+{
+	CfsTimer	timer(CFS_OP_CREATE);
+	
+	CFS_DEBUG("in " << __func__ << "(" << path << ")");
+	
+	if (!S_ISREG(mode)) {
+		return -EOPNOTSUPP;
+	}
+	return -cfs_get_handle(path,1,fi);
 }
 
 static int cfs_read(const char *path, char *buf, size_t size, off_t offset,
@@ -253,51 +614,141 @@ static int cfs_read(const char *path, char *buf, size_t size, off_t offset,
 	CassFs *	cfs;
 	int		rc;
 	cfs_size_t	len;
+	cfs_handle *	h	= FI_HANDLE(fi);
+	CfsTimer	timer(CFS_OP_READ);
+	
+	CFS_DEBUG("in " << __func__ << "(" << path << "," << offset << ","
+	          << size << ")");
 	
-	printf("in %s(%s,%d,%u)\n",__func__,path,offset,size);
+	if (h->stats) {
+		if ((size_t)offset >= h->stats->size()) {
+			return 0;
+		}
+		len = h->stats->copy(buf,size,offset);
+		return len;
+	}
 	
+	cfs_wb_age();
+	rc = h->wbuf->Flush();
+	if (rc != 0) {
+		return -rc;
+	}
 	cfs = (CassFs *)fuse_get_context()->private_data;
 	len = size;
-	rc = cfs->Read((char *)path,(cfs_offset_t)offset,buf,len);
-	return rc ? -rc : len;
+	rc = cfs->ReadFile(h->file,(cfs_offset_t)offset,buf,len);
+	if (rc != 0) {
+		return -rc;
+	}
+	CfsStatCount(CFS_CTR_READ_BYTES,len);
+	return len;
 }
 
 static int cfs_write(const char *path, const char *buf, size_t size,
 		     off_t offset, struct fuse_file_info *fi)
 {
-	CassFs *	cfs;
 	int		rc;
+	cfs_handle *	h	= FI_HANDLE(fi);
+	CfsTimer	timer(CFS_OP_WRITE);
 	
-	printf("in %s\n",__func__);
+	CFS_DEBUG("in " << __func__);
 	
-	cfs = (CassFs *)fuse_get_context()->private_data;
-	rc = cfs->Write((char *)path,(cfs_offset_t)offset,(char *)buf,size);
-	cout << __func__ << "got " << rc << " back from Write" << endl;
-	return rc ? -rc : size;
+	if (h->stats) {
+		CfsStatsReset();
+		return size;
+	}
+	
+	cfs_wb_age();
+	rc = h->wbuf->Write((cfs_offset_t)offset,buf,size);
+	CFS_DEBUG(__func__ << "got " << rc << " back from Write");
+	if (rc != 0) {
+		return -rc;
+	}
+	CfsStatCount(CFS_CTR_WRITE_BYTES,size);
+	return size;
 }
 
-static int cfs_statfs(const char *path, struct statvfs *stbuf)
+static int cfs_flush(const char *path, struct fuse_file_info *fi)
 {
-	int res;
+	cfs_handle *	h	= FI_HANDLE(fi);
+	CfsTimer	timer(CFS_OP_FLUSH);
+	
+	CFS_DEBUG("in " << __func__);
+	return h->stats ? 0 : -h->wbuf->Flush();
+}
 
-	printf("in %s\n",__func__);
-	res = statvfs(path, stbuf);
-	if (res == -1)
-		return -errno;
+static int cfs_release(const char *path, struct fuse_file_info *fi)
+{
+	cfs_handle *	h	= FI_HANDLE(fi);
+	CfsTimer	timer(CFS_OP_RELEASE);
+	
+	CFS_DEBUG("in " << __func__);
+	if (h->stats) {
+		delete h->stats;
+		delete h;
+		return 0;
+	}
+	return -cfs_put_handle(h);
+}
 
-	return 0;
+static int cfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	cfs_handle *	h	= FI_HANDLE(fi);
+	CfsTimer	timer(CFS_OP_FSYNC);
+	
+	CFS_DEBUG("in " << __func__);
+	return h->stats ? 0 : -h->wbuf->Flush();
+}
+
+static int cfs_statfs(const char *path, struct statvfs *stbuf)
+{
+	CassFs *	cfs;
+	CfsTimer	timer(CFS_OP_STATFS);
+
+	CFS_DEBUG("in " << __func__);
+	cfs = (CassFs *)fuse_get_context()->private_data;
+	return -cfs->Statfs(stbuf);
 }
 
 void *
 cfs_init (struct fuse_conn_info * not_used)
 {
 	CassFs *	cfs;
+	CfsConnector *	connector	= NULL;
+	bool		mem;
+	int		writers;
+	int		window;
+	int		reclaim;
 	
 	(void)not_used;
 	
-	printf("in %s\n",__func__);
-	cfs = new CassFs();
+	(void)CfsLogStart();	// fuse_main has daemonized by now
+	CFS_DEBUG("in " << __func__);
+	mem = opts.backend && !strcmp(opts.backend,"mem");
+	if (mem) {
+		// A fresh filesystem that lasts until unmount, for testing.
+		connector = new CfsMemConnector();
+	}
+	else if (opts.latency) {
+		connector = new CfsThriftConnector(THRIFT_HOST,THRIFT_PORT);
+	}
+	if (opts.latency) {
+		connector = new CfsLatencyConnector(connector,true,
+						    latency_spec);
+	}
+	cfs = connector ? new CassFs(connector) : new CassFs();
+	if (mem) {
+		(void)cfs->Mkfs(opts.name);
+	}
 	cfs->MountFs(opts.name);
+	if (opts.writers) {
+		writers = atoi(opts.writers);
+		window = opts.window ? atoi(opts.window) : (4 * writers);
+		(void)cfs->StartPipeline(writers,window);
+	}
+	reclaim = opts.reclaim ? atoi(opts.reclaim) : CFS_DEFAULT_RECLAIM;
+	if (reclaim > 0) {
+		(void)cfs->StartReclaimer(reclaim);
+	}
 	return cfs;
 }
 
@@ -323,29 +774,223 @@ static struct fuse_operations cfs_oper = {
 	cfs_read,
 	cfs_write,
 	cfs_statfs,
-	NULL, /* flush */
-	NULL, /* release */
-	NULL, /* fsync */
+	cfs_flush,
+	cfs_release,
+	cfs_fsync,
 #ifdef HAVE_SETXATTR
 	NULL,
 	NULL,
 	NULL,
 	NULL,
 #endif
-	NULL, /* opendir */
+	cfs_opendir,
 	cfs_readdir,
-	NULL, /* releasedir */
+	cfs_releasedir,
 	NULL, /* fsyncdir */
 	cfs_init,
 	NULL, /* destroy */
 	cfs_access,
-	NULL, /* create */
-	NULL, /* ftruncate */
+	cfs_create,
+	cfs_ftruncate,
 	NULL, /* fgetattr */
 	NULL, /* lock */
 	cfs_utimens,
 };
 
+// With -o trace, these stand in for the callbacks that do anything, and
+// record each call on its way out.  Paths are enough to replay a trace:
+// every open of a path shares one handle anyway.
+static int
+cfs_traced (int op, const char * path, const char * path2, uint64_t offset,
+	    uint64_t size, uint64_t start, int rc)
+{
+	CfsTraceAdd(op,path,path2,offset,size,rc,start,CfsNowNs());
+	return rc;
+}
+
+static int cfs_tr_getattr(const char *path, struct stat *stbuf)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_getattr(path,stbuf);
+	
+	return cfs_traced(CFS_OP_GETATTR,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_mknod(const char *path, mode_t mode, dev_t rdev)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_mknod(path,mode,rdev);
+	
+	return cfs_traced(CFS_OP_MKNOD,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_mkdir(const char *path, mode_t mode)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_mkdir(path,mode);
+	
+	return cfs_traced(CFS_OP_MKDIR,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_unlink(const char *path)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_unlink(path);
+	
+	return cfs_traced(CFS_OP_UNLINK,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_rmdir(const char *path)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_rmdir(path);
+	
+	return cfs_traced(CFS_OP_RMDIR,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_rename(const char *from, const char *to)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_rename(from,to);
+	
+	return cfs_traced(CFS_OP_RENAME,from,to,0,0,start,rc);
+}
+
+static int cfs_tr_truncate(const char *path, off_t size)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_truncate(path,size);
+	
+	return cfs_traced(CFS_OP_TRUNCATE,path,NULL,0,size,start,rc);
+}
+
+static int cfs_tr_ftruncate(const char *path, off_t size,
+			    struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_ftruncate(path,size,fi);
+	
+	return cfs_traced(CFS_OP_TRUNCATE,path,NULL,0,size,start,rc);
+}
+
+static int cfs_tr_open(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_open(path,fi);
+	
+	return cfs_traced(CFS_OP_OPEN,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_create(const char *path, mode_t mode,
+			 struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_create(path,mode,fi);
+	
+	return cfs_traced(CFS_OP_CREATE,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_read(const char *path, char *buf, size_t size,
+		       off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_read(path,buf,size,offset,fi);
+	
+	return cfs_traced(CFS_OP_READ,path,NULL,offset,size,start,rc);
+}
+
+static int cfs_tr_write(const char *path, const char *buf, size_t size,
+			off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_write(path,buf,size,offset,fi);
+	
+	return cfs_traced(CFS_OP_WRITE,path,NULL,offset,size,start,rc);
+}
+
+static int cfs_tr_statfs(const char *path, struct statvfs *stbuf)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_statfs(path,stbuf);
+	
+	return cfs_traced(CFS_OP_STATFS,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_flush(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_flush(path,fi);
+	
+	return cfs_traced(CFS_OP_FLUSH,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_release(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_release(path,fi);
+	
+	return cfs_traced(CFS_OP_RELEASE,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_fsync(const char *path, int datasync,
+			struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_fsync(path,datasync,fi);
+	
+	return cfs_traced(CFS_OP_FSYNC,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_opendir(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_opendir(path,fi);
+	
+	return cfs_traced(CFS_OP_OPENDIR,path,NULL,0,0,start,rc);
+}
+
+static int cfs_tr_readdir(const char *path, void *buf,
+			  fuse_fill_dir_t filler, off_t offset,
+			  struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_readdir(path,buf,filler,offset,fi);
+	
+	return cfs_traced(CFS_OP_READDIR,path,NULL,offset,0,start,rc);
+}
+
+static int cfs_tr_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t	start	= CfsNowNs();
+	int		rc	= cfs_releasedir(path,fi);
+	
+	return cfs_traced(CFS_OP_RELEASEDIR,path,NULL,0,0,start,rc);
+}
+
+static void
+cfs_trace_oper (struct fuse_operations * oper)
+{
+	oper->getattr = cfs_tr_getattr;
+	oper->mknod = cfs_tr_mknod;
+	oper->mkdir = cfs_tr_mkdir;
+	oper->unlink = cfs_tr_unlink;
+	oper->rmdir = cfs_tr_rmdir;
+	oper->rename = cfs_tr_rename;
+	oper->truncate = cfs_tr_truncate;
+	oper->ftruncate = cfs_tr_ftruncate;
+	oper->open = cfs_tr_open;
+	oper->create = cfs_tr_create;
+	oper->read = cfs_tr_read;
+	oper->write = cfs_tr_write;
+	oper->statfs = cfs_tr_statfs;
+	oper->flush = cfs_tr_flush;
+	oper->release = cfs_tr_release;
+	oper->fsync = cfs_tr_fsync;
+	oper->opendir = cfs_tr_opendir;
+	oper->readdir = cfs_tr_readdir;
+	oper->releasedir = cfs_tr_releasedir;
+}
+
 
 int
 myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs)
@@ -359,7 +1004,32 @@ int main(int argc, char *argv[])
 
 	umask(0);
 	fuse_opt_parse(&args, &opts, my_opt_descs, myfs_opt_proc);
-	printf("using %s:%s\n",opts.host,opts.port);
+	if (opts.log) {
+		cfs_log_level = CfsLogLevelByName(opts.log);
+		if (cfs_log_level < 0) {
+			fprintf(stderr,"%s: bad log level %s\n",argv[0],opts.log);
+			return 1;
+		}
+	}
+	if (opts.backend && strcmp(opts.backend,"mem")
+	    && strcmp(opts.backend,"cassandra")) {
+		fprintf(stderr,"%s: bad backend %s\n",argv[0],opts.backend);
+		return 1;
+	}
+	if (opts.latency && CfsParseLatency(opts.latency,&latency_spec)) {
+		fprintf(stderr,"%s: bad latency %s\n",argv[0],opts.latency);
+		return 1;
+	}
+	if (opts.trace) {
+		// Opened here, while relative paths still mean something.
+		errno = CfsTraceStart(opts.trace);
+		if (errno) {
+			perror(opts.trace);
+			return 1;
+		}
+		cfs_trace_oper(&cfs_oper);
+	}
+	CFS_INFO("using " << opts.host << ":" << opts.port);
 	return fuse_main(args.argc, args.argv, &cfs_oper, NULL);
 }
 
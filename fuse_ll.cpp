@@ -0,0 +1,956 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A FUSE frontend on the low-level API, which deals in inode numbers rather
+// than paths.  Our inode numbers are the inum kept in every directory entry
+// (the root's is 1, just as FUSE wants), and the kernel caches names and
+// attributes itself, so an operation on a file it has already looked up
+// needs no path resolution at all, just a step into the node table below.
+// Like the high-level frontend, this runs single-threaded.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TTransportUtils.h>
+#include "Cassandra.h"
+#include "base64.h"
+#include "bufpool.h"
+#include "cfs_types.h"
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace org::apache::cassandra;
+
+#include "connect.h"
+#include "cassfs.h"
+#include "log.h"
+#include "writebuf.h"
+
+#define FUSE_USE_VERSION 26
+#include <fuse_lowlevel.h>
+
+// How long the kernel may trust names and attributes we give it, unless
+// the attr_timeout and entry_timeout options say otherwise.  Unless there's
+// a negative_timeout, it doesn't cache failed lookups at all.
+#define CFS_LL_TIMEOUT		1.0	// seconds
+// As in fuse.cpp.
+#define CFS_WB_MAX_AGE		0.5	// seconds
+#define CFS_DEFAULT_RECLAIM	500
+
+struct my_opts {
+	char *	name;
+	char *	writers;	// write pipeline threads, if any
+	char *	window;		// blocks in flight (default 4 per thread)
+	char *	reclaim;	// removals/sec for freeing space (0 = off)
+	char *	attr_timeout;
+	char *	entry_timeout;
+	char *	negative_timeout;
+	int	keep_cache;	// let the kernel keep unchanged files' pages
+	char *	log;		// error, warn, info or debug
+	char *	backend;	// cassandra (default) or mem
+	char *	latency;	// simulated, see CfsLatencyConnector
+};
+
+struct my_opts opts;
+
+static double	attr_timeout;
+static double	entry_timeout;
+static double	negative_timeout;
+
+static CfsLatencySpec	latency_spec;
+
+struct fuse_opt my_opt_descs[] = {
+	{ "name=%s", offsetof(struct my_opts,name) },
+	{ "writers=%s", offsetof(struct my_opts,writers) },
+	{ "window=%s", offsetof(struct my_opts,window) },
+	{ "reclaim=%s", offsetof(struct my_opts,reclaim) },
+	{ "attr_timeout=%s", offsetof(struct my_opts,attr_timeout) },
+	{ "entry_timeout=%s", offsetof(struct my_opts,entry_timeout) },
+	{ "negative_timeout=%s", offsetof(struct my_opts,negative_timeout) },
+	{ "keep_cache", offsetof(struct my_opts,keep_cache), 1 },
+	{ "log=%s", offsetof(struct my_opts,log) },
+	{ "backend=%s", offsetof(struct my_opts,backend) },
+	{ "latency=%s", offsetof(struct my_opts,latency) },
+	FUSE_OPT_END
+};
+
+// Every inode the kernel knows about, from the lookup (or mkdir/create)
+// that told it until it forgets the last of them.  While a file is open,
+// all its opens share one CfsFile and write buffer, as in fuse.cpp.
+//
+// version is the inode version that the kernel's cached pages (and
+// attributes) reflect.  Our own writes go through the page cache, so they
+// keep it current; if the version in the store moves on otherwise, someone
+// else changed the file, and we invalidate the kernel's copy.  With
+// keep_cache, pages survive from one open to the next unless that's
+// happened.
+struct cfs_node {
+	fuse_ino_t		ino;
+	char			inode_key[CFS_MAX_KEY_LEN];
+	char			data_key[CFS_MAX_KEY_LEN];	// dirs only
+	bool			is_dir;
+	unsigned long		nlookup;
+	CfsFile *		file;
+	CfsWriteBuffer *	wbuf;
+	int			opens;
+	unsigned long		version;
+};
+
+static CassFs *				cfs;
+static CfsConnector *			connector;	// if not the default
+static struct fuse_chan *		chan;
+static map<fuse_ino_t,cfs_node *>	nodes;
+
+static cfs_node *
+cfs_ll_find (fuse_ino_t ino)
+{
+	map<fuse_ino_t,cfs_node *>::iterator	it;
+	
+	it = nodes.find(ino);
+	return (it == nodes.end()) ? NULL : it->second;
+}
+
+// Counts one more lookup of ino, adding it to the table if it's new.
+static cfs_node *
+cfs_ll_remember (fuse_ino_t ino, const char * inode_key, CfsInode * inodep)
+{
+	cfs_node *	n	= cfs_ll_find(ino);
+	
+	if (!n) {
+		n = new cfs_node;
+		n->ino = ino;
+		CopyKey(n->inode_key,inode_key);
+		n->is_dir = S_ISDIR(inodep->type);
+		if (n->is_dir) {
+			cfs->DirDataKey(inodep,n->data_key);
+		}
+		n->nlookup = 0;
+		n->file = NULL;
+		n->wbuf = NULL;
+		n->opens = 0;
+		n->version = inodep->version;
+		nodes[ino] = n;
+	}
+	++n->nlookup;
+	return n;
+}
+
+// Drops n once nothing refers to it any more.
+static void
+cfs_ll_drop (cfs_node * n)
+{
+	if (n->nlookup || n->opens || (n->ino == FUSE_ROOT_ID)) {
+		return;
+	}
+	nodes.erase(n->ino);
+	delete n;
+}
+
+static void
+cfs_ll_age (void)
+{
+	map<fuse_ino_t,cfs_node *>::iterator	it;
+	
+	for (it = nodes.begin(); it != nodes.end(); ++it) {
+		if (it->second->wbuf) {
+			it->second->wbuf->FlushIfOlder(CFS_WB_MAX_AGE);
+		}
+	}
+}
+
+// Invalidations are sent from a thread of their own: the kernel may need
+// a reply from us (e.g. to a read of the same file) before it can drop the
+// pages, so sending one from inside a request handler could deadlock.
+static pthread_mutex_t		inval_lock	= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		inval_cv	= PTHREAD_COND_INITIALIZER;
+static vector<fuse_ino_t>	inval_queue;
+
+static void *
+cfs_ll_inval_thread (void * arg)
+{
+	vector<fuse_ino_t>	todo;
+	size_t			i;
+	
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&inval_lock);
+		while (inval_queue.empty()) {
+			pthread_cond_wait(&inval_cv,&inval_lock);
+		}
+		todo.swap(inval_queue);
+		pthread_mutex_unlock(&inval_lock);
+		for (i = 0; i < todo.size(); ++i) {
+			(void)fuse_lowlevel_notify_inval_inode(chan,todo[i],0,0);
+		}
+		todo.clear();
+	}
+	return NULL;
+}
+
+static void
+cfs_ll_check_version (cfs_node * n, CfsInode * inodep)
+{
+	if (inodep->version == n->version) {
+		return;
+	}
+	CFS_DEBUG("inode " << n->ino << " changed elsewhere");
+	n->version = inodep->version;
+	if (chan && !n->is_dir) {
+		pthread_mutex_lock(&inval_lock);
+		inval_queue.push_back(n->ino);
+		pthread_cond_signal(&inval_cv);
+		pthread_mutex_unlock(&inval_lock);
+	}
+}
+
+// Gets n's inode: from the open file if there is one (after flushing, so
+// the size is current), otherwise from the store into *tmp.
+static int
+cfs_ll_inode (cfs_node * n, CfsInode * tmp, CfsInode ** inodepp)
+{
+	int	rc;
+	
+	if (n->file) {
+		rc = n->wbuf->Flush();
+		*inodepp = &n->file->inode;
+		return rc;
+	}
+	*inodepp = tmp;
+	rc = cfs->GetInode(n->inode_key,tmp);
+	if (rc == 0) {
+		cfs_ll_check_version(n,tmp);
+	}
+	return rc;
+}
+
+static void
+cfs_ll_stat (fuse_ino_t ino, CfsInode * inodep, struct stat * st)
+{
+	memset(st,0,sizeof(*st));
+	st->st_ino = ino;
+	if (S_ISDIR(inodep->type)) {
+		st->st_mode = inodep->type | 0755;
+		st->st_nlink = 2;
+	}
+	else {
+		st->st_mode = inodep->type | 0644;
+		st->st_nlink = 1;
+	}
+	st->st_size = inodep->size;
+	st->st_blksize = cfs->BlockSize();
+	st->st_blocks = (inodep->size + 511) / 512;
+}
+
+// Fills in e for a reply to lookup, mkdir or create, which the kernel
+// counts as a lookup.  inodep is ent's inode if the caller has it already.
+static int
+cfs_ll_entry (CfsDirEntry * ent, CfsInode * inodep,
+	      struct fuse_entry_param * e)
+{
+	cfs_node *	n	= cfs_ll_find(ent->inum);
+	CfsInode	tmp;
+	int		rc;
+	
+	if (n) {
+		rc = cfs_ll_inode(n,&tmp,&inodep);
+	}
+	else if (!inodep) {
+		inodep = &tmp;
+		rc = cfs->GetInode(ent->inode_key,inodep);
+	}
+	else {
+		rc = 0;
+	}
+	if (rc != 0) {
+		return rc;
+	}
+	
+	(void)cfs_ll_remember(ent->inum,ent->inode_key,inodep);
+	memset(e,0,sizeof(*e));
+	e->ino = ent->inum;
+	e->attr_timeout = attr_timeout;
+	e->entry_timeout = entry_timeout;
+	cfs_ll_stat(ent->inum,inodep,&e->attr);
+	return 0;
+}
+
+// Adds an open to n, opening it for real unless it already is.  A file
+// the caller has just opened itself (fresh) is used for that if it can be,
+// and closed otherwise.
+static int
+cfs_ll_open_node (cfs_node * n, CfsFile * fresh, struct fuse_file_info * fi)
+{
+	int	rc;
+	
+	if (n->is_dir) {
+		return EISDIR;
+	}
+	if (!n->file) {
+		if (!fresh) {
+			rc = cfs->OpenInode(n->inode_key,&fresh);
+			if (rc != 0) {
+				return rc;
+			}
+		}
+		n->file = fresh;
+		n->wbuf = new CfsWriteBuffer(cfs,fresh);
+		// Not keeping the cache drops it, so no need to invalidate.
+		fi->keep_cache = opts.keep_cache
+			      && (fresh->inode.version == n->version);
+		n->version = fresh->inode.version;
+	}
+	else {
+		if (fresh) {
+			cfs->Close(fresh);
+		}
+		fi->keep_cache = opts.keep_cache;
+	}
+	++n->opens;
+	fi->fh = (uintptr_t)n;
+	return 0;
+}
+
+#define FI_NODE(fi)	((cfs_node *)(uintptr_t)(fi)->fh)
+
+static void
+cfs_ll_init (void * userdata, struct fuse_conn_info * conn)
+{
+	CfsInode	root;
+	char		root_key[CFS_MAX_KEY_LEN];
+	int		writers;
+	int		window;
+	int		reclaim;
+	bool		mem;
+	
+	(void)userdata;
+	(void)conn;
+	
+	(void)CfsLogStart();	// we're past any daemonizing by now
+	CFS_DEBUG("in " << __func__);
+	mem = opts.backend && !strcmp(opts.backend,"mem");
+	if (mem) {
+		// A fresh filesystem that lasts until unmount, as in fuse.cpp.
+		connector = new CfsMemConnector();
+	}
+	else if (opts.latency) {
+		connector = new CfsThriftConnector(THRIFT_HOST,THRIFT_PORT);
+	}
+	if (opts.latency) {
+		connector = new CfsLatencyConnector(connector,true,
+						    latency_spec);
+	}
+	cfs = connector ? new CassFs(connector) : new CassFs();
+	if (mem) {
+		(void)cfs->Mkfs(opts.name);
+	}
+	if (cfs->MountFs(opts.name) != 0) {
+		CFS_ERROR("could not mount " << opts.name);
+		return;
+	}
+	if (opts.writers) {
+		writers = atoi(opts.writers);
+		window = opts.window ? atoi(opts.window) : (4 * writers);
+		(void)cfs->StartPipeline(writers,window);
+	}
+	reclaim = opts.reclaim ? atoi(opts.reclaim) : CFS_DEFAULT_RECLAIM;
+	if (reclaim > 0) {
+		(void)cfs->StartReclaimer(reclaim);
+	}
+	
+	cfs->InodeKey(FUSE_ROOT_ID,root_key);
+	if (cfs->GetInode(root_key,&root) == 0) {
+		(void)cfs_ll_remember(FUSE_ROOT_ID,root_key,&root);
+	}
+}
+
+static void
+cfs_ll_destroy (void * userdata)
+{
+	(void)userdata;
+	
+	CFS_DEBUG("in " << __func__);
+	delete cfs;
+	delete connector;
+}
+
+static void
+cfs_ll_lookup (fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+	cfs_node *		pn	= cfs_ll_find(parent);
+	CfsDirEntry		ent;
+	struct fuse_entry_param	e;
+	int			rc;
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)parent << ","
+	          << name << ")");
+	
+	cfs_ll_age();
+	if (!pn || !pn->is_dir) {
+		fuse_reply_err(req,ENOTDIR);
+		return;
+	}
+	rc = cfs->LookupIn(pn->data_key,(char *)name,&ent);
+	if (rc == 0) {
+		rc = cfs_ll_entry(&ent,NULL,&e);
+	}
+	if ((rc == ENOENT) && (negative_timeout > 0)) {
+		// A zero inode number caches the miss.
+		memset(&e,0,sizeof(e));
+		e.entry_timeout = negative_timeout;
+		fuse_reply_entry(req,&e);
+		return;
+	}
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	fuse_reply_entry(req,&e);
+}
+
+static void
+cfs_ll_forget (fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	cfs_node *	n	= cfs_ll_find(ino);
+	
+	if (n) {
+		n->nlookup -= (nlookup < n->nlookup) ? nlookup : n->nlookup;
+		cfs_ll_drop(n);
+	}
+	fuse_reply_none(req);
+}
+
+static void
+cfs_ll_getattr (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+	cfs_node *	n	= cfs_ll_find(ino);
+	CfsInode	tmp;
+	CfsInode *	inodep;
+	struct stat	st;
+	int		rc;
+	
+	(void)fi;
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << ")");
+	
+	cfs_ll_age();
+	if (!n) {
+		fuse_reply_err(req,ENOENT);
+		return;
+	}
+	rc = cfs_ll_inode(n,&tmp,&inodep);
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	cfs_ll_stat(ino,inodep,&st);
+	fuse_reply_attr(req,&st,attr_timeout);
+}
+
+// Only the size can be set; the rest we don't store yet, so it's ignored
+// (as with chmod etc. in fuse.cpp).
+static void
+cfs_ll_setattr (fuse_req_t req, fuse_ino_t ino, struct stat * attr,
+		int to_set, struct fuse_file_info * fi)
+{
+	cfs_node *	n	= cfs_ll_find(ino);
+	CfsFile *	file;
+	CfsInode	tmp;
+	CfsInode *	inodep;
+	struct stat	st;
+	int		rc	= 0;
+	
+	(void)fi;
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << "," << hex
+	          << to_set << ")");
+	
+	if (!n) {
+		fuse_reply_err(req,ENOENT);
+		return;
+	}
+	if (to_set & FUSE_SET_ATTR_SIZE) {
+		if (n->is_dir) {
+			rc = EISDIR;
+		}
+		else if (n->file) {
+			// Keep the open file's copy of the inode current.
+			rc = n->wbuf->Flush();
+			if (rc == 0) {
+				rc = cfs->TruncateFile(n->file,attr->st_size);
+			}
+		}
+		else {
+			rc = cfs->OpenInode(n->inode_key,&file);
+			if (rc == 0) {
+				cfs_ll_check_version(n,&file->inode);
+				rc = cfs->TruncateFile(file,attr->st_size);
+				// The kernel truncates its own copy.
+				n->version = file->inode.version;
+				cfs->Close(file);
+			}
+		}
+	}
+	if (rc == 0) {
+		rc = cfs_ll_inode(n,&tmp,&inodep);
+	}
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	cfs_ll_stat(ino,inodep,&st);
+	fuse_reply_attr(req,&st,attr_timeout);
+}
+
+// As in fuse.cpp, an open directory holds a snapshot of its entries, and
+// an entry's offset cookie is its index in the snapshot plus one, so each
+// readdir only encodes the entries it's actually returning.
+struct cfs_dir_handle {
+	string	entries;	// packed CfsDirEntry array, as stored
+	bool	fresh;		// not read from yet
+};
+
+#define FI_DIR(fi)	((cfs_dir_handle *)(uintptr_t)(fi)->fh)
+
+static void
+cfs_ll_opendir (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+	cfs_node *		n	= cfs_ll_find(ino);
+	cfs_dir_handle *	dh;
+	int			rc;
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << ")");
+	
+	if (!n || !n->is_dir) {
+		fuse_reply_err(req,ENOTDIR);
+		return;
+	}
+	dh = new cfs_dir_handle;
+	rc = cfs->GetDirData(n->data_key,dh->entries);
+	if (rc != 0) {
+		delete dh;
+		fuse_reply_err(req,rc);
+		return;
+	}
+	dh->fresh = true;
+	fi->fh = (uintptr_t)dh;
+	fuse_reply_open(req,fi);
+}
+
+static void
+cfs_ll_readdir (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		struct fuse_file_info * fi)
+{
+	cfs_node *		n	= cfs_ll_find(ino);
+	cfs_dir_handle *	dh	= FI_DIR(fi);
+	string			buf;
+	CfsDirEntry *		r_data;
+	struct stat		st;
+	size_t			i;
+	size_t			len;
+	int			rc;
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << ","
+	          << (unsigned long)size << "," << (long)off << ")");
+	
+	// Starting over (rewinddir) should see any changes since opendir.
+	if (!off && !dh->fresh && n) {
+		rc = cfs->GetDirData(n->data_key,dh->entries);
+		if (rc != 0) {
+			fuse_reply_err(req,rc);
+			return;
+		}
+	}
+	dh->fresh = false;
+	
+	memset(&st,0,sizeof(st));
+	r_data = (CfsDirEntry *)dh->entries.data();
+	for (i = off; i < (dh->entries.size() / sizeof(*r_data)); ++i) {
+		st.st_ino = r_data[i].inum;
+		st.st_mode = r_data[i].mode;
+		len = fuse_add_direntry(req,NULL,0,r_data[i].name,NULL,0);
+		if ((buf.size() + len) > size) {
+			break;
+		}
+		buf.resize(buf.size()+len);
+		fuse_add_direntry(req,&buf[buf.size()-len],len,r_data[i].name,
+				  &st,i+1);
+	}
+	fuse_reply_buf(req,buf.data(),buf.size());
+}
+
+static void
+cfs_ll_releasedir (fuse_req_t req, fuse_ino_t ino,
+		   struct fuse_file_info * fi)
+{
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << ")");
+	delete FI_DIR(fi);
+	fuse_reply_err(req,0);
+}
+
+static void
+cfs_ll_mkdir (fuse_req_t req, fuse_ino_t parent, const char * name,
+	      mode_t mode)
+{
+	cfs_node *		pn	= cfs_ll_find(parent);
+	CfsDirEntry		ent;
+	struct fuse_entry_param	e;
+	int			rc;
+	
+	(void)mode;
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)parent << ","
+	          << name << ")");
+	
+	if (!pn || !pn->is_dir) {
+		fuse_reply_err(req,ENOTDIR);
+		return;
+	}
+	rc = cfs->MkdirIn(pn->data_key,(char *)name,&ent);
+	if (rc == 0) {
+		rc = cfs_ll_entry(&ent,NULL,&e);
+	}
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	fuse_reply_entry(req,&e);
+}
+
+static void
+cfs_ll_create (fuse_req_t req, fuse_ino_t parent, const char * name,
+	       mode_t mode, struct fuse_file_info * fi)
+{
+	cfs_node *		pn	= cfs_ll_find(parent);
+	CfsFile *		file;
+	CfsDirEntry		ent;
+	struct fuse_entry_param	e;
+	int			rc;
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)parent << ","
+	          << name << ")");
+	
+	cfs_ll_age();
+	if (!S_ISREG(mode)) {
+		fuse_reply_err(req,EOPNOTSUPP);
+		return;
+	}
+	if (!pn || !pn->is_dir) {
+		fuse_reply_err(req,ENOTDIR);
+		return;
+	}
+	rc = cfs->OpenIn(pn->data_key,(char *)name,1,&file);
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	ent.inum = cfs->InodeIndex(file->inode_key);
+	CopyKey(ent.inode_key,file->inode_key);
+	rc = cfs_ll_entry(&ent,&file->inode,&e);
+	if (rc != 0) {
+		cfs->Close(file);
+		fuse_reply_err(req,rc);
+		return;
+	}
+	rc = cfs_ll_open_node(cfs_ll_find(ent.inum),file,fi);
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	fuse_reply_create(req,&e,fi);
+}
+
+static void
+cfs_ll_open (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+	cfs_node *	n	= cfs_ll_find(ino);
+	int		rc;
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << ")");
+	
+	cfs_ll_age();
+	rc = n ? cfs_ll_open_node(n,NULL,fi) : ENOENT;
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	fuse_reply_open(req,fi);
+}
+
+static void
+cfs_ll_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+	     struct fuse_file_info * fi)
+{
+	cfs_node *	n	= FI_NODE(fi);
+	CfsBuf		blk;
+	cfs_size_t	len;
+	int		rc;
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << ","
+	          << (long)off << "," << (unsigned long)size << ")");
+	
+	cfs_ll_age();
+	rc = n->wbuf->Flush();
+	if (rc == 0) {
+		blk->resize(size);
+		len = size;
+		rc = cfs->ReadFile(n->file,(cfs_offset_t)off,&(*blk)[0],len);
+	}
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	fuse_reply_buf(req,blk->data(),len);
+}
+
+static void
+cfs_ll_write (fuse_req_t req, fuse_ino_t ino, const char * buf, size_t size,
+	      off_t off, struct fuse_file_info * fi)
+{
+	cfs_node *	n	= FI_NODE(fi);
+	int		rc;
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << ","
+	          << (long)off << "," << (unsigned long)size << ")");
+	
+	cfs_ll_age();
+	rc = n->wbuf->Write((cfs_offset_t)off,buf,size);
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	fuse_reply_write(req,size);
+}
+
+static void
+cfs_ll_flush (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+	(void)ino;
+	fuse_reply_err(req,FI_NODE(fi)->wbuf->Flush());
+}
+
+static void
+cfs_ll_fsync (fuse_req_t req, fuse_ino_t ino, int datasync,
+	      struct fuse_file_info * fi)
+{
+	(void)ino;
+	(void)datasync;
+	fuse_reply_err(req,FI_NODE(fi)->wbuf->Flush());
+}
+
+static void
+cfs_ll_release (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+	cfs_node *	n	= FI_NODE(fi);
+	int		rc;
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)ino << ")");
+	
+	rc = n->wbuf->Flush();
+	if (--n->opens == 0) {
+		n->version = n->file->inode.version;
+		delete n->wbuf;
+		cfs->Close(n->file);
+		n->wbuf = NULL;
+		n->file = NULL;
+		cfs_ll_drop(n);
+	}
+	fuse_reply_err(req,rc);
+}
+
+// The inode is queued for reclaim right away, even if it's still open;
+// CassFs leaves it alone until it's closed (see CfsOpenCount).
+static void
+cfs_ll_unlink (fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+	cfs_node *	pn	= cfs_ll_find(parent);
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)parent << ","
+	          << name << ")");
+	
+	if (!pn || !pn->is_dir) {
+		fuse_reply_err(req,ENOTDIR);
+		return;
+	}
+	fuse_reply_err(req,cfs->RemoveIn(pn->data_key,(char *)name,false,true,
+					  NULL));
+}
+
+static void
+cfs_ll_rmdir (fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+	cfs_node *	pn	= cfs_ll_find(parent);
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)parent << ","
+	          << name << ")");
+	
+	if (!pn || !pn->is_dir) {
+		fuse_reply_err(req,ENOTDIR);
+		return;
+	}
+	fuse_reply_err(req,cfs->RemoveIn(pn->data_key,(char *)name,true,true,
+					  NULL));
+}
+
+// Open files are found by inode number, which a rename doesn't change,
+// so unlike fuse.cpp there's nothing to fix up afterwards.
+static void
+cfs_ll_rename (fuse_req_t req, fuse_ino_t parent, const char * name,
+	       fuse_ino_t newparent, const char * newname)
+{
+	cfs_node *	pn	= cfs_ll_find(parent);
+	cfs_node *	npn	= cfs_ll_find(newparent);
+	
+	CFS_DEBUG("in " << __func__ << "(" << (unsigned long)parent << ","
+	          << name << "," << (unsigned long)newparent << "," << newname
+	          << ")");
+	
+	if (!pn || !pn->is_dir || !npn || !npn->is_dir) {
+		fuse_reply_err(req,ENOTDIR);
+		return;
+	}
+	fuse_reply_err(req,cfs->RenameIn(pn->data_key,(char *)name,
+					  npn->data_key,(char *)newname,true,
+					  NULL));
+}
+
+static void
+cfs_ll_statfs (fuse_req_t req, fuse_ino_t ino)
+{
+	struct statvfs	st;
+	int		rc;
+	
+	(void)ino;
+	rc = cfs->Statfs(&st);
+	if (rc != 0) {
+		fuse_reply_err(req,rc);
+		return;
+	}
+	fuse_reply_statfs(req,&st);
+}
+
+// Positional, for the same reason as in fuse.cpp.
+static struct fuse_lowlevel_ops cfs_ll_oper = {
+	cfs_ll_init,
+	cfs_ll_destroy,
+	cfs_ll_lookup,
+	cfs_ll_forget,
+	cfs_ll_getattr,
+	cfs_ll_setattr,
+	NULL, /* readlink */
+	NULL, /* mknod */
+	cfs_ll_mkdir,
+	cfs_ll_unlink,
+	cfs_ll_rmdir,
+	NULL, /* symlink */
+	cfs_ll_rename,
+	NULL, /* link */
+	cfs_ll_open,
+	cfs_ll_read,
+	cfs_ll_write,
+	cfs_ll_flush,
+	cfs_ll_release,
+	cfs_ll_fsync,
+	cfs_ll_opendir,
+	cfs_ll_readdir,
+	cfs_ll_releasedir,
+	NULL, /* fsyncdir */
+	cfs_ll_statfs,
+	NULL, /* setxattr */
+	NULL, /* getxattr */
+	NULL, /* listxattr */
+	NULL, /* removexattr */
+	NULL, /* access */
+	cfs_ll_create,
+};
+
+int
+main (int argc, char ** argv)
+{
+	struct fuse_args	args	= FUSE_ARGS_INIT(argc,argv);
+	struct fuse_chan *	ch;
+	struct fuse_session *	se;
+	pthread_t		tid;
+	char *			mountpoint;
+	int			foreground;
+	int			err	= -1;
+	
+	if (fuse_opt_parse(&args,&opts,my_opt_descs,NULL) == -1) {
+		return 1;
+	}
+	if (!opts.name) {
+		fprintf(stderr,"%s: need -o name=fs_name\n",argv[0]);
+		return 1;
+	}
+	if (opts.log) {
+		cfs_log_level = CfsLogLevelByName(opts.log);
+		if (cfs_log_level < 0) {
+			fprintf(stderr,"%s: bad log level %s\n",argv[0],opts.log);
+			return 1;
+		}
+	}
+	if (opts.backend && strcmp(opts.backend,"mem")
+	    && strcmp(opts.backend,"cassandra")) {
+		fprintf(stderr,"%s: bad backend %s\n",argv[0],opts.backend);
+		return 1;
+	}
+	if (opts.latency && CfsParseLatency(opts.latency,&latency_spec)) {
+		fprintf(stderr,"%s: bad latency %s\n",argv[0],opts.latency);
+		return 1;
+	}
+	if (fuse_parse_cmdline(&args,&mountpoint,NULL,&foreground) == -1) {
+		return 1;
+	}
+	attr_timeout = opts.attr_timeout ? atof(opts.attr_timeout)
+					 : CFS_LL_TIMEOUT;
+	entry_timeout = opts.entry_timeout ? atof(opts.entry_timeout)
+					   : CFS_LL_TIMEOUT;
+	negative_timeout = opts.negative_timeout ? atof(opts.negative_timeout)
+						 : 0;
+	
+	ch = fuse_mount(mountpoint,&args);
+	if (ch) {
+		chan = ch;
+		se = fuse_lowlevel_new(&args,&cfs_ll_oper,sizeof(cfs_ll_oper),
+				       NULL);
+		if (se) {
+			if ((fuse_set_signal_handlers(se) != -1)
+			    && (fuse_daemonize(foreground) != -1)) {
+				fuse_session_add_chan(se,ch);
+				if (pthread_create(&tid,NULL,cfs_ll_inval_thread,
+						   NULL) != 0) {
+					chan = NULL;	// no invalidations
+				}
+				err = fuse_session_loop(se);
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(se);
+		}
+		fuse_unmount(mountpoint,ch);
+	}
+	fuse_opt_free_args(&args);
+	return err ? 1 : 0;
+}
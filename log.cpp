@@ -0,0 +1,219 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "log.h"
+
+using namespace std;
+
+#define CFS_LOG_POLL_USECS	10000	// how often an idle drain looks again
+
+// A bounded multi-producer queue after Dmitry Vyukov's: each slot's seq
+// says whose turn it is.  Slot i is free for the producer that claims
+// position pos when seq == pos, and full (for the consumer at pos) when
+// seq == pos + 1.  The consumer hands it back for the next lap by setting
+// seq to pos + CFS_LOG_RING.
+struct CfsLogSlot {
+	volatile unsigned long	seq;
+	int			level;
+	char			text[CFS_LOG_LINE];
+};
+
+int			cfs_log_level	= CFS_LOG_INFO;
+
+static CfsLogSlot	ring[CFS_LOG_RING];
+static unsigned long	tail;		// next position to fill
+static unsigned long	head;		// next position to drain
+static unsigned long	dropped;
+static volatile int	putting;	// producers inside CfsLogPut
+static volatile int	running;
+static volatile int	stopping;
+static pthread_t	drain_tid;
+static int		exit_hooked;
+
+static const char *	level_names[]	= {
+	"error", "warn", "info", "debug", NULL
+};
+
+int
+CfsLogLevelByName (const char * name)
+{
+	int	i;
+	
+	for (i = 0; level_names[i]; ++i) {
+		if (!strcasecmp(name,level_names[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void
+WriteLine (int level, const char * text)
+{
+	if (level <= CFS_LOG_WARN) {
+		printf("%s: %s\n",level_names[level],text);
+	}
+	else {
+		printf("%s\n",text);
+	}
+}
+
+void
+CfsLogPut (int level, const string & msg)
+{
+	CfsLogSlot *	slot;
+	unsigned long	pos;
+	long		diff;
+	size_t		len;
+	
+	// Counted before looking at running, so that CfsLogStop can wait for
+	// anyone who still saw it set.
+	__sync_fetch_and_add(&putting,1);
+	if (!running) {
+		__sync_fetch_and_sub(&putting,1);
+		WriteLine(level,msg.c_str());
+		return;
+	}
+	
+	pos = __sync_fetch_and_add(&tail,0);
+	for (;;) {
+		slot = &ring[pos & (CFS_LOG_RING - 1)];
+		diff = (long)(slot->seq - pos);
+		if (diff == 0) {
+			if (__sync_bool_compare_and_swap(&tail,pos,pos+1)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			__sync_fetch_and_add(&dropped,1);
+			__sync_fetch_and_sub(&putting,1);
+			return;
+		}
+		pos = __sync_fetch_and_add(&tail,0);
+	}
+	
+	len = msg.size();
+	if (len >= CFS_LOG_LINE) {
+		len = CFS_LOG_LINE - 1;
+	}
+	memcpy(slot->text,msg.data(),len);
+	slot->text[len] = '\0';
+	slot->level = level;
+	__sync_synchronize();
+	slot->seq = pos + 1;
+	__sync_fetch_and_sub(&putting,1);
+}
+
+// Writes out whatever is in the ring; only ever one caller at a time.
+static int
+Drain (void)
+{
+	CfsLogSlot *	slot;
+	unsigned long	lost;
+	int		n	= 0;
+	
+	for (;;) {
+		slot = &ring[head & (CFS_LOG_RING - 1)];
+		if (slot->seq != (head + 1)) {
+			break;
+		}
+		__sync_synchronize();
+		WriteLine(slot->level,slot->text);
+		__sync_synchronize();
+		slot->seq = head + CFS_LOG_RING;
+		++head;
+		++n;
+	}
+	
+	lost = dropped;
+	if (lost) {
+		__sync_fetch_and_sub(&dropped,lost);
+		printf("%s: %lu log messages dropped\n",
+		       level_names[CFS_LOG_WARN],lost);
+		++n;
+	}
+	if (n) {
+		fflush(stdout);
+	}
+	return n;
+}
+
+static void *
+DrainLoop (void * arg)
+{
+	(void)arg;
+	while (!stopping) {
+		if (!Drain()) {
+			usleep(CFS_LOG_POLL_USECS);
+		}
+	}
+	return NULL;
+}
+
+// Starts writing messages from a thread of our own.  Daemons should call
+// this after they fork, since the thread wouldn't survive it.
+int
+CfsLogStart (void)
+{
+	unsigned long	i;
+	
+	if (running) {
+		return 0;
+	}
+	for (i = 0; i < CFS_LOG_RING; ++i) {
+		ring[i].seq = i;
+	}
+	head = tail = 0;
+	stopping = 0;
+	if (pthread_create(&drain_tid,NULL,DrainLoop,NULL) != 0) {
+		return EAGAIN;
+	}
+	running = 1;
+	if (!exit_hooked) {
+		(void)atexit(CfsLogStop);
+		exit_hooked = 1;
+	}
+	return 0;
+}
+
+// Goes back to writing messages directly, once the ring is empty, with
+// whatever producers that still saw us running put in it.
+void
+CfsLogStop (void)
+{
+	if (!running) {
+		return;
+	}
+	stopping = 1;
+	(void)pthread_join(drain_tid,NULL);
+	running = 0;
+	__sync_synchronize();
+	while (putting) {
+		sched_yield();
+	}
+	(void)Drain();
+}
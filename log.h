@@ -0,0 +1,75 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Leveled logging that stays off the I/O path.  A message is formatted in
+// the calling thread and dropped into a fixed ring of slots without taking
+// any lock; a background thread (see CfsLogStart) writes them to stdout.
+// Until that thread is started, e.g. in cassfs_cli, messages are written
+// out directly instead.  If the ring is full, messages are dropped (and
+// counted) rather than making anybody wait.
+//
+// Messages above cfs_log_level cost one comparison.  Debug messages cost
+// nothing at all unless built with -DCFS_DEBUG_LOG.
+//
+//	CFS_INFO("writing " << key);
+
+#include <sstream>
+#include <string>
+
+#define CFS_LOG_ERROR	0
+#define CFS_LOG_WARN	1
+#define CFS_LOG_INFO	2
+#define CFS_LOG_DEBUG	3
+
+#define CFS_LOG_RING	4096	// slots; must be a power of two
+#define CFS_LOG_LINE	256	// longer messages are cut short
+
+extern int	cfs_log_level;	// default CFS_LOG_INFO
+
+int	CfsLogLevelByName	(const char * name);
+void	CfsLogPut		(int level, const std::string & msg);
+int	CfsLogStart		(void);
+void	CfsLogStop		(void);
+
+// Collects one message and logs it when it goes out of scope.
+class CfsLogLine {
+private:
+	int			level;
+public:
+	std::ostringstream	os;
+	
+		CfsLogLine	(int a_level) : level(a_level) {}
+		~CfsLogLine	() { CfsLogPut(level,os.str()); }
+};
+
+#define CFS_LOG(lvl,msg)					\
+	do {							\
+		if ((lvl) <= cfs_log_level) {			\
+			CfsLogLine	cfs_line_(lvl);		\
+			cfs_line_.os << msg;			\
+		}						\
+	} while (0)
+
+#define CFS_ERROR(msg)	CFS_LOG(CFS_LOG_ERROR,msg)
+#define CFS_WARN(msg)	CFS_LOG(CFS_LOG_WARN,msg)
+#define CFS_INFO(msg)	CFS_LOG(CFS_LOG_INFO,msg)
+#ifdef CFS_DEBUG_LOG
+#define CFS_DEBUG(msg)	CFS_LOG(CFS_LOG_DEBUG,msg)
+#else
+#define CFS_DEBUG(msg)	do { } while (0)
+#endif
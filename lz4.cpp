@@ -0,0 +1,244 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4.h"
+
+// Format constants, straight from the LZ4 block format description.
+#define MIN_MATCH	4
+#define LAST_LITERALS	5	// the last 5 bytes are always literals
+#define MF_LIMIT	12	// no match may start within 12 bytes of the end
+#define MAX_OFFSET	65535
+#define RUN_MASK	15
+#define ML_MASK		15
+
+#define HASH_LOG	12
+#define SKIP_TRIGGER	6	// speed up after 2^6 misses in a row
+
+typedef unsigned char	u8;
+
+static inline uint32_t
+Read32 (const u8 * p)
+{
+	uint32_t	v;
+	
+	memcpy(&v,p,sizeof(v));
+	return v;
+}
+
+static inline uint32_t
+Hash (uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// Emits a length continuation (the part past the 4-bit token field).
+static inline u8 *
+PutLength (u8 * op, unsigned int len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (u8)len;
+	return op;
+}
+
+// Emits one sequence: literals from anchor up to ip, then (unless this is
+// the last sequence) a match of mlen bytes at the given offset.
+static u8 *
+PutSequence (u8 * op, u8 * oend, const u8 * anchor, const u8 * ip,
+	     unsigned int offset, unsigned int mlen)
+{
+	unsigned int	lit_len	= ip - anchor;
+	u8 *		token;
+	
+	if ((op + 1 + lit_len + (lit_len / 255) + 1 + 2 + (mlen / 255) + 1)
+	    > oend) {
+		return NULL;
+	}
+	
+	token = op++;
+	if (lit_len >= RUN_MASK) {
+		*token = RUN_MASK << 4;
+		op = PutLength(op,lit_len-RUN_MASK);
+	}
+	else {
+		*token = lit_len << 4;
+	}
+	memcpy(op,anchor,lit_len);
+	op += lit_len;
+	
+	if (!offset) {
+		return op;	// last literals, no match part
+	}
+	
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	mlen -= MIN_MATCH;
+	if (mlen >= ML_MASK) {
+		*token |= ML_MASK;
+		op = PutLength(op,mlen-ML_MASK);
+	}
+	else {
+		*token |= mlen;
+	}
+	return op;
+}
+
+int
+cfs_lz4_compress (const char * src, int src_len, char * dst, int dst_cap)
+{
+	const u8 *	base		= (const u8 *)src;
+	const u8 *	ip		= base;
+	const u8 *	anchor		= base;
+	const u8 *	iend		= base + src_len;
+	const u8 *	mflimit		= iend - MF_LIMIT;
+	const u8 *	matchlimit	= iend - LAST_LITERALS;
+	u8 *		op		= (u8 *)dst;
+	u8 *		oend		= op + dst_cap;
+	uint32_t	table[1<<HASH_LOG];
+	const u8 *	ref;
+	const u8 *	mp;
+	uint32_t	seq;
+	uint32_t	h;
+	unsigned int	misses;
+	
+	if (src_len > MF_LIMIT) {
+		memset(table,0,sizeof(table));
+		misses = 1 << SKIP_TRIGGER;
+		while (ip < mflimit) {
+			seq = Read32(ip);
+			h = Hash(seq);
+			ref = base + table[h];
+			table[h] = ip - base;
+			if ((ref >= ip) || ((ip - ref) > MAX_OFFSET)
+			    || (Read32(ref) != seq)) {
+				// Skip ahead faster through incompressible data.
+				ip += misses++ >> SKIP_TRIGGER;
+				continue;
+			}
+			misses = 1 << SKIP_TRIGGER;
+	
+			// Extend backwards over literals, then forwards.
+			while ((ip > anchor) && (ref > base) && (ip[-1] == ref[-1])) {
+				--ip;
+				--ref;
+			}
+			mp = ip + MIN_MATCH;
+			ref += MIN_MATCH;
+			while ((mp < matchlimit) && (*mp == *ref)) {
+				++mp;
+				++ref;
+			}
+	
+			op = PutSequence(op,oend,anchor,ip,mp-ref,mp-ip);
+			if (!op) {
+				return 0;
+			}
+			ip = anchor = mp;
+		}
+	}
+	
+	op = PutSequence(op,oend,anchor,iend,0,0);
+	if (!op) {
+		return 0;
+	}
+	return op - (u8 *)dst;
+}
+
+// Reads a length continuation; returns false on truncated input.
+static inline bool
+GetLength (const u8 * &ip, const u8 * iend, size_t &len)
+{
+	u8	b;
+	
+	do {
+		if (ip >= iend) {
+			return false;
+		}
+		b = *ip++;
+		len += b;
+	} while (b == 255);
+	return true;
+}
+
+int
+cfs_lz4_decompress (const char * src, int src_len, char * dst, int dst_cap)
+{
+	const u8 *	ip	= (const u8 *)src;
+	const u8 *	iend	= ip + src_len;
+	u8 *		op	= (u8 *)dst;
+	u8 *		oend	= op + dst_cap;
+	const u8 *	match;
+	unsigned int	token;
+	unsigned int	offset;
+	size_t		len;
+	
+	while (ip < iend) {
+		token = *ip++;
+	
+		len = token >> 4;
+		if ((len == RUN_MASK) && !GetLength(ip,iend,len)) {
+			return -1;
+		}
+		if ((len > (size_t)(iend - ip)) || (len > (size_t)(oend - op))) {
+			return -1;
+		}
+		memcpy(op,ip,len);
+		op += len;
+		ip += len;
+		if (ip >= iend) {
+			break;	// that was the last-literals sequence
+		}
+	
+		if ((iend - ip) < 2) {
+			return -1;
+		}
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (!offset || (offset > (unsigned int)(op - (u8 *)dst))) {
+			return -1;
+		}
+	
+		len = token & ML_MASK;
+		if ((len == ML_MASK) && !GetLength(ip,iend,len)) {
+			return -1;
+		}
+		len += MIN_MATCH;
+		if (len > (size_t)(oend - op)) {
+			return -1;
+		}
+	
+		match = op - offset;
+		if (offset >= len) {
+			memcpy(op,match,len);
+			op += len;
+		}
+		else {
+			// Overlapping copy, i.e. a repeated pattern.
+			while (len--) {
+				*op++ = *match++;
+			}
+		}
+	}
+	
+	return op - (u8 *)dst;
+}
@@ -0,0 +1,33 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A small, self-contained implementation of the LZ4 *block* format (no
+// frames, no checksums), so we don't need liblz4 just to compress data
+// blocks.  Output is readable by the real LZ4_decompress_safe and vice versa.
+
+// Worst-case compressed size for len input bytes.
+#define CFS_LZ4_BOUND(len)	((len) + ((len) / 255) + 16)
+
+// Returns the compressed length, or 0 if it didn't fit in dst_cap.
+int	cfs_lz4_compress	(const char * src, int src_len,
+				 char * dst, int dst_cap);
+
+// Returns the decompressed length, or -1 if the input is malformed or
+// would overflow dst_cap.
+int	cfs_lz4_decompress	(const char * src, int src_len,
+				 char * dst, int dst_cap);
@@ -0,0 +1,457 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A metadata storm, in the spirit of mdtest, run through a mounted
+// filesystem with plain system calls.  Each of -t threads creates -n
+// files, then stats them, lists their directory -r times, and removes
+// them; every phase starts and ends with all threads together, and is
+// reported in ops/s.  The files go in one shared directory, or with -u
+// one per thread, -d levels down.  With -x, each thread instead unpacks
+// a tarball's worth of small files (-s bytes each, -b to a directory)
+// and then removes the lot.
+//
+// Nothing here is CassFS-specific, so the same run can be compared with
+// a local filesystem.  To take Cassandra out of the picture, mount with
+// -o backend=mem:
+//
+//	./cassfs -s -o name=md,backend=mem /tmp/md
+//	./cassfs_mdtest -t 4 -n 1000 -d 3 /tmp/md
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define PHASE_CREATE	0
+#define PHASE_STAT	1
+#define PHASE_READDIR	2
+#define PHASE_REMOVE	3
+#define PHASE_UNTAR	4
+#define PHASE_UNTAR_RM	5
+#define N_PHASES	6
+
+static const char *	phase_names[N_PHASES] = {
+	"create", "stat", "readdir", "remove", "untar", "untar_rm"
+};
+
+// Settings, from the command line.
+static int		n_threads	= 1;
+static unsigned long	n_items		= 1000;
+static int		depth		= 0;
+static bool		unique_dirs	= false;
+static int		n_readdirs	= 10;
+static bool		untar		= false;
+static size_t		file_size	= 4096;
+static unsigned long	fanout		= 10;
+
+static string			top;	// everything goes under here
+static pthread_barrier_t	barrier;
+static double			phase_secs[N_PHASES];
+static unsigned long		phase_ops[N_PHASES];
+static int			errors;
+
+struct Worker {
+	int		id;
+	pthread_t	thread;
+	string		dir;		// where its files go
+	unsigned long	ops[N_PHASES];
+};
+
+double
+Now (void)
+{
+	struct timeval	tv;
+	
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+Fail (const string & what)
+{
+	perror(what.c_str());
+	__sync_fetch_and_add(&errors,1);
+}
+
+static string
+ItemPath (Worker * w, unsigned long i)
+{
+	char	name[64];
+	
+	snprintf(name,sizeof(name),"/f.%d.%lu",w->id,i);
+	return w->dir + name;
+}
+
+// Makes dir and depth levels below it, and returns the bottom one.
+static string
+MakeTree (const string & dir)
+{
+	string	path	= dir;
+	char	name[16];
+	int	i;
+	
+	if ((mkdir(path.c_str(),0755) != 0) && (errno != EEXIST)) {
+		Fail("mkdir " + path);
+	}
+	for (i = 0; i < depth; ++i) {
+		snprintf(name,sizeof(name),"/l%d",i);
+		path += name;
+		if ((mkdir(path.c_str(),0755) != 0) && (errno != EEXIST)) {
+			Fail("mkdir " + path);
+		}
+	}
+	return path;
+}
+
+static void
+RemoveTree (const string & dir)
+{
+	string	path	= dir;
+	char	name[16];
+	int	i;
+	
+	for (i = 0; i < depth; ++i) {
+		snprintf(name,sizeof(name),"/l%d",i);
+		path += name;
+	}
+	for (i = depth; i >= 0; --i) {
+		if (rmdir(path.c_str()) != 0) {
+			Fail("rmdir " + path);
+		}
+		path.erase(path.rfind('/'));
+	}
+}
+
+static void
+Create (Worker * w)
+{
+	string		path;
+	unsigned long	i;
+	int		fd;
+	
+	for (i = 0; i < n_items; ++i) {
+		path = ItemPath(w,i);
+		fd = open(path.c_str(),O_CREAT|O_EXCL|O_WRONLY,0644);
+		if (fd < 0) {
+			Fail("create " + path);
+			continue;
+		}
+		close(fd);
+		++w->ops[PHASE_CREATE];
+	}
+}
+
+static void
+Stat (Worker * w)
+{
+	string		path;
+	struct stat	st;
+	unsigned long	i;
+	
+	for (i = 0; i < n_items; ++i) {
+		path = ItemPath(w,i);
+		if (stat(path.c_str(),&st) != 0) {
+			Fail("stat " + path);
+			continue;
+		}
+		++w->ops[PHASE_STAT];
+	}
+}
+
+static void
+ReadDir (Worker * w)
+{
+	DIR *		dp;
+	struct dirent *	de;
+	int		i;
+	
+	for (i = 0; i < n_readdirs; ++i) {
+		dp = opendir(w->dir.c_str());
+		if (!dp) {
+			Fail("opendir " + w->dir);
+			return;
+		}
+		while ((de = readdir(dp))) {
+			continue;
+		}
+		closedir(dp);
+		++w->ops[PHASE_READDIR];
+	}
+}
+
+static void
+Remove (Worker * w)
+{
+	string		path;
+	unsigned long	i;
+	
+	for (i = 0; i < n_items; ++i) {
+		path = ItemPath(w,i);
+		if (unlink(path.c_str()) != 0) {
+			Fail("unlink " + path);
+			continue;
+		}
+		++w->ops[PHASE_REMOVE];
+	}
+}
+
+static string
+UntarPath (Worker * w, unsigned long i, bool dir_only)
+{
+	char	name[64];
+	
+	if (dir_only) {
+		snprintf(name,sizeof(name),"/d%lu",i/fanout);
+	}
+	else {
+		snprintf(name,sizeof(name),"/d%lu/f%lu",i/fanout,i);
+	}
+	return w->dir + name;
+}
+
+// Like tar xf: a directory, then its files, each created, written in one
+// go and closed.
+static void
+Untar (Worker * w)
+{
+	vector<char>	buf(file_size,'x');
+	string		path;
+	unsigned long	i;
+	int		fd;
+	
+	for (i = 0; i < n_items; ++i) {
+		if (!(i % fanout)) {
+			path = UntarPath(w,i,true);
+			if (mkdir(path.c_str(),0755) != 0) {
+				Fail("mkdir " + path);
+			}
+		}
+		path = UntarPath(w,i,false);
+		fd = open(path.c_str(),O_CREAT|O_EXCL|O_WRONLY,0644);
+		if (fd < 0) {
+			Fail("create " + path);
+			continue;
+		}
+		if (file_size
+		    && (write(fd,&buf[0],file_size) != (ssize_t)file_size)) {
+			Fail("write " + path);
+		}
+		if (close(fd) != 0) {
+			Fail("close " + path);
+		}
+		++w->ops[PHASE_UNTAR];
+	}
+}
+
+static void
+UntarRemove (Worker * w)
+{
+	string		path;
+	unsigned long	i;
+	
+	for (i = 0; i < n_items; ++i) {
+		path = UntarPath(w,i,false);
+		if (unlink(path.c_str()) != 0) {
+			Fail("unlink " + path);
+			continue;
+		}
+		++w->ops[PHASE_UNTAR_RM];
+		if (((i % fanout) == (fanout - 1)) || (i == (n_items - 1))) {
+			path = UntarPath(w,i,true);
+			if (rmdir(path.c_str()) != 0) {
+				Fail("rmdir " + path);
+			}
+		}
+	}
+}
+
+static void
+RunPhase (Worker * w, int phase)
+{
+	pthread_barrier_wait(&barrier);
+	switch (phase) {
+	case PHASE_CREATE:	Create(w);	break;
+	case PHASE_STAT:	Stat(w);	break;
+	case PHASE_READDIR:	ReadDir(w);	break;
+	case PHASE_REMOVE:	Remove(w);	break;
+	case PHASE_UNTAR:	Untar(w);	break;
+	case PHASE_UNTAR_RM:	UntarRemove(w);	break;
+	}
+	pthread_barrier_wait(&barrier);
+}
+
+static void *
+WorkerMain (void * arg)
+{
+	Worker *	w	= (Worker *)arg;
+	int		p;
+	
+	for (p = 0; p < N_PHASES; ++p) {
+		if (untar == (p >= PHASE_UNTAR)) {
+			RunPhase(w,p);
+		}
+	}
+	return NULL;
+}
+
+static int
+ExitWithUsage (char * prog)
+{
+	fprintf(stderr,"Usage: %s [options] dir\n",prog);
+	fprintf(stderr,"  -t threads     (1)\n");
+	fprintf(stderr,"  -n items       files per thread (1000)\n");
+	fprintf(stderr,"  -d depth       directory levels to put them under (0)\n");
+	fprintf(stderr,"  -u             a directory per thread, not shared\n");
+	fprintf(stderr,"  -r count       listings per thread (10)\n");
+	fprintf(stderr,"  -x             untar mode instead\n");
+	fprintf(stderr,"  -s size        bytes per file in untar mode (4096)\n");
+	fprintf(stderr,"  -b count       files per directory in untar mode (10)\n");
+	return EINVAL;
+}
+
+int
+main (int argc, char ** argv)
+{
+	vector<Worker>	workers;
+	char		name[32];
+	string		shared;
+	double		start;
+	int		opt;
+	int		i;
+	int		p;
+	
+	while ((opt = getopt(argc,argv,"t:n:d:ur:xs:b:")) != -1) {
+		switch (opt) {
+		case 't':
+			n_threads = atoi(optarg);
+			break;
+		case 'n':
+			n_items = strtoul(optarg,NULL,10);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'u':
+			unique_dirs = true;
+			break;
+		case 'r':
+			n_readdirs = atoi(optarg);
+			break;
+		case 'x':
+			untar = true;
+			break;
+		case 's':
+			file_size = strtoul(optarg,NULL,10);
+			break;
+		case 'b':
+			fanout = strtoul(optarg,NULL,10);
+			break;
+		default:
+			return ExitWithUsage(argv[0]);
+		}
+	}
+	if ((optind != (argc - 1)) || (n_threads < 1) || !fanout
+	    || (depth < 0)) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	snprintf(name,sizeof(name),"/mdtest.%d",(int)getpid());
+	top = string(argv[optind]) + name;
+	if (mkdir(top.c_str(),0755) != 0) {
+		perror(top.c_str());
+		return errno;
+	}
+	workers.resize(n_threads);
+	if (!unique_dirs && !untar) {
+		shared = MakeTree(top + "/shared");
+	}
+	for (i = 0; i < n_threads; ++i) {
+		workers[i].id = i;
+		memset(workers[i].ops,0,sizeof(workers[i].ops));
+		if (shared.empty()) {
+			snprintf(name,sizeof(name),"/t%d",i);
+			workers[i].dir = MakeTree(top + name);
+		}
+		else {
+			workers[i].dir = shared;
+		}
+	}
+	
+	pthread_barrier_init(&barrier,NULL,n_threads+1);
+	for (i = 0; i < n_threads; ++i) {
+		pthread_create(&workers[i].thread,NULL,WorkerMain,&workers[i]);
+	}
+	for (p = 0; p < N_PHASES; ++p) {
+		if (untar != (p >= PHASE_UNTAR)) {
+			continue;
+		}
+		pthread_barrier_wait(&barrier);
+		start = Now();
+		pthread_barrier_wait(&barrier);
+		phase_secs[p] = Now() - start;
+	}
+	for (i = 0; i < n_threads; ++i) {
+		pthread_join(workers[i].thread,NULL);
+		for (p = 0; p < N_PHASES; ++p) {
+			phase_ops[p] += workers[i].ops[p];
+		}
+	}
+	
+	if (shared.empty()) {
+		for (i = 0; i < n_threads; ++i) {
+			snprintf(name,sizeof(name),"/t%d",i);
+			RemoveTree(top + name);
+		}
+	}
+	else {
+		RemoveTree(top + "/shared");
+	}
+	if (rmdir(top.c_str()) != 0) {
+		Fail("rmdir " + top);
+	}
+	
+	printf("%d threads, %lu items each, depth %d, %s\n",n_threads,n_items,
+	       depth,untar ? "untar" : unique_dirs ? "unique dirs"
+						   : "shared dir");
+	printf("%-10s %10s %10s %12s\n","phase","ops","seconds","ops/s");
+	for (p = 0; p < N_PHASES; ++p) {
+		if (untar != (p >= PHASE_UNTAR)) {
+			continue;
+		}
+		printf("%-10s %10lu %10.3f %12.1f\n",phase_names[p],phase_ops[p],
+		       phase_secs[p],phase_ops[p] / phase_secs[p]);
+	}
+	if (untar) {
+		printf("untar: %.2f MB/s\n",phase_ops[PHASE_UNTAR] * file_size
+		       / phase_secs[PHASE_UNTAR] / (1024 * 1024));
+	}
+	if (errors) {
+		printf("%d errors\n",errors);
+	}
+	return errors ? EIO : 0;
+}
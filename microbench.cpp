@@ -0,0 +1,248 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Times the small pieces that every operation pays for, in ns per call:
+// base64 of data blocks and inodes, key formatting, path splitting, and
+// directory scans (at 10 to a million entries, in powers of ten).  Each
+// case runs for at least -t seconds (default 0.5); -m caps the largest
+// directory.  Run it before and after a change to any of these.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TTransportUtils.h>
+#include "Cassandra.h"
+#include "base64.h"
+#include "cfs_types.h"
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace org::apache::cassandra;
+
+#include "connect.h"
+#include "cassfs.h"
+
+typedef void bench_fn_t (void * arg, unsigned long reps);
+
+static double		min_seconds	= 0.5;
+static volatile size_t	sink;		// so nothing gets optimized away
+
+double
+Now (void)
+{
+	struct timeval	tv;
+	
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Doubles the repetitions until one batch takes long enough to time.
+void
+Run (const char * name, const char * size, bench_fn_t * fn, void * arg)
+{
+	unsigned long	reps	= 1;
+	double		start;
+	double		secs;
+	
+	for (;;) {
+		start = Now();
+		fn(arg,reps);
+		secs = Now() - start;
+		if (secs >= min_seconds) {
+			break;
+		}
+		reps *= (secs < (min_seconds / 16)) ? 16 : 2;
+	}
+	printf("%-14s %-12s %12.1f\n",name,size,secs * 1e9 / reps);
+}
+
+struct B64Arg {
+	string	raw;
+	string	encoded;
+	string	out;
+	char *	buf;
+};
+
+void
+Encode (void * arg, unsigned long reps)
+{
+	B64Arg *	b	= (B64Arg *)arg;
+	
+	while (reps--) {
+		base64_encode(UCCP(b->raw.data()),b->raw.size(),b->out);
+		sink += b->out.size();
+	}
+}
+
+void
+Decode (void * arg, unsigned long reps)
+{
+	B64Arg *	b	= (B64Arg *)arg;
+	
+	while (reps--) {
+		sink += base64_decode(b->encoded,b->buf,b->raw.size());
+	}
+}
+
+void
+RunBase64 (const char * what, size_t len)
+{
+	B64Arg	b;
+	char	size[32];
+	size_t	i;
+	
+	b.raw.resize(len);
+	for (i = 0; i < len; ++i) {
+		b.raw[i] = random();
+	}
+	base64_encode(UCCP(b.raw.data()),len,b.encoded);
+	b.buf = new char[len];
+	snprintf(size,sizeof(size),"%s %luk",what,(unsigned long)len >> 10);
+	Run("b64_encode",size,Encode,&b);
+	Run("b64_decode",size,Decode,&b);
+	delete [] b.buf;
+}
+
+void
+DataKeys (void * arg, unsigned long reps)
+{
+	char	key[CFS_MAX_KEY_LEN];
+	
+	while (reps--) {
+		IndexToDataKey(reps,(char *)arg,key);
+		sink += key[0];
+	}
+}
+
+void
+InodeKeys (void * arg, unsigned long reps)
+{
+	char	key[CFS_MAX_KEY_LEN];
+	
+	while (reps--) {
+		IndexToInodeKey(reps,(char *)arg,key);
+		sink += key[0];
+	}
+}
+
+// The same loop as CassFs::LookupAll, minus the lookups.
+void
+Split (void * arg, unsigned long reps)
+{
+	char *	path	= (char *)arg;
+	char *	sep;
+	char *	elem;
+	
+	while (reps--) {
+		sep = NULL;
+		for (elem = mysplit(path,sep); elem; elem = mysplit(path,sep)) {
+			sink += *elem;
+		}
+	}
+}
+
+struct DirArg {
+	vector<CfsDirEntry>	ents;
+	const char *		name;
+};
+
+void
+Scan (void * arg, unsigned long reps)
+{
+	DirArg *	d	= (DirArg *)arg;
+	
+	while (reps--) {
+		sink += CfsFindEntry(&d->ents[0],d->ents.size(),d->name);
+	}
+}
+
+// Entries are named like the files cassfs_bench creates.  Looking up the
+// middle one is the average hit; a missing name (e.g. any create) scans
+// the lot.
+void
+RunScans (size_t max_ents)
+{
+	DirArg	d;
+	char	name[CFS_MAX_NAME_LEN];
+	char	size[32];
+	size_t	n;
+	size_t	i;
+	
+	for (n = 10; n <= max_ents; n *= 10) {
+		d.ents.resize(n);
+		memset(&d.ents[0],0,n*sizeof(CfsDirEntry));
+		for (i = 0; i < n; ++i) {
+			snprintf(d.ents[i].name,CFS_MAX_NAME_LEN,"f%07lu",
+				 (unsigned long)i);
+			IndexToInodeKey(i+2,(char *)"fs",d.ents[i].inode_key);
+			d.ents[i].inum = i+2;
+			d.ents[i].mode = S_IFREG;
+		}
+		snprintf(size,sizeof(size),"%lu ents",(unsigned long)n);
+		snprintf(name,sizeof(name),"f%07lu",(unsigned long)n/2);
+		d.name = name;
+		Run("dir_hit",size,Scan,&d);
+		d.name = "missing";
+		Run("dir_miss",size,Scan,&d);
+	}
+}
+
+int
+main (int argc, char ** argv)
+{
+	size_t	max_ents	= 1000000;
+	char	prefix[]	= "myfs";
+	char	path[]		= "/home/user/src/cassfs/obj/file.o";
+	int	opt;
+	
+	while ((opt = getopt(argc,argv,"t:m:")) != -1) {
+		switch (opt) {
+		case 't':
+			min_seconds = atof(optarg);
+			break;
+		case 'm':
+			max_ents = strtoul(optarg,NULL,10);
+			break;
+		default:
+			fprintf(stderr,"Usage: %s [-t secs] [-m max_ents]\n",
+				argv[0]);
+			return EINVAL;
+		}
+	}
+	
+	printf("%-14s %-12s %12s\n","case","size","ns/op");
+	RunBase64("block",CFS_BLOCK_SIZE);
+	RunBase64("inode",sizeof(CfsInode));
+	Run("data_key","",DataKeys,prefix);
+	Run("inode_key","",InodeKeys,prefix);
+	Run("split","depth 6",Split,path);
+	RunScans(max_ents);
+	return 0;
+}
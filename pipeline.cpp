@@ -0,0 +1,255 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <iostream>
+
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TTransportUtils.h>
+#include "Cassandra.h"
+#include "cfs_types.h"
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace org::apache::cassandra;
+
+#include "connect.h"
+#include "cassfs.h"
+#include "log.h"
+#include "pipeline.h"
+
+// Connections are made up front, so a failure shows up here (as a
+// TException) rather than as a worker that never takes any jobs.  So does
+// failing to start any threads at all; with fewer than asked for, the
+// pipeline just runs on those.
+CfsPipeline::CfsPipeline (CassFs * a_cfs, CfsConnector * a_connector,
+			  int nthreads, int a_window) :
+	cfs(a_cfs), connector(a_connector), window(a_window),
+	next_client(0), in_flight(0), error(0), stopping(false)
+{
+	pthread_t	tid;
+	int		i;
+	
+	pthread_mutex_init(&lock,NULL);
+	pthread_cond_init(&work_cv,NULL);
+	pthread_cond_init(&done_cv,NULL);
+	
+	try {
+		for (i = 0; i < nthreads; ++i) {
+			clients.push_back(connector->Connect());
+		}
+	}
+	catch (...) {
+		for (i = 0; i < (int)clients.size(); ++i) {
+			connector->Disconnect(clients[i]);
+		}
+		throw;
+	}
+	for (i = 0; i < nthreads; ++i) {
+		if (pthread_create(&tid,NULL,Worker,this) == 0) {
+			threads.push_back(tid);
+		}
+	}
+	if (!threads.empty() && ((int)threads.size() < nthreads)) {
+		CFS_ERROR("started " << threads.size() << " of " << nthreads
+		          << " pipeline threads");
+	}
+	
+	// Workers take clients from the front, so the ones at the back are
+	// those nobody will use.
+	pthread_mutex_lock(&lock);
+	while (clients.size() > threads.size()) {
+		connector->Disconnect(clients.back());
+		clients.pop_back();
+	}
+	pthread_mutex_unlock(&lock);
+	if (threads.empty()) {
+		pthread_cond_destroy(&done_cv);
+		pthread_cond_destroy(&work_cv);
+		pthread_mutex_destroy(&lock);
+		throw TException("could not start pipeline threads");
+	}
+}
+
+CfsPipeline::~CfsPipeline ()
+{
+	size_t	i;
+	
+	(void)Drain();
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_broadcast(&work_cv);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < threads.size(); ++i) {
+		pthread_join(threads[i],NULL);
+	}
+	for (i = 0; i < clients.size(); ++i) {
+		connector->Disconnect(clients[i]);
+	}
+	for (i = 0; i < spare.size(); ++i) {
+		delete spare[i];
+	}
+	pthread_cond_destroy(&done_cv);
+	pthread_cond_destroy(&work_cv);
+	pthread_mutex_destroy(&lock);
+}
+
+void *
+CfsPipeline::Worker (void * arg)
+{
+	((CfsPipeline *)arg)->Run();
+	return NULL;
+}
+
+void
+CfsPipeline::Run (void)
+{
+	CassandraIf *	client;
+	CfsPipeJob *	job;
+	int		rc;
+	
+	pthread_mutex_lock(&lock);
+	client = clients[next_client++];
+	for (;;) {
+		while (queue.empty() && !stopping) {
+			pthread_cond_wait(&work_cv,&lock);
+		}
+		if (queue.empty()) {
+			break;
+		}
+		job = queue.front();
+		queue.pop_front();
+		pthread_mutex_unlock(&lock);
+		
+		rc = 0;
+		try {
+			if (job->remove) {
+				cfs->RemoveBlock(client,job->key,
+						 job->timestamp);
+			}
+			else {
+				cfs->PutBlock(client,job->key,job->data.data(),
+					      job->timestamp);
+			}
+		}
+		catch (TException &tx) {
+			CFS_ERROR("pipelined update of " << job->key
+			          << " failed: " << tx.what());
+			rc = EIO;
+		}
+		
+		pthread_mutex_lock(&lock);
+		if (rc && !error) {
+			error = rc;
+		}
+		spare.push_back(job);
+		--in_flight;
+		pthread_cond_broadcast(&done_cv);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+// Waits for a slot in the window, then returns a job to fill in.  The job
+// is the caller's until PutJob queues it.
+CfsPipeJob *
+CfsPipeline::GetJob (void)
+{
+	CfsPipeJob *	job;
+	
+	pthread_mutex_lock(&lock);
+	while (in_flight >= window) {
+		pthread_cond_wait(&done_cv,&lock);
+	}
+	++in_flight;
+	if (spare.empty()) {
+		job = new CfsPipeJob;
+	}
+	else {
+		job = spare.back();
+		spare.pop_back();
+	}
+	pthread_mutex_unlock(&lock);
+	return job;
+}
+
+void
+CfsPipeline::PutJob (CfsPipeJob * job)
+{
+	pthread_mutex_lock(&lock);
+	queue.push_back(job);
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&lock);
+}
+
+void
+CfsPipeline::Submit (const char * data_key, const char * data, size_t len,
+		     int64_t timestamp)
+{
+	CfsPipeJob *	job	= GetJob();
+	
+	// Copy outside the lock.
+	job->key = data_key;
+	job->data.assign(data,len);
+	job->remove = false;
+	job->timestamp = timestamp;
+	PutJob(job);
+}
+
+void
+CfsPipeline::SubmitRemove (const char * data_key, int64_t timestamp)
+{
+	CfsPipeJob *	job	= GetJob();
+	
+	job->key = data_key;
+	job->data.clear();
+	job->remove = true;
+	job->timestamp = timestamp;
+	PutJob(job);
+}
+
+// Waits for everything submitted so far to be stored (or fail).
+void
+CfsPipeline::Wait (void)
+{
+	pthread_mutex_lock(&lock);
+	while (in_flight > 0) {
+		pthread_cond_wait(&done_cv,&lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+int
+CfsPipeline::Drain (void)
+{
+	int	rc;
+	
+	pthread_mutex_lock(&lock);
+	while (in_flight > 0) {
+		pthread_cond_wait(&done_cv,&lock);
+	}
+	rc = error;
+	error = 0;
+	pthread_mutex_unlock(&lock);
+	return rc;
+}
@@ -0,0 +1,72 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Streams data blocks to the store in the background, for big sequential
+// writes (and removes them, for truncate).  Submit queues a block and
+// returns at once unless the window (blocks queued or being stored) is
+// full, in which case it waits for a slot.  Worker threads, each with a
+// connection of its own, encode and store blocks concurrently.  Drain
+// waits for everything submitted so far and returns the first error since
+// the last Drain, so an inode that points at the blocks should only be
+// written after that.  Errors aren't tracked per file.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct CfsPipeJob {
+	std::string	key;
+	std::string	data;
+	bool		remove;		// remove the block instead
+	int64_t		timestamp;
+};
+
+class CfsPipeline {
+private:
+	CassFs *			cfs;
+	CfsConnector *			connector;
+	int				window;
+	pthread_mutex_t			lock;
+	pthread_cond_t			work_cv;	// job queued, or stopping
+	pthread_cond_t			done_cv;	// job finished
+	std::deque<CfsPipeJob *>	queue;
+	std::vector<CfsPipeJob *>	spare;		// for reuse
+	std::vector<CassandraIf *>	clients;
+	std::vector<pthread_t>		threads;
+	size_t				next_client;
+	int				in_flight;	// queued + storing
+	int				error;
+	bool				stopping;
+	
+	static void *	Worker		(void * arg);
+	void		Run		(void);
+	CfsPipeJob *	GetJob		(void);
+	void		PutJob		(CfsPipeJob * job);
+	
+public:
+		CfsPipeline	(CassFs * a_cfs, CfsConnector * a_connector,
+				 int nthreads, int a_window);
+		~CfsPipeline	();
+	void	Submit		(const char * data_key, const char * data,
+				 size_t len, int64_t timestamp);
+	void	SubmitRemove	(const char * data_key, int64_t timestamp);
+	void	Wait		(void);
+	int	Drain		(void);
+};
@@ -0,0 +1,153 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <iostream>
+
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TTransportUtils.h>
+#include "Cassandra.h"
+#include "cfs_types.h"
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace org::apache::cassandra;
+
+#include "connect.h"
+#include "cassfs.h"
+#include "log.h"
+#include "reclaim.h"
+
+// Inodes to take from the queue at a time.
+#define CFS_RECLAIM_BATCH	16
+// How often to look at the queue when nobody has kicked us.
+#define CFS_RECLAIM_IDLE_SECS	30
+
+static double
+Now (void)
+{
+	struct timeval	tv;
+	
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// As with the write pipeline, the connection is made up front, so failure
+// shows up here as a TException.
+CfsReclaimer::CfsReclaimer (CassFs * a_cfs, CfsConnector * a_connector,
+			    int a_rate) :
+	cfs(a_cfs), connector(a_connector), rate(a_rate), next_slot(0),
+	kicked(true), stopping(false)
+{
+	client = connector->Connect();
+	pthread_mutex_init(&lock,NULL);
+	pthread_cond_init(&cv,NULL);
+	if (pthread_create(&thread,NULL,Worker,this) != 0) {
+		CFS_ERROR("could not start reclaimer thread");
+		stopping = true;
+	}
+}
+
+// Stops after the inode being reclaimed, if any; the rest stay queued.
+CfsReclaimer::~CfsReclaimer ()
+{
+	bool	running	= !stopping;
+	
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&cv);
+	pthread_mutex_unlock(&lock);
+	if (running) {
+		pthread_join(thread,NULL);
+	}
+	connector->Disconnect(client);
+	pthread_cond_destroy(&cv);
+	pthread_mutex_destroy(&lock);
+}
+
+void *
+CfsReclaimer::Worker (void * arg)
+{
+	((CfsReclaimer *)arg)->Run();
+	return NULL;
+}
+
+void
+CfsReclaimer::Run (void)
+{
+	struct timespec	until;
+	int		done;
+	
+	for (;;) {
+		try {
+			done = cfs->ReclaimSome(client,CFS_RECLAIM_BATCH,this);
+		}
+		catch (TException &tx) {
+			CFS_ERROR("reclaim failed: " << tx.what());
+			done = 0;
+		}
+		
+		pthread_mutex_lock(&lock);
+		if (!done && !kicked && !stopping) {
+			until.tv_sec = time(NULL) + CFS_RECLAIM_IDLE_SECS;
+			until.tv_nsec = 0;
+			(void)pthread_cond_timedwait(&cv,&lock,&until);
+		}
+		kicked = false;
+		if (stopping) {
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+// Something was queued.
+void
+CfsReclaimer::Kick (void)
+{
+	pthread_mutex_lock(&lock);
+	kicked = true;
+	pthread_cond_signal(&cv);
+	pthread_mutex_unlock(&lock);
+}
+
+// Waits for the next removal slot.  Time spent idle doesn't build up
+// credit, so a big backlog still goes at rate, not in a burst.  Once we're
+// stopping, there's no waiting, so the inode in hand gets finished quickly.
+void
+CfsReclaimer::Pace (void)
+{
+	double	now	= Now();
+	
+	if (next_slot < now) {
+		next_slot = now;
+	}
+	else if (!stopping) {
+		usleep((useconds_t)((next_slot - now) * 1000000));
+	}
+	next_slot += 1.0 / rate;
+}
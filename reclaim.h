@@ -0,0 +1,52 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Frees the space of removed files and directories in the background.
+// Unlink and rmdir only drop the directory entry and put the inode on the
+// reclaim queue, so they take two small writes however big the file was.
+// This thread works the queue off with a connection of its own, removing
+// at most rate keys per second so that it doesn't crowd out foreground
+// I/O.  The queue is stored, so whatever is left at unmount (or after a
+// crash) gets reclaimed after the next mount.
+
+#include <pthread.h>
+
+class CfsReclaimer {
+private:
+	CassFs *		cfs;
+	CfsConnector *		connector;
+	CassandraIf *		client;
+	int			rate;		// removals per second
+	double			next_slot;	// earliest time for the next
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cv;		// kicked, or stopping
+	bool			kicked;
+	volatile bool		stopping;
+	
+	static void *	Worker		(void * arg);
+	void		Run		(void);
+	
+public:
+		CfsReclaimer	(CassFs * a_cfs, CfsConnector * a_connector,
+				 int a_rate);
+		~CfsReclaimer	();
+	void	Kick		(void);
+	void	Pace		(void);
+	bool	Stopping	(void) { return stopping; }
+};
@@ -0,0 +1,647 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Plays back a trace recorded by the daemon (-o trace=file) against CassFs
+// directly, e.g. to see what a change does to a real workload without a
+// mount.  Calls go out in the order they were recorded, one at a time, at
+// the recorded pace (-s 1, the default), faster or slower (-s 10, -s 0.5),
+// or as fast as they'll go (-s 0).  By default it runs against an
+// in-memory store; -c host:port runs against a real cluster instead, and
+// -l adds simulated latency to either (see CfsLatencyConnector).
+//
+// Whatever the trace found already there - files it read, directories it
+// listed, the parents of everything - is made first, on a fresh
+// filesystem (-F, default "replay"), with files as long as the furthest
+// read.  Open files are kept per path, as the daemon does, and reads or
+// writes on a path nobody opened in the trace (because it was already
+// open when recording started) open it then.  A call that succeeded in
+// the trace and failed here, or the other way round, counts as a
+// mismatch; a lot of those means the guesses above were wrong.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TTransportUtils.h>
+#include "Cassandra.h"
+#include "cfs_types.h"
+#include "codec.h"
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace org::apache::cassandra;
+
+#include "connect.h"
+#include "cassfs.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "writebuf.h"
+
+#define META_DIR	"/.cassfs"	// the daemon's own files
+#define FILL_SIZE	(1 << 20)
+
+struct Call {
+	CfsTraceRec	rec;
+	string		path;
+	string		path2;
+};
+
+struct Handle {
+	CfsFile *		file;
+	CfsWriteBuffer *	wbuf;
+	int			refs;
+};
+
+struct OpResult {
+	unsigned long		mismatches;
+	uint64_t		traced_ns;
+	vector<uint64_t>	lat;
+};
+
+// What the trace implies was there before it started.
+struct Existing {
+	bool		dir;
+	uint64_t	size;
+};
+
+static vector<Call>		calls;
+static map<string,Existing>	existing;
+static map<string,Handle *>	handles;
+static OpResult			results[CFS_OP_COUNT];
+static char *			io_buf;
+static size_t			io_buf_size;
+
+static void
+Fail (const char * what, const string & path, int rc)
+{
+	fprintf(stderr,"%s %s failed: %s\n",what,path.c_str(),strerror(rc));
+}
+
+static int
+LoadTrace (const char * path)
+{
+	FILE *	fp;
+	Call	call;
+	int	rc;
+	
+	fp = CfsTraceOpen(path);
+	if (!fp) {
+		perror(path);
+		return errno;
+	}
+	while ((rc = CfsTraceRead(fp,&call.rec,call.path,call.path2)) > 0) {
+		if (call.rec.op >= CFS_OP_BE_GET) {
+			continue;
+		}
+		if (!call.path.compare(0,strlen(META_DIR),META_DIR)) {
+			continue;
+		}
+		calls.push_back(call);
+	}
+	fclose(fp);
+	if (rc < 0) {
+		fprintf(stderr,"%s: cut short after %lu calls\n",path,
+			(unsigned long)calls.size());
+	}
+	return 0;
+}
+
+static bool
+IsDirOp (int op)
+{
+	switch (op) {
+	case CFS_OP_OPENDIR:
+	case CFS_OP_READDIR:
+	case CFS_OP_RELEASEDIR:
+	case CFS_OP_RMDIR:
+		return true;
+	}
+	return false;
+}
+
+static bool
+IsCreateOp (int op)
+{
+	return (op == CFS_OP_MKNOD) || (op == CFS_OP_CREATE)
+		|| (op == CFS_OP_MKDIR);
+}
+
+// Everything above path must have been a directory, and anything we
+// haven't seen yet was there to begin with.
+static void
+NoteParents (const string & path, map<string,bool> & seen)
+{
+	size_t	slash;
+	string	parent;
+	
+	for (slash = path.find('/',1); slash != string::npos;
+	     slash = path.find('/',slash+1)) {
+		parent = path.substr(0,slash);
+		if (seen.find(parent) == seen.end()) {
+			seen[parent] = true;
+			existing[parent].dir = true;
+		}
+		else if (existing.find(parent) != existing.end()) {
+			existing[parent].dir = true;
+		}
+	}
+}
+
+// Works out the initial state from the first time each path shows up: if
+// the trace didn't create it but used it successfully (or failed to
+// create it because it was there), it was there.
+static void
+FindExisting (void)
+{
+	map<string,bool>	seen;
+	Existing *		ex;
+	size_t			i;
+	int			op;
+	bool			ok;
+	
+	for (i = 0; i < calls.size(); ++i) {
+		const CfsTraceRec &	rec	= calls[i].rec;
+		const string &		path	= calls[i].path;
+	
+		op = rec.op;
+		ok = (rec.result >= 0)
+			|| (IsCreateOp(op) && (rec.result == -EEXIST));
+		if (!ok || (path == "/")) {
+			continue;
+		}
+		NoteParents(path,seen);
+		if (op == CFS_OP_RENAME) {
+			NoteParents(calls[i].path2,seen);
+			seen[calls[i].path2] = true;
+		}
+		if (seen.find(path) == seen.end()) {
+			seen[path] = true;
+			if ((rec.result >= 0) && IsCreateOp(op)) {
+				continue;
+			}
+			existing[path].dir = (op == CFS_OP_MKDIR) || IsDirOp(op);
+			existing[path].size = 0;
+		}
+		ex = (existing.find(path) == existing.end()) ? NULL
+							      : &existing[path];
+		if (ex && (op == CFS_OP_READ) && (rec.result > 0)) {
+			ex->size = max(ex->size,rec.offset + rec.result);
+		}
+	}
+}
+
+// Grows io_buf to at least size, filled with random bytes: CassFs never
+// stores a block of zeroes, so writing those wouldn't store anything.
+static void
+GrowBuffer (size_t size)
+{
+	size_t	i;
+	
+	if (size <= io_buf_size) {
+		return;
+	}
+	delete [] io_buf;
+	io_buf_size = size;
+	io_buf = new char[io_buf_size];
+	for (i = 0; i < io_buf_size; ++i) {
+		io_buf[i] = random();
+	}
+}
+
+static int
+FillFile (CassFs * cfs, const string & path, uint64_t size)
+{
+	CfsFile *		file;
+	CfsWriteBuffer *	wbuf;
+	uint64_t		off;
+	size_t			len;
+	int			rc;
+	
+	rc = cfs->Open((char *)path.c_str(),1,&file);
+	if (rc != 0) {
+		return rc;
+	}
+	wbuf = new CfsWriteBuffer(cfs,file);
+	for (off = 0; (off < size) && (rc == 0); off += len) {
+		len = (size_t)min((uint64_t)FILL_SIZE,size - off);
+		rc = wbuf->Write(off,io_buf,len);
+	}
+	if (rc == 0) {
+		rc = wbuf->Flush();
+	}
+	delete wbuf;
+	cfs->Close(file);
+	return rc;
+}
+
+// Parents sort before their children, so one pass will do.
+static int
+MakeExisting (CassFs * cfs)
+{
+	map<string,Existing>::iterator	it;
+	int				rc;
+	
+	for (it = existing.begin(); it != existing.end(); ++it) {
+		if (it->second.dir) {
+			rc = cfs->Mkdir((char *)it->first.c_str());
+		}
+		else {
+			rc = FillFile(cfs,it->first,it->second.size);
+		}
+		if (rc != 0) {
+			Fail("setup",it->first,rc);
+			return rc;
+		}
+	}
+	return 0;
+}
+
+static Handle *
+FindHandle (const string & path)
+{
+	map<string,Handle *>::iterator	it;
+	
+	it = handles.find(path);
+	return (it == handles.end()) ? NULL : it->second;
+}
+
+static int
+GetHandle (CassFs * cfs, const string & path, int create, Handle ** hp)
+{
+	CfsFile *	file;
+	Handle *	h;
+	int		rc;
+	
+	h = FindHandle(path);
+	if (!h) {
+		rc = cfs->Open((char *)path.c_str(),create,&file);
+		if (rc != 0) {
+			return rc;
+		}
+		h = new Handle;
+		h->file = file;
+		h->wbuf = new CfsWriteBuffer(cfs,file);
+		h->refs = 0;
+		handles[path] = h;
+	}
+	++h->refs;
+	if (hp) {
+		*hp = h;
+	}
+	return 0;
+}
+
+static void
+CloseHandle (CassFs * cfs, Handle * h)
+{
+	delete h->wbuf;
+	cfs->Close(h->file);
+	delete h;
+}
+
+static int
+PutHandle (CassFs * cfs, const string & path, Handle * h)
+{
+	int	rc;
+	
+	rc = h->wbuf->Flush();
+	if (--h->refs == 0) {
+		handles.erase(path);
+		CloseHandle(cfs,h);
+	}
+	return rc;
+}
+
+// For reads and writes, which need something open.
+static int
+UseHandle (CassFs * cfs, const string & path, Handle ** hp)
+{
+	*hp = FindHandle(path);
+	return *hp ? 0 : GetHandle(cfs,path,0,hp);
+}
+
+// A file the rename replaced is gone, open or not, so it's closed here.
+static void
+MoveHandles (CassFs * cfs, const string & from, const string & to)
+{
+	map<string,Handle *>::iterator	it;
+	vector<string>			moved;
+	string				under	= from + "/";
+	size_t				i;
+	
+	if (from == to) {
+		return;
+	}
+	it = handles.find(to);
+	if (it != handles.end()) {
+		(void)it->second->wbuf->Flush();
+		CloseHandle(cfs,it->second);
+		handles.erase(it);
+	}
+	for (it = handles.begin(); it != handles.end(); ++it) {
+		if ((it->first == from)
+		    || !it->first.compare(0,under.size(),under)) {
+			moved.push_back(it->first);
+		}
+	}
+	for (i = 0; i < moved.size(); ++i) {
+		handles[to + moved[i].substr(from.size())] = handles[moved[i]];
+		handles.erase(moved[i]);
+	}
+}
+
+// Does what the daemon does for each call, returning an errno.
+static int
+Replay (CassFs * cfs, const Call & call)
+{
+	char *		path	= (char *)call.path.c_str();
+	CfsInode	tmp;
+	CfsInode *	inodep	= &tmp;
+	Handle *	h;
+	cfs_size_t	len;
+	string		rddata;
+	struct statvfs	st;
+	int		rc;
+	
+	switch (call.rec.op) {
+	case CFS_OP_GETATTR:
+		h = FindHandle(call.path);
+		if (h) {
+			(void)h->wbuf->Flush();
+			return 0;
+		}
+		return cfs->LookupAll(path,&inodep);
+	case CFS_OP_MKNOD:
+		rc = GetHandle(cfs,call.path,1,&h);
+		return (rc == 0) ? PutHandle(cfs,call.path,h) : rc;
+	case CFS_OP_MKDIR:
+		return cfs->Mkdir(path);
+	case CFS_OP_UNLINK:
+		return cfs->Unlink(path);
+	case CFS_OP_RMDIR:
+		return cfs->Rmdir(path);
+	case CFS_OP_RENAME:
+		rc = cfs->Rename(path,(char *)call.path2.c_str());
+		if (rc == 0) {
+			MoveHandles(cfs,call.path,call.path2);
+		}
+		return rc;
+	case CFS_OP_TRUNCATE:
+		h = FindHandle(call.path);
+		if (!h) {
+			return cfs->Truncate(path,call.rec.size);
+		}
+		rc = h->wbuf->Flush();
+		return (rc == 0) ? cfs->TruncateFile(h->file,call.rec.size)
+				 : rc;
+	case CFS_OP_OPEN:
+		return GetHandle(cfs,call.path,0,NULL);
+	case CFS_OP_CREATE:
+		return GetHandle(cfs,call.path,1,NULL);
+	case CFS_OP_READ:
+		rc = UseHandle(cfs,call.path,&h);
+		if (rc == 0) {
+			rc = h->wbuf->Flush();
+		}
+		if (rc != 0) {
+			return rc;
+		}
+		GrowBuffer(call.rec.size);
+		len = call.rec.size;
+		return cfs->ReadFile(h->file,call.rec.offset,io_buf,len);
+	case CFS_OP_WRITE:
+		rc = UseHandle(cfs,call.path,&h);
+		if (rc != 0) {
+			return rc;
+		}
+		GrowBuffer(call.rec.size);
+		return h->wbuf->Write(call.rec.offset,io_buf,call.rec.size);
+	case CFS_OP_FLUSH:
+	case CFS_OP_FSYNC:
+		h = FindHandle(call.path);
+		return h ? h->wbuf->Flush() : 0;
+	case CFS_OP_RELEASE:
+		h = FindHandle(call.path);
+		return h ? PutHandle(cfs,call.path,h) : 0;
+	case CFS_OP_STATFS:
+		return cfs->Statfs(&st);
+	case CFS_OP_OPENDIR:
+		return cfs->ReadDir(path,rddata);
+	}
+	// Listing comes from what opendir read; releasedir does nothing.
+	return 0;
+}
+
+static void
+WaitUntil (uint64_t when)
+{
+	uint64_t	now	= CfsNowNs();
+	struct timespec	ts;
+	
+	if (now >= when) {
+		return;
+	}
+	ts.tv_sec = (when - now) / 1000000000;
+	ts.tv_nsec = (when - now) % 1000000000;
+	(void)nanosleep(&ts,NULL);
+}
+
+static void
+PrintResults (uint64_t elapsed)
+{
+	OpResult *	res;
+	uint64_t	sum;
+	size_t		i;
+	int		op;
+	
+	printf("%-12s %8s %8s %12s %12s %12s\n","op","calls","mismatch",
+	       "traced_us","replay_us","replay_p99");
+	for (op = 0; op < CFS_OP_BE_GET; ++op) {
+		res = &results[op];
+		if (res->lat.empty()) {
+			continue;
+		}
+		sum = 0;
+		for (i = 0; i < res->lat.size(); ++i) {
+			sum += res->lat[i];
+		}
+		sort(res->lat.begin(),res->lat.end());
+		printf("%-12s %8lu %8lu %12.1f %12.1f %12.1f\n",
+		       CfsStatOpName(op),(unsigned long)res->lat.size(),
+		       res->mismatches,
+		       res->traced_ns / 1000.0 / res->lat.size(),
+		       sum / 1000.0 / res->lat.size(),
+		       res->lat[res->lat.size() * 99 / 100] / 1000.0);
+	}
+	printf("%lu calls in %.3f s (traced: %.3f s)\n",
+	       (unsigned long)calls.size(),elapsed / 1e9,
+	       calls.empty() ? 0.0 : (calls.back().rec.start_ns
+				      + calls.back().rec.dur_ns) / 1e9);
+}
+
+static int
+ExitWithUsage (char * prog)
+{
+	fprintf(stderr,"Usage: %s [options] tracefile\n",prog);
+	fprintf(stderr,"  -c host:port   use Cassandra, not an in-memory store\n");
+	fprintf(stderr,"  -l spec        simulated latency, e.g. fixed:500/bw:100\n");
+	fprintf(stderr,"  -F name        filesystem to (re)make (replay)\n");
+	fprintf(stderr,"  -s speed       times recorded pace, 0 for flat out (1)\n");
+	fprintf(stderr,"  -p writers     write pipeline threads (none)\n");
+	return EINVAL;
+}
+
+int
+main (int argc, char ** argv)
+{
+	CfsConnector *			connector	= NULL;
+	const char *			backend		= "mem";
+	const char *			latency		= NULL;
+	CfsLatencySpec			lspec;
+	char *				fs_name		= (char *)"replay";
+	double				speed		= 1.0;
+	int				writers		= 0;
+	CassFs *			cfs;
+	map<string,Handle *>::iterator	it;
+	uint64_t			start;
+	uint64_t			begin;
+	char *				colon;
+	size_t				i;
+	int				opt;
+	int				rc;
+	
+	while ((opt = getopt(argc,argv,"c:l:F:s:p:")) != -1) {
+		switch (opt) {
+		case 'c':
+			backend = optarg;
+			colon = strchr(optarg,':');
+			if (!colon) {
+				return ExitWithUsage(argv[0]);
+			}
+			connector = new CfsThriftConnector(
+				string(optarg,colon-optarg).c_str(),
+				atoi(colon+1));
+			break;
+		case 'l':
+			latency = optarg;
+			if (CfsParseLatency(latency,&lspec) != 0) {
+				fprintf(stderr,"bad latency spec %s\n",latency);
+				return ExitWithUsage(argv[0]);
+			}
+			break;
+		case 'F':
+			fs_name = optarg;
+			break;
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'p':
+			writers = atoi(optarg);
+			break;
+		default:
+			return ExitWithUsage(argv[0]);
+		}
+	}
+	if ((optind != argc - 1) || (speed < 0)) {
+		return ExitWithUsage(argv[0]);
+	}
+	
+	rc = LoadTrace(argv[optind]);
+	if (rc != 0) {
+		return rc;
+	}
+	FindExisting();
+	
+	if (!connector) {
+		connector = new CfsMemConnector();
+	}
+	if (latency) {
+		connector = new CfsLatencyConnector(connector,true,lspec);
+	}
+	cfs_log_level = CFS_LOG_WARN;	// no superblock dumps, please
+	try {
+		cfs = new CassFs(connector);
+	}
+	catch (TException &tx) {
+		fprintf(stderr,"can't connect to %s: %s\n",backend,tx.what());
+		return EIO;
+	}
+	rc = cfs->Mkfs(fs_name);
+	if (rc == 0) {
+		rc = cfs->MountFs(fs_name);
+	}
+	if ((rc == 0) && writers) {
+		rc = cfs->StartPipeline(writers,4*writers);
+	}
+	if (rc != 0) {
+		fprintf(stderr,"mkfs/mount failed: %s\n",strerror(rc));
+		return rc;
+	}
+	GrowBuffer(FILL_SIZE);
+	rc = MakeExisting(cfs);
+	if (rc != 0) {
+		return rc;
+	}
+	printf("%lu calls, %lu paths already there\n",
+	       (unsigned long)calls.size(),(unsigned long)existing.size());
+	
+	begin = CfsNowNs();
+	for (i = 0; i < calls.size(); ++i) {
+		const CfsTraceRec &	rec	= calls[i].rec;
+	
+		if (speed > 0) {
+			WaitUntil(begin + (uint64_t)(rec.start_ns / speed));
+		}
+		start = CfsNowNs();
+		rc = Replay(cfs,calls[i]);
+		results[rec.op].lat.push_back(CfsNowNs()-start);
+		results[rec.op].traced_ns += rec.dur_ns;
+		if ((rec.result < 0) != (rc != 0)) {
+			++results[rec.op].mismatches;
+		}
+	}
+	rc = 0;
+	for (it = handles.begin(); it != handles.end(); ++it) {
+		if (it->second->wbuf->Flush() != 0) {
+			rc = EIO;
+		}
+		CloseHandle(cfs,it->second);
+	}
+	handles.clear();
+	PrintResults(CfsNowNs()-begin);
+	
+	delete cfs;
+	delete connector;
+	delete [] io_buf;
+	return rc;
+}
@@ -0,0 +1,287 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+using namespace std;
+
+struct CfsStatSet {
+	uint64_t	hist[CFS_OP_COUNT][CFS_HIST_BUCKETS];
+	uint64_t	total_ns[CFS_OP_COUNT];
+	uint64_t	ctrs[CFS_CTR_COUNT];
+};
+
+// Each thread's set stays on the list for good, so its numbers outlive
+// it; a thread that exits hands its set on to the next one to start.
+struct CfsThreadStats {
+	CfsStatSet	set;
+	CfsThreadStats *	next;
+	CfsThreadStats *	next_free;
+};
+
+static __thread CfsThreadStats *	my_stats;
+static pthread_key_t			stats_key;
+static pthread_once_t			stats_once	= PTHREAD_ONCE_INIT;
+static pthread_mutex_t			stats_lock	=
+	PTHREAD_MUTEX_INITIALIZER;
+static CfsThreadStats *			all_stats;
+static CfsThreadStats *			free_stats;
+static CfsStatSet *			baseline;
+static uint64_t				baseline_time;
+
+static const char *	op_names[CFS_OP_COUNT] = {
+	"getattr", "mknod", "mkdir", "unlink", "rmdir", "rename",
+	"truncate", "open", "create", "read", "write", "flush", "release",
+	"fsync", "statfs", "opendir", "readdir", "releasedir",
+	"be_get", "be_get_slice", "be_multiget", "be_multiget_slice",
+	"be_get_count", "be_get_key_range", "be_insert", "be_batch_insert",
+	"be_remove"
+};
+
+static const char *	ctr_names[CFS_CTR_COUNT] = {
+	"read_bytes", "write_bytes", "be_bytes_in", "be_bytes_out",
+	"be_not_found", "be_errors", "handle_hits", "handle_misses",
+	"pages_kept", "pages_dropped"
+};
+
+static void
+ReleaseStats (void * arg)
+{
+	CfsThreadStats *	ts	= (CfsThreadStats *)arg;
+	
+	pthread_mutex_lock(&stats_lock);
+	ts->next_free = free_stats;
+	free_stats = ts;
+	pthread_mutex_unlock(&stats_lock);
+	my_stats = NULL;
+}
+
+static void
+MakeKey (void)
+{
+	(void)pthread_key_create(&stats_key,ReleaseStats);
+}
+
+static CfsStatSet *
+MyStats (void)
+{
+	if (!my_stats) {
+		(void)pthread_once(&stats_once,MakeKey);
+		pthread_mutex_lock(&stats_lock);
+		if (free_stats) {
+			my_stats = free_stats;
+			free_stats = free_stats->next_free;
+		}
+		else {
+			my_stats = new CfsThreadStats;
+			memset(&my_stats->set,0,sizeof(my_stats->set));
+			my_stats->next = all_stats;
+			all_stats = my_stats;
+		}
+		pthread_mutex_unlock(&stats_lock);
+		(void)pthread_setspecific(stats_key,my_stats);
+	}
+	return &my_stats->set;
+}
+
+static int
+Bucket (uint64_t ns)
+{
+	int	shift;
+	
+	if (ns < (1 << CFS_HIST_SUB_BITS)) {
+		return ns;
+	}
+	shift = 63 - __builtin_clzll(ns) - CFS_HIST_SUB_BITS;
+	if (shift > CFS_HIST_MAX_SHIFT) {
+		return CFS_HIST_BUCKETS - 1;
+	}
+	return (shift << CFS_HIST_SUB_BITS) + (ns >> shift);
+}
+
+// The highest value that lands in bucket b.
+static uint64_t
+BucketTop (int b)
+{
+	int	shift	= (b >> CFS_HIST_SUB_BITS) - 1;
+	
+	if (shift <= 0) {
+		return b;
+	}
+	return ((uint64_t)((b & ((1 << CFS_HIST_SUB_BITS) - 1))
+			   + (1 << CFS_HIST_SUB_BITS) + 1) << shift) - 1;
+}
+
+void
+CfsStatRecord (int op, uint64_t ns)
+{
+	CfsStatSet *	set	= MyStats();
+	
+	++set->hist[op][Bucket(ns)];
+	set->total_ns[op] += ns;
+}
+
+void
+CfsStatCount (int ctr, uint64_t n)
+{
+	MyStats()->ctrs[ctr] += n;
+}
+
+// Adds up every thread's numbers, less those in less (if any).  Caller
+// holds stats_lock.
+static void
+Collect (CfsStatSet * sum, CfsStatSet * less)
+{
+	CfsThreadStats *	ts;
+	uint64_t *		dst	= (uint64_t *)sum;
+	uint64_t *		src;
+	size_t			n	= sizeof(*sum) / sizeof(uint64_t);
+	size_t			i;
+	
+	memset(sum,0,sizeof(*sum));
+	for (ts = all_stats; ts; ts = ts->next) {
+		src = (uint64_t *)&ts->set;
+		for (i = 0; i < n; ++i) {
+			dst[i] += src[i];
+		}
+	}
+	if (less) {
+		src = (uint64_t *)less;
+		for (i = 0; i < n; ++i) {
+			dst[i] -= src[i];
+		}
+	}
+}
+
+static double
+Percentile (uint64_t * hist, uint64_t count, double pct)
+{
+	uint64_t	want	= (uint64_t)(count * pct / 100.0);
+	uint64_t	seen	= 0;
+	int		b;
+	
+	for (b = 0; b < CFS_HIST_BUCKETS; ++b) {
+		seen += hist[b];
+		if (seen > want) {
+			break;
+		}
+	}
+	if (b == CFS_HIST_BUCKETS) {
+		--b;
+	}
+	return BucketTop(b) / 1000.0;
+}
+
+void
+CfsStatsRender (string & out)
+{
+	CfsStatSet *	sum	= new CfsStatSet;
+	char		line[160];
+	uint64_t	count;
+	int		op;
+	int		b;
+	int		top;
+	
+	pthread_mutex_lock(&stats_lock);
+	Collect(sum,baseline);
+	out.clear();
+	if (baseline_time) {
+		snprintf(line,sizeof(line),"# %.1f seconds since reset\n",
+			 (CfsNowNs() - baseline_time) / 1e9);
+		out = line;
+	}
+	pthread_mutex_unlock(&stats_lock);
+	
+	snprintf(line,sizeof(line),"%-18s %10s %10s %10s %10s %10s %10s %10s\n",
+		 "op","count","mean_us","p50_us","p90_us","p99_us",
+		 "p99.9_us","max_us");
+	out += line;
+	for (op = 0; op < CFS_OP_COUNT; ++op) {
+		count = 0;
+		top = 0;
+		for (b = 0; b < CFS_HIST_BUCKETS; ++b) {
+			if (sum->hist[op][b]) {
+				count += sum->hist[op][b];
+				top = b;
+			}
+		}
+		if (!count) {
+			snprintf(line,sizeof(line),"%-18s %10d\n",op_names[op],
+				 0);
+			out += line;
+			continue;
+		}
+		snprintf(line,sizeof(line),
+			 "%-18s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			 op_names[op],(unsigned long long)count,
+			 sum->total_ns[op] / 1000.0 / count,
+			 Percentile(sum->hist[op],count,50),
+			 Percentile(sum->hist[op],count,90),
+			 Percentile(sum->hist[op],count,99),
+			 Percentile(sum->hist[op],count,99.9),
+			 BucketTop(top) / 1000.0);
+		out += line;
+	}
+	
+	for (b = 0; b < CFS_CTR_COUNT; ++b) {
+		snprintf(line,sizeof(line),"%-18s %10llu\n",ctr_names[b],
+			 (unsigned long long)sum->ctrs[b]);
+		out += line;
+	}
+	delete sum;
+}
+
+void
+CfsStatsReset (void)
+{
+	CfsStatSet *	sum	= new CfsStatSet;
+	
+	pthread_mutex_lock(&stats_lock);
+	Collect(sum,NULL);
+	delete baseline;
+	baseline = sum;
+	baseline_time = CfsNowNs();
+	pthread_mutex_unlock(&stats_lock);
+}
+
+uint64_t
+CfsStatOpCount (int op)
+{
+	CfsStatSet *	sum	= new CfsStatSet;
+	uint64_t	count	= 0;
+	int		b;
+	
+	pthread_mutex_lock(&stats_lock);
+	Collect(sum,baseline);
+	pthread_mutex_unlock(&stats_lock);
+	for (b = 0; b < CFS_HIST_BUCKETS; ++b) {
+		count += sum->hist[op][b];
+	}
+	delete sum;
+	return count;
+}
+
+const char *
+CfsStatOpName (int op)
+{
+	return op_names[op];
+}
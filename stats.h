@@ -0,0 +1,106 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Operation latencies and counters, kept per thread so that recording one
+// is a few plain increments: no locks, no shared cache lines.  Latencies go
+// into log-linear histograms (in the style of HdrHistogram) with eight
+// buckets per power of two, i.e. to within 12.5%, from 1ns up to about 18
+// minutes.  CfsStatsRender adds up every thread's numbers.  A reset just
+// takes a snapshot to subtract from then on, so it never races the
+// threads doing the recording.
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+enum {
+	// FUSE callbacks (fuse.cpp)
+	CFS_OP_GETATTR,
+	CFS_OP_MKNOD,
+	CFS_OP_MKDIR,
+	CFS_OP_UNLINK,
+	CFS_OP_RMDIR,
+	CFS_OP_RENAME,
+	CFS_OP_TRUNCATE,
+	CFS_OP_OPEN,
+	CFS_OP_CREATE,
+	CFS_OP_READ,
+	CFS_OP_WRITE,
+	CFS_OP_FLUSH,
+	CFS_OP_RELEASE,
+	CFS_OP_FSYNC,
+	CFS_OP_STATFS,
+	CFS_OP_OPENDIR,
+	CFS_OP_READDIR,
+	CFS_OP_RELEASEDIR,
+	// Cassandra calls (CfsTimedClient)
+	CFS_OP_BE_GET,
+	CFS_OP_BE_GET_SLICE,
+	CFS_OP_BE_MULTIGET,
+	CFS_OP_BE_MULTIGET_SLICE,
+	CFS_OP_BE_GET_COUNT,
+	CFS_OP_BE_GET_KEY_RANGE,
+	CFS_OP_BE_INSERT,
+	CFS_OP_BE_BATCH_INSERT,
+	CFS_OP_BE_REMOVE,
+	CFS_OP_COUNT
+};
+
+enum {
+	CFS_CTR_READ_BYTES,		// returned by read
+	CFS_CTR_WRITE_BYTES,		// accepted by write
+	CFS_CTR_BE_BYTES_IN,		// column values fetched
+	CFS_CTR_BE_BYTES_OUT,		// column values stored
+	CFS_CTR_BE_NOT_FOUND,		// NotFoundException, often expected
+	CFS_CTR_BE_ERRORS,		// any other exception
+	CFS_CTR_HANDLE_HITS,		// opens that found the file open
+	CFS_CTR_HANDLE_MISSES,
+	CFS_CTR_PAGES_KEPT,		// keep_cache opens that kept pages
+	CFS_CTR_PAGES_DROPPED,
+	CFS_CTR_COUNT
+};
+
+#define CFS_HIST_SUB_BITS	3
+#define CFS_HIST_MAX_SHIFT	37	// 2^40ns and up share the last bucket
+#define CFS_HIST_BUCKETS	((CFS_HIST_MAX_SHIFT + 2) << CFS_HIST_SUB_BITS)
+
+void	CfsStatRecord	(int op, uint64_t ns);
+void	CfsStatCount	(int ctr, uint64_t n);
+void	CfsStatsRender	(std::string & out);
+void	CfsStatsReset	(void);
+uint64_t	CfsStatOpCount	(int op);	// since the last reset
+const char *	CfsStatOpName	(int op);
+
+static inline uint64_t
+CfsNowNs (void)
+{
+	struct timespec	ts;
+	
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Times the rest of the enclosing scope as one op.
+class CfsTimer {
+private:
+	int		op;
+	uint64_t	start;
+public:
+		CfsTimer	(int an_op) : op(an_op), start(CfsNowNs()) {}
+		~CfsTimer	() { CfsStatRecord(op,CfsNowNs()-start); }
+};
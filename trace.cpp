@@ -0,0 +1,144 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "trace.h"
+
+using namespace std;
+
+#define CFS_TRACE_BUFFER	(1 << 20)
+
+static FILE *		trace_fp;
+static pthread_mutex_t	trace_lock	= PTHREAD_MUTEX_INITIALIZER;
+static uint64_t		trace_base;
+static int		exit_hooked;
+
+int
+CfsTraceStart (const char * path)
+{
+	CfsTraceHeader	hdr;
+	
+	trace_fp = fopen(path,"w");
+	if (!trace_fp) {
+		return errno;
+	}
+	(void)setvbuf(trace_fp,NULL,_IOFBF,CFS_TRACE_BUFFER);
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,CFS_TRACE_MAGIC,sizeof(hdr.magic));
+	hdr.version = CFS_TRACE_VERSION;
+	hdr.rec_size = sizeof(CfsTraceRec);
+	// Flushed now, so a fork (e.g. to daemonize) can't write it twice.
+	if ((fwrite(&hdr,sizeof(hdr),1,trace_fp) != 1)
+	    || (fflush(trace_fp) != 0)) {
+		fclose(trace_fp);
+		trace_fp = NULL;
+		return EIO;
+	}
+	trace_base = CfsNowNs();
+	if (!exit_hooked) {
+		exit_hooked = 1;
+		(void)atexit(CfsTraceStop);
+	}
+	return 0;
+}
+
+void
+CfsTraceAdd (int op, const char * path, const char * path2,
+	     uint64_t offset, uint64_t size, int result, uint64_t start_ns,
+	     uint64_t end_ns)
+{
+	CfsTraceRec	rec;
+	
+	memset(&rec,0,sizeof(rec));
+	rec.start_ns = start_ns - trace_base;
+	rec.dur_ns = end_ns - start_ns;
+	rec.offset = offset;
+	rec.size = size;
+	rec.result = result;
+	rec.op = op;
+	rec.path_len = path ? strlen(path) : 0;
+	rec.path2_len = path2 ? strlen(path2) : 0;
+	
+	pthread_mutex_lock(&trace_lock);
+	if (trace_fp) {
+		fwrite(&rec,sizeof(rec),1,trace_fp);
+		fwrite(path,1,rec.path_len,trace_fp);
+		fwrite(path2,1,rec.path2_len,trace_fp);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void
+CfsTraceStop (void)
+{
+	pthread_mutex_lock(&trace_lock);
+	if (trace_fp) {
+		fclose(trace_fp);
+		trace_fp = NULL;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+FILE *
+CfsTraceOpen (const char * path)
+{
+	FILE *		fp;
+	CfsTraceHeader	hdr;
+	
+	fp = fopen(path,"r");
+	if (!fp) {
+		return NULL;
+	}
+	if ((fread(&hdr,sizeof(hdr),1,fp) != 1)
+	    || memcmp(hdr.magic,CFS_TRACE_MAGIC,sizeof(hdr.magic))
+	    || (hdr.version != CFS_TRACE_VERSION)
+	    || (hdr.rec_size != sizeof(CfsTraceRec))) {
+		fclose(fp);
+		errno = EINVAL;
+		return NULL;
+	}
+	return fp;
+}
+
+static bool
+ReadString (FILE * fp, size_t len, string & out)
+{
+	out.resize(len);
+	return !len || (fread(&out[0],len,1,fp) == 1);
+}
+
+int
+CfsTraceRead (FILE * fp, CfsTraceRec * rec, string & path, string & path2)
+{
+	size_t	got;
+	
+	got = fread(rec,1,sizeof(*rec),fp);
+	if (got != sizeof(*rec)) {
+		return got ? -1 : 0;
+	}
+	if (!ReadString(fp,rec->path_len,path)
+	    || !ReadString(fp,rec->path2_len,path2)) {
+		return -1;
+	}
+	return 1;
+}
@@ -0,0 +1,63 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Recorded FUSE calls, so that a real workload can be replayed offline
+// (see replay.cpp).  A trace file is a CfsTraceHeader, then one
+// CfsTraceRec per call, each followed by its path and, for rename, the new
+// path (neither one NUL-terminated).  Numbers are in host byte order, and
+// ops are CFS_OP_* (see stats.h).  Recording is a buffered write under a
+// lock, so it's cheap but not free; the daemon only does it when asked.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#define CFS_TRACE_MAGIC		"CFSTRACE"
+#define CFS_TRACE_VERSION	1
+
+typedef struct {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	rec_size;	// sizeof(CfsTraceRec)
+} CfsTraceHeader;
+
+typedef struct {
+	uint64_t	start_ns;	// since recording started
+	uint64_t	dur_ns;
+	uint64_t	offset;		// read, write, readdir
+	uint64_t	size;		// read, write, truncate
+	int32_t		result;		// as returned to FUSE
+	uint16_t	op;
+	uint16_t	path_len;
+	uint16_t	path2_len;	// rename only
+	uint16_t	spare[3];
+} CfsTraceRec;
+
+// Recording.  CfsTraceStart returns an errno.
+int	CfsTraceStart	(const char * path);
+void	CfsTraceAdd	(int op, const char * path, const char * path2,
+			 uint64_t offset, uint64_t size, int result,
+			 uint64_t start_ns, uint64_t end_ns);
+void	CfsTraceStop	(void);
+
+// Reading back.  CfsTraceOpen returns NULL (with errno set) if the file
+// can't be read or isn't a trace of this version.  CfsTraceRead returns 1
+// for a record, 0 at the end, and -1 if the file is cut short.
+FILE *	CfsTraceOpen	(const char * path);
+int	CfsTraceRead	(FILE * fp, CfsTraceRec * rec, std::string & path,
+			 std::string & path2);
@@ -0,0 +1,138 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <iostream>
+
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TTransportUtils.h>
+#include "Cassandra.h"
+#include "cfs_types.h"
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace org::apache::cassandra;
+
+#include "connect.h"
+#include "cassfs.h"
+#include "log.h"
+#include "writebuf.h"
+
+static double
+Now (void)
+{
+	struct timeval	tv;
+	
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+CfsWriteBuffer::CfsWriteBuffer (CassFs * a_cfs, CfsFile * a_file) :
+	cfs(a_cfs), file(a_file), start(0), born(0), error(0)
+{
+}
+
+CfsWriteBuffer::~CfsWriteBuffer ()
+{
+	if (!data.empty()) {
+		CFS_ERROR("discarding " << data.size() << " unflushed bytes for "
+		          << file->inode_key);
+	}
+}
+
+int
+CfsWriteBuffer::Write (cfs_offset_t off, const char * buf, cfs_size_t len)
+{
+	cfs_size_t	bsize		= cfs->BlockSize();
+	cfs_offset_t	end		= off + len;
+	cfs_offset_t	boundary;
+	int		rc;
+	
+	if (!data.empty() && (off != (start + data.size()))) {
+		rc = Flush();
+		if (rc != 0) {
+			return rc;
+		}
+	}
+	if (data.empty()) {
+		start = off;
+		born = Now();
+	}
+	
+	boundary = end & ~(bsize - 1);
+	if (boundary <= start) {
+		data.append(buf,len);	// still inside one block
+		return 0;
+	}
+	
+	// Send everything up to the last block boundary.  If nothing was
+	// pending, that can come straight from the caller's buffer.
+	if (data.empty()) {
+		rc = cfs->WriteFile(file,off,(char *)buf,boundary-off);
+	}
+	else {
+		data.append(buf,boundary-off);
+		rc = cfs->WriteFile(file,start,&data[0],data.size());
+	}
+	data.assign(buf+(boundary-off),end-boundary);
+	start = boundary;
+	born = Now();
+	return rc;
+}
+
+int
+CfsWriteBuffer::Flush (void)
+{
+	int	rc	= error;
+	
+	error = 0;
+	if (!data.empty()) {
+		if (cfs->WriteFile(file,start,&data[0],data.size()) != 0) {
+			rc = EIO;
+		}
+		data.clear();
+	}
+	if ((cfs->SyncFile(file) != 0) && !rc) {
+		rc = EIO;
+	}
+	return rc;
+}
+
+// Called opportunistically; any error is kept for the next Flush.
+void
+CfsWriteBuffer::FlushIfOlder (double secs)
+{
+	int	rc;
+	
+	if (data.empty() || ((Now() - born) < secs)) {
+		return;
+	}
+	rc = cfs->WriteFile(file,start,&data[0],data.size());
+	if ((rc != 0) && !error) {
+		error = rc;
+	}
+	data.clear();
+}
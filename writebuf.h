@@ -0,0 +1,44 @@
+/*
+    This file is part of CassFS.
+    Copyright 2010 Jeff Darcy <jeff@pl.atyp.us>
+
+    CassFS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CassFS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with CassFS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Coalesces small contiguous writes to one file (e.g. 4 KB appends from
+// FUSE) so that they reach CassFs::WriteFile as whole blocks, instead of one
+// block read-modify-write plus inode rewrite per write call.  Data up to
+// the last block boundary goes out as soon as it's complete; the partial
+// tail waits for more data, Flush, or FlushIfOlder.  Flush also commits
+// the file (see CassFs::SyncFile).  As with any write-back cache, an error
+// writing deferred data is returned by a later Flush.
+
+class CfsWriteBuffer {
+private:
+	CassFs *	cfs;
+	CfsFile *	file;
+	string		data;		// pending bytes, starting at start
+	cfs_offset_t	start;
+	double		born;		// when data became non-empty
+	int		error;		// from a write nobody was waiting for
+	
+public:
+		CfsWriteBuffer	(CassFs * a_cfs, CfsFile * a_file);
+		~CfsWriteBuffer	();
+	int	Write		(cfs_offset_t off, const char * buf,
+				 cfs_size_t len);
+	int	Flush		(void);
+	void	FlushIfOlder	(double secs);
+	bool	Empty		(void) { return data.empty(); }
+};